@@ -0,0 +1,406 @@
+/*
+    Micro-benchmarks of the functions that sampler, filter and scope spend
+    their time in. Each benchmark runs over data generated from a fixed
+    seed, so results can be compared from one build to the next, and
+    reports the best time per operation over several rounds along with the
+    bytes and number of allocations per operation.
+
+    usage: scope_benchmarks [-n items] [-r rounds] [name...]
+
+    Only the benchmarks whose names contain one of the given names are run.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <chrono>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "convert_date.h"
+#include "line_io.h"
+#include "literal_scan.h"
+#include "parse_number.h"
+#include "pattern_set.h"
+#include "pipeline.h"
+#include "sample_output.h"
+
+static uint64_t allocations = 0;
+static uint64_t allocated_bytes = 0;
+
+void *operator new(size_t size)
+{
+    ++allocations;
+    allocated_bytes += size;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+// an output stream's buffer that discards what is written to it, so that
+// output stages are timed without the cost of a file
+class NullBuffer : public std::streambuf {
+    public:
+        NullBuffer() : bytes(0) { setp(buffer, buffer + sizeof(buffer)); }
+        uint64_t written() const { return bytes + (pptr() - pbase()); }
+
+    protected:
+        int overflow(int c)
+        {
+            bytes += pptr() - pbase();
+            setp(buffer, buffer + sizeof(buffer));
+            if (c != traits_type::eof()) {
+                *pptr() = c;
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+    private:
+        char buffer[65536];
+        uint64_t bytes;
+};
+
+static long items = 100000;
+static int rounds = 5;
+static std::vector<std::string> selected;
+static uint64_t sink = 0;      // results are added here so that no work is optimised away
+
+static uint32_t random_state = 12345;
+
+static uint32_t next_random()
+{
+    random_state = random_state * 1103515245 + 12345;
+    return random_state >> 8;
+}
+
+static bool wanted(const char *name)
+{
+    if (selected.empty()) {
+        return true;
+    }
+    for (size_t i = 0; i < selected.size(); ++i) {
+        if (strstr(name, selected[i].c_str())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// op performs ops operations and returns something derived from them
+template <class Op>
+static void run(const char *name, long ops, Op op)
+{
+    if (!wanted(name) || ops <= 0) {
+        return;
+    }
+    sink += op();   // warm up
+    double best = 0;
+    uint64_t round_allocations = 0;
+    uint64_t round_bytes = 0;
+    for (int r = 0; r < rounds; ++r) {
+        uint64_t allocations_before = allocations;
+        uint64_t bytes_before = allocated_bytes;
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        sink += op();
+        double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        if (r == 0 || ns < best) {
+            best = ns;
+        }
+        round_allocations = allocations - allocations_before;
+        round_bytes = allocated_bytes - bytes_before;
+    }
+    printf("%-32s %10.1f ns/op %10.1f B/op %8.2f allocs/op\n", name, best / ops, (double)round_bytes / ops,
+            (double)round_allocations / ops);
+}
+
+static std::string device_name(uint32_t n)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "conveyor%03u", n);
+    return buf;
+}
+
+static const char *state_names[] = { "stopped", "running", "fault", "starting", "stopping", "idle", "manual", "homing" };
+
+static std::string iso_time(uint32_t seconds, uint32_t micros)
+{
+    time_t t = 1672531200 + seconds;   // 2023-01-01T00:00:00Z
+    tm f;
+    gmtime_r(&t, &f);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%06uZ", f.tm_year + 1900, f.tm_mon + 1, f.tm_mday,
+            f.tm_hour, f.tm_min, f.tm_sec, micros);
+    return buf;
+}
+
+// lines as sampler writes them in the std format
+static std::vector<std::string> sample_lines(long count, bool with_dates)
+{
+    std::vector<std::string> lines(count);
+    uint64_t time = 0;
+    for (long i = 0; i < count; ++i) {
+        time += next_random() % 5000;
+        uint32_t device = next_random() % 250;
+        std::ostringstream line;
+        if (with_dates) {
+            line << iso_time(time / 1000000, time % 1000000);
+        }
+        else {
+            line << time;
+        }
+        if (next_random() % 4 == 0) {
+            line << "\t" << device_name(device) << ".motor\tvalue\t" << next_random() % 2000;
+        }
+        else {
+            uint32_t state = next_random() % 8;
+            line << "\t" << device_name(device) << "\t" << state_names[state] << "\t" << state;
+        }
+        lines[i] = line.str();
+    }
+    return lines;
+}
+
+static void sampler_benchmarks()
+{
+    std::vector<std::string> states;
+    for (int i = 0; i < 200; ++i) {
+        states.push_back(std::string(state_names[i % 8]) + "_" + device_name(i));
+    }
+    std::map<std::string, int> state_map;
+    int next_state = 0;
+    for (size_t i = 0; i < states.size(); ++i) {
+        lookupName(state_map, states[i], next_state);
+    }
+    run("sampler/lookupState", items, [&]() {
+        uint64_t total = 0;
+        for (long i = 0; i < items; ++i) {
+            total += lookupName(state_map, states[i % states.size()], next_state);
+        }
+        return total;
+    });
+
+    std::vector<std::string> devices(items < 250 ? 250 : items);
+    for (size_t i = 0; i < devices.size(); ++i) {
+        devices[i] = device_name(i) + ".property";
+    }
+    run("sampler/device-map-insert", items, [&]() {
+        std::map<std::string, int> device_map;
+        int next_device = 0;
+        for (long i = 0; i < items; ++i) {
+            lookupName(device_map, devices[i], next_device);
+        }
+        return (uint64_t)device_map.size();
+    });
+
+    std::vector<std::string> values(1024);
+    for (size_t i = 0; i < values.size(); ++i) {
+        for (int c = 0; c < 24; ++c) {
+            values[i] += next_random() % 16 == 0 ? (char)(next_random() % 32) + 1 : (char)(' ' + next_random() % 95);
+        }
+    }
+    run("sampler/escapeNonprintables", items, [&]() {
+        uint64_t total = 0;
+        for (long i = 0; i < items; ++i) {
+            total += escapeNonprintables(values[i & 1023].c_str()).length();
+        }
+        return total;
+    });
+
+    // as sampler does, the output stream is emptied before each message
+    std::stringstream output;
+    const char *date_formats[] = { "offset", "iso8601", "posix" };
+    for (int d = 0; d < 3; ++d) {
+        std::string name = std::string("sampler/timestamp-") + date_formats[d];
+        bool use_datetime = d > 0;
+        std::string date_format = date_formats[d];
+        run(name.c_str(), items, [&]() {
+            uint64_t total = 0;
+            for (long i = 0; i < items; ++i) {
+                output.str("");
+                output.clear();
+                timestamp(output, i * 1237, 1000, use_datetime, date_format);
+                total += output.tellp();
+            }
+            return total;
+        });
+    }
+
+    std::vector<std::string> properties(250);
+    for (size_t i = 0; i < properties.size(); ++i) {
+        properties[i] = devices[i] + ".motor";
+    }
+    const char *formats[] = { "std", "kv", "kvq" };
+    for (int f = 0; f < 3; ++f) {
+        SampleFormat format;
+        format.format = formats[f];
+        format.scale = 1000;
+        format.use_datetime = false;
+        format.date_format = "iso8601";
+        std::string name = std::string("sampler/format-") + formats[f];
+        run(name.c_str(), items, [&]() {
+            uint64_t total = 0;
+            for (long i = 0; i < items; ++i) {
+                output.str("");
+                output.clear();
+                const std::string &machine = devices[i % 250];
+                static const std::string prop("motor");
+                if (i % 4 == 0) {
+                    formatProperty(output, format, i * 1237, machine, prop, properties[i % 250], values[i & 1023]);
+                }
+                else {
+                    formatState(output, format, i * 1237, machine, state_names[i % 8], i % 8);
+                }
+                total += output.tellp();
+            }
+            return total;
+        });
+    }
+}
+
+static void filter_benchmarks()
+{
+    std::vector<std::string> lines = sample_lines(items, true);
+    const char *patterns[] = {
+        "conveyor0[0-4][0-9]\tfault", "conveyor1[0-9]{2}\\.motor", "\t(starting|stopping)\t", "value\t1[0-9]{3}$",
+        "conveyor2[0-4]7", "homing", "manual\t6", "conveyor00[0-9]\\.motor\tvalue\t[0-9]+$"
+    };
+    PatternSet combined;
+    LiteralScanner prefilter;
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); ++i) {
+        combined.add(patterns[i]);
+        prefilter.add(PatternSet::requiredLiteral(patterns[i]));
+    }
+    run("filter/patterns", items, [&]() {
+        uint64_t matched = 0;
+        for (long i = 0; i < items; ++i) {
+            matched += combined.match(lines[i].data(), lines[i].length()) >= 0;
+        }
+        return matched;
+    });
+    run("filter/prefilter", items, [&]() {
+        uint64_t candidates = 0;
+        for (long i = 0; i < items; ++i) {
+            candidates += prefilter.contains(lines[i].data(), lines[i].length());
+        }
+        return candidates;
+    });
+
+    LocalTimeConverter converter;
+    std::string updated;
+    run("filter/fix-time", items, [&]() {
+        uint64_t total = 0;
+        for (long i = 0; i < items; ++i) {
+            if (rewrite_time(lines[i].data(), lines[i].length(), converter, updated)) {
+                total += updated.length();
+            }
+        }
+        return total;
+    });
+
+    run("parse_8601_datetime", items, [&]() {
+        uint64_t total = 0;
+        for (long i = 0; i < items; ++i) {
+            DateTime dt;
+            if (parse_8601_datetime(lines[i].data(), lines[i].length(), dt) == none) {
+                total += dt.datetime.tm_sec + dt.frac_sec;
+            }
+        }
+        return total;
+    });
+}
+
+static void scope_benchmarks()
+{
+    std::vector<std::string> lines = sample_lines(items, false);
+    run("scope/parse", items, [&]() {
+        uint64_t total = 0;
+        LineField fields[4];
+        for (long i = 0; i < items; ++i) {
+            long event_time;
+            double value;
+            if (split_fields(lines[i].data(), lines[i].length(), fields, 4) == 4
+                    && parse_integer(fields[0].text, fields[0].len, event_time)
+                    && parse_number(fields[3].text, fields[3].len, value)) {
+                total += event_time + (uint64_t)value;
+            }
+        }
+        return total;
+    });
+
+    // scope's output stage in each of its modes, fed an Event per change
+    // in a different millisecond, as scope's readers do
+    std::vector<std::string> names;
+    for (int i = 0; i < 250; ++i) {
+        names.push_back(device_name(i));
+    }
+    struct Mode {
+        const char *name;
+        ScopeRows::Mode mode;
+    };
+    static const Mode modes[] = {
+        { "scope/emit", ScopeRows::dense_rows },
+        { "scope/emit-changes", ScopeRows::changed_columns },
+        { "scope/emit-runs", ScopeRows::column_runs },
+        { "scope/emit-vcd", ScopeRows::value_change_dump }
+    };
+    for (const Mode &mode : modes) {
+        run(mode.name, items, [&]() {
+            NullBuffer buffer;
+            std::ostream out(&buffer);
+            ScopeRows rows(out, mode.mode);
+            for (size_t i = 0; i < names.size(); ++i) {
+                rows.addColumn(names[i], i);
+            }
+            rows.start();
+            Event event;
+            for (long i = 0; i < items; ++i) {
+                uint32_t state = (i * 7) % 8;
+                const std::string &name = names[i % names.size()];
+                event.setValue(i * 1000, name.data(), name.length(), state_names[state], strlen(state_names[state]), state);
+                rows.process(event);
+            }
+            rows.finish();
+            return buffer.written();
+        });
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            items = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-h") == 0) {
+            std::cout << "usage: " << argv[0] << " [-n items] [-r rounds] [name...]\n";
+            return 0;
+        }
+        else {
+            selected.push_back(argv[i]);
+        }
+    }
+    if (rounds < 1) {
+        rounds = 1;
+    }
+    sampler_benchmarks();
+    filter_benchmarks();
+    scope_benchmarks();
+    std::cerr << "(" << sink << ")\n";
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "column_store.h"
+#include "hash_bytes.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+ColumnStore::ColumnStore() : dirty_count(0), row_stale(true), emit_names(false), emit_ids(true)
+{
+    rehash();
+}
+
+void ColumnStore::add(const std::string &name, int device_id)
+{
+    if (find(name.data(), name.length()) >= 0) {
+        return;
+    }
+    Column column;
+    column.name = name;
+    column.device_id = device_id;
+    column.id = 0;
+    column.value = 0;
+    std::vector<Column>::iterator pos = std::lower_bound(columns.begin(), columns.end(), column,
+        [](const Column &a, const Column &b) { return a.name < b.name; });
+    pos = columns.insert(pos, column);
+    format(*pos);
+    rehash();
+}
+
+// called as columns are added, which moves them, so everything indexed by
+// column is rebuilt
+void ColumnStore::rehash()
+{
+    size_t size = 16;
+    while (size < columns.size() * 2) {
+        size *= 2;
+    }
+    table.assign(size, -1);
+    hashes.resize(columns.size());
+    by_device.clear();
+    for (size_t i = 0; i < columns.size(); ++i) {
+        hashes[i] = hash_bytes(columns[i].name.data(), columns[i].name.length());
+        size_t slot = hashes[i] & (size - 1);
+        while (table[slot] >= 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = i;
+        int device = columns[i].device_id;
+        if (device >= 0) {
+            if ((size_t)device >= by_device.size()) {
+                by_device.resize(device + 1, -1);
+            }
+            by_device[device] = i;
+        }
+    }
+    size_t words = (columns.size() + 63) / 64;
+    dirty.assign(words, 0);
+    dirty_count = 0;
+    stale.assign(words, 0);
+    row_stale = true;
+}
+
+int ColumnStore::find(const char *name, size_t len) const
+{
+    uint64_t h = hash_bytes(name, len);
+    size_t mask = table.size() - 1;
+    for (size_t slot = h & mask; table[slot] >= 0; slot = (slot + 1) & mask) {
+        int idx = table[slot];
+        const std::string &column = columns[idx].name;
+        if (hashes[idx] == h && column.length() == len && memcmp(column.data(), name, len) == 0) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+int ColumnStore::findDevice(int device_id, const char *name, size_t len) const
+{
+    // the number is only trusted if the name agrees, as scope.dat may
+    // number devices differently from sampler
+    if (device_id >= 0 && (size_t)device_id < by_device.size()) {
+        int idx = by_device[device_id];
+        if (idx >= 0 && columns[idx].name.length() == len && memcmp(columns[idx].name.data(), name, len) == 0) {
+            return idx;
+        }
+    }
+    return find(name, len);
+}
+
+bool ColumnStore::update(int col, const char *state, size_t len, double value)
+{
+    Column &column = columns[col];
+    if (column.value == value && column.state.length() == len && memcmp(column.state.data(), state, len) == 0) {
+        return false;
+    }
+    column.state.assign(state, len);
+    column.id = (int)value;
+    column.value = value;
+    uint64_t bit = 1ULL << (col & 63);
+    if (!(dirty[col >> 6] & bit)) {
+        dirty[col >> 6] |= bit;
+        ++dirty_count;
+    }
+    stale[col >> 6] |= bit;
+    row_stale = true;
+    return true;
+}
+
+int ColumnStore::nextDirty(int col) const
+{
+    size_t next = col + 1;
+    size_t word = next >> 6;
+    if (word >= dirty.size()) {
+        return -1;
+    }
+    uint64_t bits = dirty[word] & (~0ULL << (next & 63));
+    while (bits == 0) {
+        if (++word >= dirty.size()) {
+            return -1;
+        }
+        bits = dirty[word];
+    }
+    return (word << 6) + __builtin_ctzll(bits);
+}
+
+void ColumnStore::clearDirty()
+{
+    if (dirty_count) {
+        std::fill(dirty.begin(), dirty.end(), 0);
+        dirty_count = 0;
+    }
+}
+
+void ColumnStore::setFormat(bool names, bool ids)
+{
+    emit_names = names;
+    emit_ids = ids;
+    for (size_t i = 0; i < columns.size(); ++i) {
+        format(columns[i]);
+    }
+    std::fill(stale.begin(), stale.end(), 0);
+    row_stale = true;
+}
+
+void ColumnStore::format(Column &column)
+{
+    column.text.clear();
+    if (emit_names) {
+        column.text += '\t';
+        column.text += column.state;
+    }
+    if (emit_ids) {
+        char buf[16];
+        int n = snprintf(buf, sizeof(buf), "\t%d", column.id);
+        column.text.append(buf, n);
+    }
+}
+
+const std::string &ColumnStore::row()
+{
+    if (!row_stale) {
+        return row_text;
+    }
+    for (size_t word = 0; word < stale.size(); ++word) {
+        uint64_t bits = stale[word];
+        while (bits) {
+            format(columns[(word << 6) + __builtin_ctzll(bits)]);
+            bits &= bits - 1;
+        }
+        stale[word] = 0;
+    }
+    row_text.clear();
+    for (size_t i = 0; i < columns.size(); ++i) {
+        row_text += columns[i].text;
+    }
+    row_stale = false;
+    return row_text;
+}
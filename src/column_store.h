@@ -0,0 +1,80 @@
+#ifndef __column_store_h__
+#define __column_store_h__
+
+/*
+    The current state of each device that scope reports, one column per
+    device in name order. Device names are looked up in a hash table
+    without copying them into a std::string, or by sampler's device number
+    (see devices.dat) when events come from the shared memory ring, so an
+    update costs the same however many columns there are.
+
+    Columns that change are marked in a dirty bitset until the caller
+    clears it, and each column keeps its output text so that building a
+    row only formats the columns that changed.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class ColumnStore {
+    public:
+        ColumnStore();
+
+        // columns are kept in name order; a name already present is ignored
+        void add(const std::string &name, int device_id);
+
+        size_t size() const { return columns.size(); }
+        const std::string &name(size_t col) const { return columns[col].name; }
+        int deviceId(size_t col) const { return columns[col].device_id; }
+        const std::string &stateName(size_t col) const { return columns[col].state; }
+        int stateId(size_t col) const { return columns[col].id; }
+        double value(size_t col) const { return columns[col].value; }
+
+        // the column for a device, -1 if it is not reported
+        int find(const char *name, size_t len) const;
+        // as find() but using sampler's device number when it is known
+        int findDevice(int device_id, const char *name, size_t len) const;
+
+        // the state id is the value truncated to an integer; returns true
+        // if the column changed
+        bool update(int col, const char *state, size_t len, double value);
+
+        bool anyDirty() const { return dirty_count > 0; }
+        // the next changed column after col (start with -1), -1 when done
+        int nextDirty(int col) const;
+        void clearDirty();
+
+        // the text of each column after the time: a tab and the state name
+        // and/or a tab and the state id
+        void setFormat(bool names, bool ids);
+        const std::string &row();
+
+    private:
+        struct Column {
+            std::string name;
+            int device_id;
+            std::string state;
+            int id;
+            double value;
+            std::string text;   // output fragment
+        };
+
+        void rehash();
+        void format(Column &column);
+
+        std::vector<Column> columns;
+        std::vector<uint64_t> hashes;
+        std::vector<int> table;             // open addressing, column or -1
+        std::vector<int> by_device;         // device number to column or -1
+        std::vector<uint64_t> dirty;        // one bit per column
+        size_t dirty_count;
+        std::vector<uint64_t> stale;        // columns whose text must be formatted
+        bool row_stale;
+        bool emit_names;
+        bool emit_ids;
+        std::string row_text;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include "context_window.h"
+#include "convert_date.h"
+#include "line_io.h"
+#include <stdlib.h>
+#include <string.h>
+
+ContextWindow::ContextWindow(int64_t before_us, size_t capacity)
+    : before(before_us), buffer((char *)malloc(capacity)), capacity(capacity), tail(0), overflowed(0)
+{
+}
+
+ContextWindow::~ContextWindow()
+{
+    free(buffer);
+}
+
+void ContextWindow::expire(int64_t time)
+{
+    while (!entries.empty() && entries.front().time < time - before) {
+        entries.pop_front();
+    }
+}
+
+// find room for len bytes in one piece, dropping the oldest lines if
+// necessary. Lines are not split across the end of the buffer; the space
+// left there is skipped.
+bool ContextWindow::reserve(size_t len, size_t &pos)
+{
+    if (len > capacity) {
+        return false;
+    }
+    for (;;) {
+        if (entries.empty()) {
+            tail = 0;
+            pos = 0;
+            return true;
+        }
+        size_t head = entries.front().start;
+        if (tail > head) {
+            if (len <= capacity - tail) {
+                pos = tail;
+                return true;
+            }
+            if (len <= head) {
+                pos = 0;
+                return true;
+            }
+        }
+        else if (tail + len <= head) {
+            pos = tail;
+            return true;
+        }
+        entries.pop_front();
+        ++overflowed;
+    }
+}
+
+void ContextWindow::add(int64_t time, const char *line, size_t len)
+{
+    expire(time);
+    size_t pos;
+    if (!reserve(len + 1, pos)) {
+        ++overflowed;
+        return;
+    }
+    memcpy(buffer + pos, line, len);
+    buffer[pos + len] = '\n';
+    Entry entry = { time, pos, len + 1 };
+    entries.push_back(entry);
+    tail = pos + len + 1;
+}
+
+void ContextWindow::release(int64_t time, OutputBuffer &out, uint64_t &lines, uint64_t &bytes)
+{
+    expire(time);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        out.append(buffer + entries[i].start, entries[i].len);
+        bytes += entries[i].len;
+    }
+    lines += entries.size();
+    entries.clear();
+    tail = 0;
+}
+
+bool leading_time(const char *line, size_t len, int64_t unit_us, int64_t &usec)
+{
+    size_t field = 0;
+    while (field < len && line[field] != '\t' && line[field] != ' ') {
+        ++field;
+    }
+    if (field == 0) {
+        return false;
+    }
+    int64_t number = 0;
+    size_t i = 0;
+    while (i < field && line[i] >= '0' && line[i] <= '9') {
+        number = number * 10 + (line[i++] - '0');
+    }
+    if (i == field) {
+        usec = number * unit_us;
+        return true;
+    }
+    return parse_8601_usec(line, field, usec);
+}
@@ -0,0 +1,60 @@
+#ifndef __context_window_h__
+#define __context_window_h__
+
+/*
+    Keeps the recent lines of a stream so that the events leading up to a
+    trigger can be written out after the trigger has been seen. Lines are
+    held for a fixed time before they are discarded, in a ring of fixed
+    size, so memory use does not depend on the length of the stream; if
+    the lines of the window do not fit, the oldest are dropped early and
+    counted.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+
+class OutputBuffer;
+
+class ContextWindow {
+    public:
+        ContextWindow(int64_t before_us, size_t capacity);
+        ~ContextWindow();
+
+        // remember a line (without its newline) seen at time, in microseconds
+        void add(int64_t time, const char *line, size_t len);
+
+        // write out the lines no older than before_us at time and forget
+        // all of them; lines and bytes are increased by what was written
+        void release(int64_t time, OutputBuffer &out, uint64_t &lines, uint64_t &bytes);
+
+        size_t size() const { return entries.size(); }
+        uint64_t dropped() const { return overflowed; }
+
+    private:
+        struct Entry {
+            int64_t time;
+            size_t start;
+            size_t len;
+        };
+
+        void expire(int64_t time);
+        bool reserve(size_t len, size_t &pos);
+
+        int64_t before;
+        char *buffer;
+        size_t capacity;
+        size_t tail;    // where the next line is written
+        std::deque<Entry> entries;
+        uint64_t overflowed;
+
+        ContextWindow(const ContextWindow &);
+        ContextWindow &operator=(const ContextWindow &);
+};
+
+// the time of a line from its leading field: an ISO 8601 date and time
+// (UTC), or a number of units microseconds as written by sampler. false
+// if the line does not start with a time.
+bool leading_time(const char *line, size_t len, int64_t unit_us, int64_t &usec);
+
+#endif
@@ -4,6 +4,8 @@
 #include <string>
 #include <time.h>
 #include <iomanip>
+#include <stdio.h>
+#include <string.h>
 
 std::ostream &operator<<(std::ostream &out, const Term &term)
 {
@@ -57,183 +59,803 @@ void display(DateTime &datetime)
 
 Term parse_8601_datetime(const std::string &input, DateTime &result)
 {
-    struct Error {
-        Term term;
-        char ch;
+    return parse_8601_datetime(input.c_str(), input.length(), result);
+}
+
+// days since 1970-01-01 of a proleptic Gregorian date, month 1..12
+static long days_from_civil(long y, int m, int d)
+{
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days(long z, long &y, int &m, int &d)
+{
+    z += 719468;
+    long era = (z >= 0 ? z : z - 146096) / 146097;
+    long doe = z - era * 146097;
+    long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = yoe + era * 400 + (m <= 2);
+}
+
+time_t utc_seconds(const tm &t)
+{
+    long year = t.tm_year + 1900L;
+    long mon = t.tm_mon;
+    if (mon < 0 || mon > 11) {
+        year += mon / 12;
+        mon %= 12;
+        if (mon < 0) {
+            mon += 12;
+            --year;
+        }
+    }
+    return (time_t)(days_from_civil(year, mon + 1, 1) + t.tm_mday - 1) * 86400
+        + t.tm_hour * 3600L + t.tm_min * 60L + t.tm_sec;
+}
+
+/*
+    The fast path: the fixed width layouts
+        extended  YYYY-MM-DDTHH:MM:SS[.f...][Z|+hh:mm|+hhmm|+hh]
+        basic     YYYYMMDDTHHMMSS[.f...][Z|+hhmm|+hh]
+    (with T or a space between the date and time) are recognised by the
+    position of their separators, and all of their digits are checked at
+    once. As with the general parser the fraction is returned as the
+    digits written and whatever follows the time is ignored.
+*/
+struct Layout {
+    size_t length;
+    int mon, day, hour, min, sec;   // positions of the two digit fields
+};
+static const Layout extended_layout = { 19, 5, 8, 11, 14, 17 };
+static const Layout basic_layout = { 15, 4, 6, 9, 11, 13 };
+
+static inline bool is_digit(char c)
+{
+    return (unsigned char)(c - '0') <= 9;
+}
+
+// the value of two digits, negative if either is not a digit
+static inline int two_digits(const char *p)
+{
+    unsigned tens = (unsigned char)p[0] - '0';
+    unsigned units = (unsigned char)p[1] - '0';
+    return tens <= 9 && units <= 9 ? (int)(tens * 10 + units) : -1;
+}
+
+// reads a zone designator (Z, +hh, +hhmm or, if extended, +hh:mm) at p[i]
+// if there is one, advancing i past it. Sets offset to the seconds east of
+// UTC and returns none or the part of the zone that is not valid.
+static Term parse_zone(const char *p, size_t len, size_t &i, bool extended, long &offset)
+{
+    offset = 0;
+    if (i < len && p[i] == 'Z') {
+        ++i;
+    }
+    else if (i < len && (p[i] == '+' || p[i] == '-')) {
+        int sign = p[i++] == '-' ? -1 : 1;
+        if (i + 2 > len || !is_digit(p[i]) || !is_digit(p[i + 1])) {
+            return zonehr;
+        }
+        int zone_hours = (p[i] - '0') * 10 + p[i + 1] - '0';
+        int zone_mins = 0;
+        i += 2;
+        if (extended && i < len && p[i] == ':') {
+            ++i;
+            if (i + 2 > len || !is_digit(p[i]) || !is_digit(p[i + 1])) {
+                return zonemin;
+            }
+        }
+        if (i + 2 <= len && is_digit(p[i]) && is_digit(p[i + 1])) {
+            zone_mins = (p[i] - '0') * 10 + p[i + 1] - '0';
+            i += 2;
+        }
+        if (zone_hours > 23) {
+            return zonehr;
+        }
+        if (zone_mins > 59) {
+            return zonemin;
+        }
+        offset = sign * (zone_hours * 3600L + zone_mins * 60L);
+    }
+    return none;
+}
+
+// local time at the given offset to UTC
+static void to_utc(tm &time, long offset)
+{
+    if (!offset) {
+        return;
+    }
+    time_t utc = utc_seconds(time) - offset;
+    long days = utc / 86400;
+    long rem = utc % 86400;
+    if (rem < 0) {
+        rem += 86400;
+        --days;
+    }
+    long y;
+    int m, md;
+    civil_from_days(days, y, m, md);
+    time.tm_year = y - 1900;
+    time.tm_mon = m - 1;
+    time.tm_mday = md;
+    time.tm_hour = rem / 3600;
+    time.tm_min = rem / 60 % 60;
+    time.tm_sec = rem % 60;
+}
+
+// false if the input is not in one of the fixed layouts, otherwise term is
+// none or the field that is not valid
+static bool parse_fixed_layout(const char *p, size_t len, DateTime &result, Term &term)
+{
+    const Layout *layout;
+    if (len >= 19 && p[4] == '-' && p[7] == '-' && (p[10] == 'T' || p[10] == ' ') && p[13] == ':' && p[16] == ':') {
+        layout = &extended_layout;
+    }
+    else if (len >= 15 && (p[8] == 'T' || p[8] == ' ') && is_digit(p[4]) && is_digit(p[11])) {
+        layout = &basic_layout;
+    }
+    else {
+        return false;
+    }
+    int century = two_digits(p);
+    int year_digits = two_digits(p + 2);
+    int month = two_digits(p + layout->mon);
+    int mday = two_digits(p + layout->day);
+    int hours = two_digits(p + layout->hour);
+    int mins = two_digits(p + layout->min);
+    int secs_value = two_digits(p + layout->sec);
+    // a single test for all of the digits, and the ranges
+    if ((century | year_digits | month | mday | hours | mins | secs_value) < 0
+            || month < 1 || month > 12 || mday < 1 || mday > 31 || hours > 24 || mins > 59 || secs_value > 60) {
+        term = century < 0 || year_digits < 0 ? year
+            : month < 1 || month > 12 ? mon
+            : mday < 1 || mday > 31 ? day
+            : hours < 0 || hours > 24 ? hour
+            : mins < 0 || mins > 59 ? min
+            : secs;
+        return true;
+    }
+    term = none;
+    bool extended = layout == &extended_layout;
+    size_t i = layout->length;
+    tm time;
+    memset(&time, 0, sizeof(time));
+    time.tm_year = century * 100 + year_digits - 1900;
+    time.tm_mon = month - 1;
+    time.tm_mday = mday;
+    time.tm_hour = hours;
+    time.tm_min = mins;
+    time.tm_sec = secs_value;
+
+    int frac_sec = 0;
+    int frac_digits = 0;
+    if (i < len && (p[i] == '.' || p[i] == ',')) {
+        size_t start = ++i;
+        while (i < len && is_digit(p[i])) {
+            if (i - start == 9) {
+                return false;   // more than an int holds
+            }
+            frac_sec = frac_sec * 10 + p[i++] - '0';
+        }
+        frac_digits = i - start;
+    }
+    else if (i < len && is_digit(p[i])) {
+        return false;   // seconds with more than two digits
+    }
+
+    long offset;
+    Term zone = parse_zone(p, len, i, extended, offset);
+    if (zone != none) {
+        term = zone;
+        return true;
+    }
+    to_utc(time, offset);
+    result.datetime = time;
+    result.frac_sec = frac_sec;
+    result.frac_digits = frac_digits;
+    return true;
+}
+
+/*
+    The general parser, for the layouts the fast path does not recognise:
+    each field has a fixed number of digits and each separator may be
+    left out, so mixed layouts and reduced precision (a date alone, or a
+    time without seconds) are read as well. A zone offset is applied as
+    on the fast path.
+*/
+static Term parse_8601_general(const char *input, size_t len, DateTime &result)
+{
+    tm time;
+    memset(&time, 0, sizeof(time));
+    int frac_sec = 0;
+    int frac_digits = 0;
+    const char *p = input;
+    const char *q = p;
+    const char *end = input + len;
+    auto append_to = [](int &field, const char *p) {
+        field = field * 10 + *p - '0';
     };
-        Error error = {none, '\0'};
-    try {
-        tm time;
-        time.tm_year = 0;
-        time.tm_mon = 0;
-        time.tm_mday = 0;
-        time.tm_hour = 0;
-        time.tm_min = 0;
-        time.tm_sec = 0;
-        int frac_sec = 0;
-        const char *p = input.c_str();
-        const char *q = p;
-        auto append_to = [](int &field, const char *p) {
-            field = field * 10 + *p - '0';
-        };
-        char date_sep = '-';
-        char time_sep = ':';
-        auto skip = [&p]() { ++p; };
-        Term state = year;
-        while (*p) {
-            switch (state) {
-                case none:
-                    break;
-                case year:
-                    if (!isdigit(*p)) {
-                        error = {state, *p};
-                        break;
-                    }
-                    append_to(time.tm_year, p);
-                    if (p - q == 3) {
-                        q = p;
-                        state = monsep;
-                    }
-                    break;
-                case monsep:
-                    state = mon;
-                    if (*p == date_sep) { skip(); q=p; continue; }
-                    q=p;
-                    break;
-                case mon:
-                    if (!isdigit(*p)) {
-                        error = {state, *p};
-                        break;
-                    }
-                    append_to(time.tm_mon, p);
-                    if (p - q == 1) {
-                        q = p;
-                        state = daysep;
-                    }
-                    break;
-                case daysep:
-                    state = day;
-                    if (*p == date_sep) { skip(); q=p; continue; }
-                    q=p;
-                    break;
-                case day:
-                    if (!isdigit(*p)) {
-                        error= Error{state, *p};
-                        break;
-                    }
-                    append_to(time.tm_mday, p);
-                    if (p - q == 1) {
-                        q = p;
-                        state = timesep;
-                    }
-                    break;
-                case timesep:
-                    state = hour;
-                    if (*p == ' ' || *p == 'T') { skip(); q=p; continue; }
-                    q = p;
-                    break;
-                case hour:
-                    if (!isdigit(*p)) {
-                        error= Error{state, *p};
-                        break;
-                    }
-                    append_to(time.tm_hour, p);
-                    if (p - q == 1) {
-                        q = p;
-                        state = minsep;
-                    }
-                    break;
-                case minsep:
-                    state = min;
-                    if (*p == time_sep) { skip(); q=p; continue; }
-                    q=p;
-                    break;
-                case min:
-                    if (!isdigit(*p)) {
-                        error= Error{state, *p};
-                        break;
-                    }
-                    append_to(time.tm_min, p);
-                    if (p - q == 1) {
-                        q = p;
-                        state = secsep;
-                    }
-                    break;
-                case secsep:
-                    state = secs;
-                    if (*p == time_sep) { skip(); q=p; break; }
-                    q=p;
-                    break;
-                case secs:
-                    if (!isdigit(*p)) {
-                        if (*p == '.') {
-                            state = fracsecs;
-                            break;
-                        }
-                        else if (*p == 'Z') {
-                            state = zonehr;
-                            break;
-                        }
-                        else if (isdigit(*p) && p - q > 2) {
-                        error= Error{state, *p};
-                            break;
-                        }
-                        else {
-                            state = none;
-                            break;
-                        }
+    const char date_sep = '-';
+    const char time_sep = ':';
+    // a separator state moves on to its field whether or not the
+    // separator is there; q marks the first digit of the field
+    Term state = year;
+    while (p < end && *p && state != zonesep) {
+        switch (state) {
+            case year:
+                if (!is_digit(*p)) {
+                    return state;
+                }
+                append_to(time.tm_year, p);
+                if (p - q == 3) {
+                    state = monsep;
+                }
+                break;
+            case monsep:
+                state = mon;
+                if (*p == date_sep) { ++p; }
+                q = p;
+                continue;
+            case mon:
+                if (!is_digit(*p)) {
+                    return state;
+                }
+                append_to(time.tm_mon, p);
+                if (p - q == 1) {
+                    state = daysep;
+                }
+                break;
+            case daysep:
+                state = day;
+                if (*p == date_sep) { ++p; }
+                q = p;
+                continue;
+            case day:
+                if (!is_digit(*p)) {
+                    return state;
+                }
+                append_to(time.tm_mday, p);
+                if (p - q == 1) {
+                    state = timesep;
+                }
+                break;
+            case timesep:
+                state = hour;
+                if (*p == ' ' || *p == 'T') { ++p; }
+                q = p;
+                continue;
+            case hour:
+                if (!is_digit(*p)) {
+                    return state;
+                }
+                append_to(time.tm_hour, p);
+                if (p - q == 1) {
+                    state = minsep;
+                }
+                break;
+            case minsep:
+                state = min;
+                if (*p == time_sep) { ++p; }
+                q = p;
+                continue;
+            case min:
+                if (!is_digit(*p)) {
+                    return state;
+                }
+                append_to(time.tm_min, p);
+                if (p - q == 1) {
+                    state = secsep;
+                }
+                break;
+            case secsep:
+                // the seconds may be left out
+                if (*p != time_sep && !is_digit(*p)) {
+                    state = zonesep;
+                    continue;
+                }
+                state = secs;
+                if (*p == time_sep) { ++p; }
+                q = p;
+                continue;
+            case secs:
+                if (!is_digit(*p)) {
+                    return state;
+                }
+                append_to(time.tm_sec, p);
+                if (p - q == 1) {
+                    ++p;
+                    if (p < end && is_digit(*p)) {
+                        return secs;
                     }
-                    append_to(time.tm_sec, p);
-                    break;
-                case fracsecs:
-                    if (!isdigit(*p)) {
-                        if (*p == 'Z') {
-                            state = zonehr;
-                            break;
-                        }
-                        else {
-                            state = none;
-                            break;
-                        }
+                    state = zonesep;
+                    if (p < end && (*p == '.' || *p == ',')) {
+                        ++p;
+                        state = fracsecs;
                     }
-                    append_to(frac_sec, p);
-                    break;
-                case zonesep:
-                    break;
-                case zonehr:
-                    state = none;
-                    break; // TODO
-                    break;
-                case zhmsep:
-                    break;
-                case zonemin:
-                    break;
-            }
-            if (state == none || error.term != none) {
+                    continue;
+                }
                 break;
+            case fracsecs:
+                if (!is_digit(*p)) {
+                    state = zonesep;
+                    continue;
+                }
+                if (++frac_digits > 9) {
+                    return state;   // more than an int holds
+                }
+                append_to(frac_sec, p);
+                break;
+            default:
+                break;
+        }
+        ++p;
+    }
+    // the input must not end part way through a field
+    switch (state) {
+        case timesep:
+        case minsep:
+        case secsep:
+        case fracsecs:
+        case zonesep:
+            break;
+        default:
+            return state;
+    }
+    if (time.tm_mon < 1 || time.tm_mon > 12) {
+        return mon;
+    }
+    if (time.tm_mday < 1 || time.tm_mday > 31) {
+        return day;
+    }
+    if (time.tm_hour > 24) {
+        return hour;
+    }
+    if (time.tm_min > 59) {
+        return min;
+    }
+    if (time.tm_sec > 60) {
+        return secs;
+    }
+    long offset = 0;
+    if (state == zonesep) {
+        size_t i = p - input;
+        Term zone = parse_zone(input, len, i, true, offset);
+        if (zone != none) {
+            return zone;
+        }
+    }
+    time.tm_year -= 1900;
+    time.tm_mon -= 1;
+    to_utc(time, offset);
+    result.datetime = time;
+    result.frac_sec = frac_sec;
+    result.frac_digits = frac_digits;
+    return none;
+}
+
+Term parse_8601_datetime(const char *input, size_t len, DateTime &result)
+{
+    Term term;
+    if (parse_fixed_layout(input, len, result, term)) {
+        return term;
+    }
+    return parse_8601_general(input, len, result);
+}
+
+bool parse_8601_usec(const char *input, size_t len, int64_t &usec)
+{
+    DateTime dt;
+    if (parse_8601_datetime(input, len, dt) != none) {
+        return false;
+    }
+    int64_t frac = dt.frac_sec;
+    int digits = dt.frac_digits;
+    for (; digits < 6; ++digits) {
+        frac *= 10;
+    }
+    for (; digits > 6; --digits) {
+        frac /= 10;
+    }
+    usec = (int64_t)utc_seconds(dt.datetime) * 1000000 + frac;
+    return true;
+}
+
+static long utc_offset(time_t t)
+{
+    tm local;
+    localtime_r(&t, &local);
+    return local.tm_gmtoff;
+}
+
+// transitions are assumed to be more than this far apart
+static const time_t probe_step = 7 * 86400;
+static const int max_probes = 53;
+
+LocalTimeConverter::LocalTimeConverter() : valid_from(1), valid_until(0), offset(0)
+{
+    memset(&zone, 0, sizeof(zone));
+}
+
+void LocalTimeConverter::lookup(time_t t)
+{
+    localtime_r(&t, &zone);
+    offset = zone.tm_gmtoff;
+
+    // step a week at a time to the next change of offset then bisect
+    time_t same = t;
+    time_t changed = t;
+    int i;
+    for (i = 0; i < max_probes; ++i) {
+        changed = same + probe_step;
+        if (utc_offset(changed) != offset) {
+            break;
+        }
+        same = changed;
+    }
+    if (i < max_probes) {
+        while (changed - same > 1) {
+            time_t mid = same + (changed - same) / 2;
+            if (utc_offset(mid) == offset) {
+                same = mid;
             }
-            ++p;
-        };
-        if (error.term != none) {
-            throw std::runtime_error("Unexpected character '" + std::string(1, error.ch) + "' at term: " + std::to_string(error.term));
+            else {
+                changed = mid;
+            }
+        }
+    }
+    valid_until = same + 1;
+
+    // and the same backwards to the previous change
+    same = t;
+    for (i = 0; i < max_probes; ++i) {
+        changed = same - probe_step;
+        if (utc_offset(changed) != offset) {
+            break;
         }
-        else if (!*p || state == none) {
-            time.tm_year -= 1900;
-            time.tm_mon -= 1;
-            result.datetime = time;
-            result.frac_sec = frac_sec;
+        same = changed;
+    }
+    if (i < max_probes) {
+        while (same - changed > 1) {
+            time_t mid = changed + (same - changed) / 2;
+            if (utc_offset(mid) == offset) {
+                same = mid;
+            }
+            else {
+                changed = mid;
+            }
         }
     }
-    catch (const std::exception &e) {
-        std::cerr << "Error: " << e.what() << std::endl;
-        return error.term;
+    valid_from = same;
+}
+
+void LocalTimeConverter::toLocal(const tm &utc, tm &local)
+{
+    time_t t = utc_seconds(utc);
+    if (t < valid_from || t >= valid_until) {
+        lookup(t);
+    }
+    time_t secs = t + offset;
+    long days = secs / 86400;
+    long rem = secs % 86400;
+    if (rem < 0) {
+        rem += 86400;
+        --days;
     }
-    return none;
+    long y;
+    int m, d;
+    civil_from_days(days, y, m, d);
+    local = zone;
+    local.tm_year = y - 1900;
+    local.tm_mon = m - 1;
+    local.tm_mday = d;
+    local.tm_hour = rem / 3600;
+    local.tm_min = rem / 60 % 60;
+    local.tm_sec = rem % 60;
+    local.tm_wday = ((days + 4) % 7 + 7) % 7;    // 1970-01-01 was a Thursday
+    local.tm_yday = days - days_from_civil(y, 1, 1);
+}
+
+static char *put_digits(char *p, unsigned int value, int width)
+{
+    for (int i = width - 1; i >= 0; --i) {
+        p[i] = '0' + value % 10;
+        value /= 10;
+    }
+    return p + width;
+}
+
+int LocalTimeConverter::format(const DateTime &utc, char *out, size_t size)
+{
+    tm t;
+    toLocal(utc.datetime, t);
+    int year = t.tm_year + 1900;
+    if (size < 27 || year < 0 || year > 9999 || utc.frac_sec < 0 || utc.frac_sec > 999999) {
+        return snprintf(out, size, "%04d-%02d-%02d %02d:%02d:%02d.%06d", year, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, utc.frac_sec);
+    }
+    char *p = put_digits(out, year, 4);
+    *p++ = '-';
+    p = put_digits(p, t.tm_mon + 1, 2);
+    *p++ = '-';
+    p = put_digits(p, t.tm_mday, 2);
+    *p++ = ' ';
+    p = put_digits(p, t.tm_hour, 2);
+    *p++ = ':';
+    p = put_digits(p, t.tm_min, 2);
+    *p++ = ':';
+    p = put_digits(p, t.tm_sec, 2);
+    *p++ = '.';
+    p = put_digits(p, utc.frac_sec, 6);
+    *p = 0;
+    return p - out;
+}
+
+// rewrite the leading UTC timestamp as local time into updated; false if
+// the line has none
+bool rewrite_time(const char *line, size_t len, LocalTimeConverter &converter, std::string &updated)
+{
+    DateTime dt;
+    auto error = parse_8601_datetime(line, len, dt);
+    if (error != none) {
+        return false;
+    }
+    char stamp[64];
+    int stamp_len = converter.format(dt, stamp, sizeof(stamp));
+    const char *data_start = (const char *)memchr(line, ' ', len);
+    if (data_start == nullptr) { data_start = (const char *)memchr(line, '\t', len); }
+    if (data_start == nullptr) {
+        data_start = line;
+    }
+    updated.assign(stamp, stamp_len);
+    updated.append(data_start, line + len - data_start);
+    return true;
 }
 
 #ifdef TESTING
+#include <chrono>
+#include <stdlib.h>
+#include <vector>
+
+// the conversion filter --fix-time made before LocalTimeConverter
+static int legacy_format(const DateTime &utc, char *out, size_t size)
+{
+    tm t = utc.datetime;
+    time_t local_time = timegm(&t);
+    localtime_r(&local_time, &t);
+    return snprintf(out, size, "%04d-%02d-%02d %02d:%02d:%02d.%06d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, utc.frac_sec);
+}
+
+static void make_time(time_t t, int frac_sec, DateTime &result)
+{
+    gmtime_r(&t, &result.datetime);
+    result.frac_sec = frac_sec;
+    result.frac_digits = 6;
+}
+
+// compare with the legacy conversion, then time both over count increasing
+// timestamps spanning two years. Set TZ to try other zones.
+static int benchmark(long count)
+{
+    LocalTimeConverter converter;
+    char expected[64];
+    char actual[64];
+    long mismatches = 0;
+
+    std::vector<DateTime> times(count);
+    const time_t start = 1672531200;   // 2023-01-01T00:00:00Z
+    const double step = 2 * 365 * 86400.0 / count;
+    for (long i = 0; i < count; ++i) {
+        make_time(start + (time_t)(i * step), i % 1000000, times[i]);
+    }
+
+    // random times, including fields timegm has to normalise
+    srandom(1);
+    for (long i = 0; i < 200000; ++i) {
+        DateTime dt;
+        make_time(random() % 2000000000L, random() % 1000000, dt);
+        if (i % 4 == 0) {
+            dt.datetime.tm_sec += random() % 120;
+            dt.datetime.tm_mday = random() % 32;
+            dt.datetime.tm_hour = random() % 30;
+        }
+        int n = legacy_format(dt, expected, sizeof(expected));
+        if (converter.format(dt, actual, sizeof(actual)) != n || strcmp(expected, actual) != 0) {
+            if (++mismatches <= 10) {
+                std::cerr << "mismatch: " << expected << " != " << actual << "\n";
+            }
+        }
+    }
+    for (long i = 0; i < count; ++i) {
+        int n = legacy_format(times[i], expected, sizeof(expected));
+        if (converter.format(times[i], actual, sizeof(actual)) != n || strcmp(expected, actual) != 0) {
+            if (++mismatches <= 10) {
+                std::cerr << "mismatch: " << expected << " != " << actual << "\n";
+            }
+        }
+    }
+
+    // a full --fix-time line rewrite: parse, convert and copy the rest
+    std::vector<std::string> lines(count);
+    for (long i = 0; i < count; ++i) {
+        const tm &t = times[i].datetime;
+        snprintf(actual, sizeof(actual), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, (int)(i % 1000));
+        lines[i] = actual;
+        lines[i] += " conveyor01.motor\tvalue\t42";
+    }
+
+    unsigned long checksum = 0;
+    std::string updated;
+    for (int pass = 0; pass < 2; ++pass) {
+        auto begin = std::chrono::steady_clock::now();
+        for (long i = 0; i < count; ++i) {
+            DateTime dt;
+            const std::string &line = lines[i];
+            if (parse_8601_datetime(line.data(), line.length(), dt) != none) {
+                continue;
+            }
+            int n = pass == 0 ? legacy_format(dt, actual, sizeof(actual)) : converter.format(dt, actual, sizeof(actual));
+            const char *rest = (const char *)memchr(line.data(), ' ', line.length());
+            updated.assign(actual, n);
+            updated.append(rest, line.data() + line.length() - rest);
+            checksum += updated.length();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << (pass == 0 ? "timegm/localtime_r/snprintf " : "LocalTimeConverter         ")
+            << (double)elapsed / count << " ns/line\n";
+    }
+    std::cout << count << " lines, " << mismatches << " mismatches (" << checksum << ")\n";
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static bool same_fields(const DateTime &a, const DateTime &b)
+{
+    return a.datetime.tm_year == b.datetime.tm_year && a.datetime.tm_mon == b.datetime.tm_mon
+        && a.datetime.tm_mday == b.datetime.tm_mday && a.datetime.tm_hour == b.datetime.tm_hour
+        && a.datetime.tm_min == b.datetime.tm_min && a.datetime.tm_sec == b.datetime.tm_sec
+        && a.frac_sec == b.frac_sec && a.frac_digits == b.frac_digits;
+}
+
+// a random timestamp in one of the layouts the fast path recognises,
+// without a zone offset unless with_offset is set, in which case offset
+// is set to the seconds east of UTC written
+static std::string random_timestamp(time_t &t, int &frac, long &offset, bool &basic, bool with_offset)
+{
+    t = random() % 4000000000L;
+    tm f;
+    gmtime_r(&t, &f);
+    basic = random() % 3 == 0;
+    char sep = random() % 4 == 0 ? ' ' : 'T';
+    char buf[80];
+    if (basic) {
+        snprintf(buf, sizeof(buf), "%04d%02d%02d%c%02d%02d%02d", f.tm_year + 1900, f.tm_mon + 1, f.tm_mday, sep, f.tm_hour, f.tm_min, f.tm_sec);
+    }
+    else {
+        snprintf(buf, sizeof(buf), "%04d-%02d-%02d%c%02d:%02d:%02d", f.tm_year + 1900, f.tm_mon + 1, f.tm_mday, sep, f.tm_hour, f.tm_min, f.tm_sec);
+    }
+    std::string text(buf);
+    frac = 0;
+    int digits = random() % 10;
+    if (digits) {
+        text += '.';
+        for (int i = 0; i < digits; ++i) {
+            int digit = random() % 10;
+            frac = frac * 10 + digit;
+            text += (char)('0' + digit);
+        }
+    }
+    offset = 0;
+    if (with_offset) {
+        int hours = random() % 15;
+        int mins = (random() % 4) * 15;
+        int sign = random() % 2 ? 1 : -1;
+        offset = sign * (hours * 3600L + mins * 60L);
+        snprintf(buf, sizeof(buf), basic ? "%c%02d%02d" : "%c%02d:%02d", sign > 0 ? '+' : '-', hours, mins);
+        text += buf;
+    }
+    else if (random() % 2) {
+        text += 'Z';
+    }
+    if (random() % 2) {
+        text += " conveyor01.motor\tvalue\t42";
+    }
+    return text;
+}
+
+// check both parsers against the time each timestamp was made from
+static int differential(long count)
+{
+    long mismatches = 0;
+    srandom(2);
+    for (long i = 0; i < count; ++i) {
+        time_t t;
+        int frac;
+        long offset;
+        bool basic;
+        std::string text = random_timestamp(t, frac, offset, basic, i % 2);
+        DateTime fast, general;
+        Term fast_term = parse_8601_datetime(text.data(), text.length(), fast);
+        Term general_term = parse_8601_general(text.data(), text.length(), general);
+        bool ok = fast_term == none && fast.frac_sec == frac && utc_seconds(fast.datetime) == t - offset
+            && general_term == none && same_fields(fast, general);
+        if (!ok && ++mismatches <= 10) {
+            std::cout << "mismatch: " << text << "\n";
+        }
+
+        // damage one character: each parser must either report an error or
+        // return fields in range (the fast path may also leave it to the
+        // general parser)
+        std::string damaged = text;
+        damaged[random() % damaged.length()] = (char)(random() % 128);
+        auto in_range = [](const DateTime &dt) {
+            const tm &d = dt.datetime;
+            return d.tm_mon >= 0 && d.tm_mon <= 11 && d.tm_mday >= 1 && d.tm_mday <= 31 && d.tm_hour <= 24
+                && d.tm_min <= 59 && d.tm_sec <= 60 && dt.frac_sec >= 0;
+        };
+        Term term;
+        if (parse_fixed_layout(damaged.data(), damaged.length(), fast, term) && term == none
+                && !in_range(fast) && ++mismatches <= 10) {
+            std::cout << "accepted: " << damaged << "\n";
+        }
+        if (parse_8601_general(damaged.data(), damaged.length(), general) == none
+                && !in_range(general) && ++mismatches <= 10) {
+            std::cout << "accepted by the general parser: " << damaged << "\n";
+        }
+    }
+    std::cout << count << " timestamps, " << mismatches << " mismatches\n";
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// parsing throughput of the fast path and the general parser, over a set
+// of timestamps small enough to stay in the cache
+static int parse_benchmark(long count)
+{
+    std::vector<std::string> lines(4096);
+    srandom(3);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        time_t t;
+        int frac;
+        long offset;
+        bool basic;
+        lines[i] = random_timestamp(t, frac, offset, basic, false);
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        unsigned long checksum = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (long i = 0; i < count; ++i) {
+            DateTime dt;
+            const std::string &line = lines[i & 4095];
+            Term term = pass == 0 ? parse_8601_general(line.data(), line.length(), dt) : parse_8601_datetime(line.data(), line.length(), dt);
+            if (term == none) {
+                checksum += dt.datetime.tm_sec + dt.frac_sec;
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << (pass == 0 ? "general parser " : "fixed layouts  ") << (double)elapsed / count << " ns/timestamp ("
+            << checksum << ")\n";
+    }
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        return benchmark(argc > 2 ? atol(argv[2]) : 5000000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--parse-test") == 0) {
+        return differential(argc > 2 ? atol(argv[2]) : 1000000);
+    }
+    if (argc > 1 && strcmp(argv[1], "--parse-bench") == 0) {
+        return parse_benchmark(argc > 2 ? atol(argv[2]) : 5000000);
+    }
 
     for (int i = 1; i < argc; ++i) {
         DateTime dt;
@@ -1,10 +1,15 @@
+#ifndef __convert_date_h__
+#define __convert_date_h__
+
+#include <stdint.h>
 #include <time.h>
 #include <string>
 #include <ostream>
 
 struct DateTime {
 	tm datetime;
-	int frac_sec;
+	int frac_sec;		// the digits of the fraction as written
+	int frac_digits;	// how many there were
 };
 
 void display(tm &time, int frac_sec);
@@ -34,3 +39,47 @@ std::ostream &operator<<(std::ostream &out, const DateTime &datetime);
 std::ostream & operator<<(std::ostream &out, const Term &term);
 
 Term parse_8601_datetime(const std::string &input, DateTime &result);
+// parses at most len characters of input, which need not be nul terminated.
+// Returns none on success, otherwise the term that was not understood. A
+// zone offset (+hh:mm) is applied so that the result is always UTC.
+Term parse_8601_datetime(const char *input, size_t len, DateTime &result);
+
+// the time given by a timestamp parse_8601_datetime accepts, in
+// microseconds since the epoch; false if it is not accepted
+bool parse_8601_usec(const char *input, size_t len, int64_t &usec);
+
+// timegm() without the library call; fields need not be normalised
+time_t utc_seconds(const tm &utc);
+
+/*
+	Converts UTC times to local time without consulting the time zone
+	rules for every conversion. The UTC offset found by localtime_r is
+	kept along with the range of times over which it applies (the
+	period between two time zone transitions) and dates are computed
+	with integer arithmetic.
+*/
+class LocalTimeConverter {
+	public:
+		LocalTimeConverter();
+
+		// the local time for a UTC time; fields need not be normalised
+		void toLocal(const tm &utc, tm &local);
+
+		// writes "YYYY-MM-DD HH:MM:SS.ffffff" in local time, nul terminated,
+		// and returns its length (as snprintf would for the same format)
+		int format(const DateTime &utc, char *out, size_t size);
+
+	private:
+		void lookup(time_t t);
+
+		time_t valid_from;	// offset applies to valid_from <= t < valid_until
+		time_t valid_until;
+		long offset;
+		tm zone;	// localtime_r's result at the lookup, for the zone fields
+};
+
+// rewrite the leading UTC timestamp of a line as local time into updated;
+// false if the line has none
+bool rewrite_time(const char *line, size_t len, LocalTimeConverter &converter, std::string &updated);
+
+#endif
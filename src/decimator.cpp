@@ -0,0 +1,158 @@
+#include "decimator.h"
+#include <iomanip>
+#include <string.h>
+
+static const char *symbols = "*@#%ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+Decimator::Decimator(size_t max_buckets)
+    : max_buckets(max_buckets < 2 ? 2 : max_buckets), used(0), started(false), origin(0), bucket_width(1),
+      low(0), high(0)
+{
+}
+
+void Decimator::add(long time, const char *name, size_t len, double value)
+{
+    key.assign(name, len);
+    std::map<std::string, int>::iterator found = index.find(key);
+    int slot;
+    if (found == index.end()) {
+        slot = series.size();
+        index.insert(std::make_pair(key, slot));
+        series.push_back(std::vector<Summary>());
+    }
+    else {
+        slot = found->second;
+    }
+    if (!started) {
+        started = true;
+        origin = time;
+        low = high = value;
+    }
+    if (time < origin) {
+        time = origin;  // out of order before the first point
+    }
+    size_t bucket = (time - origin) / bucket_width;
+    while (bucket >= max_buckets) {
+        merge();
+        bucket = (time - origin) / bucket_width;
+    }
+    if (bucket >= used) {
+        used = bucket + 1;
+    }
+    std::vector<Summary> &buckets = series[slot];
+    if (buckets.size() <= bucket) {
+        Summary empty = { 0, 0, 0, 0, false };
+        buckets.resize(bucket + 1, empty);
+    }
+    Summary &s = buckets[bucket];
+    if (!s.present) {
+        s.min = s.max = s.first = s.last = value;
+        s.present = true;
+    }
+    else {
+        if (value < s.min) {
+            s.min = value;
+        }
+        if (value > s.max) {
+            s.max = value;
+        }
+        s.last = value;
+    }
+    if (value < low) {
+        low = value;
+    }
+    if (value > high) {
+        high = value;
+    }
+}
+
+// halve the number of buckets by combining each pair
+void Decimator::merge()
+{
+    for (size_t i = 0; i < series.size(); ++i) {
+        std::vector<Summary> &buckets = series[i];
+        size_t merged = (buckets.size() + 1) / 2;
+        for (size_t b = 0; b < merged; ++b) {
+            Summary s = buckets[2 * b];
+            if (2 * b + 1 < buckets.size()) {
+                const Summary &next = buckets[2 * b + 1];
+                if (!s.present) {
+                    s = next;
+                }
+                else if (next.present) {
+                    if (next.min < s.min) {
+                        s.min = next.min;
+                    }
+                    if (next.max > s.max) {
+                        s.max = next.max;
+                    }
+                    s.last = next.last;
+                }
+            }
+            buckets[b] = s;
+        }
+        buckets.resize(merged);
+    }
+    used = (used + 1) / 2;
+    bucket_width *= 2;
+}
+
+void Decimator::write(std::ostream &out, int width, double min_value, double max_value) const
+{
+    if (!started || width < 2) {
+        return;
+    }
+    double lo = low < min_value ? low : min_value;
+    double hi = high > max_value ? high : max_value;
+    if (hi <= lo) {
+        hi = lo + 1;
+    }
+    int max_sym = strlen(symbols) - 1;
+    std::vector<char> row(width + 1);
+    std::vector<double> held(series.size());
+    std::vector<bool> seen(series.size(), false);
+    for (size_t b = 0; b < used; ++b) {
+        memset(row.data(), ' ', width);
+        row[width] = 0;
+        for (long x = -30000; x <= 30000; x += 10000) {
+            if (lo <= x && hi >= x) {
+                row[(int)((width - 1) * (x - lo) / (hi - lo))] = (x == 0) ? '|' : '!';
+            }
+        }
+        // envelopes first so that no symbol is hidden by another series' range
+        std::map<std::string, int>::const_iterator iter;
+        for (iter = index.begin(); iter != index.end(); ++iter) {
+            const std::vector<Summary> &buckets = series[iter->second];
+            if (b < buckets.size() && buckets[b].present) {
+                int from = (int)((width - 1) * (buckets[b].min - lo) / (hi - lo));
+                int to = (int)((width - 1) * (buckets[b].max - lo) / (hi - lo));
+                for (int c = from; c <= to; ++c) {
+                    row[c] = '-';
+                }
+            }
+        }
+        // then the first value of each series in the bucket
+        for (iter = index.begin(); iter != index.end(); ++iter) {
+            const std::vector<Summary> &buckets = series[iter->second];
+            if (b < buckets.size() && buckets[b].present) {
+                row[(int)((width - 1) * (buckets[b].first - lo) / (hi - lo))] = '+';
+            }
+        }
+        int symbol_idx = 0;
+        for (iter = index.begin(); iter != index.end(); ++iter) {
+            int slot = iter->second;
+            const std::vector<Summary> &buckets = series[slot];
+            if (b < buckets.size() && buckets[b].present) {
+                held[slot] = buckets[b].last;
+                seen[slot] = true;
+            }
+            if (seen[slot]) {
+                row[(int)((width - 1) * (held[slot] - lo) / (hi - lo))] = symbols[symbol_idx];
+            }
+            if (symbol_idx < max_sym) {
+                ++symbol_idx;
+            }
+        }
+        out << std::setw(8) << origin + (long)b * bucket_width << " " << row.data() << "\n";
+    }
+}
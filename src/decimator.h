@@ -0,0 +1,58 @@
+#ifndef __decimator_h__
+#define __decimator_h__
+
+/*
+    Reduces any number of points per series to a fixed number of time
+    buckets in a single pass, keeping the minimum, maximum, first and last
+    value of each series in each bucket so that no extreme is lost. The
+    span of the input is not known in advance: buckets start one time unit
+    wide and, whenever the next point would need more buckets than allowed,
+    neighbouring buckets are merged and the width doubles. Memory use is
+    bounded by the number of buckets times the number of series.
+*/
+
+#include <stddef.h>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class Decimator {
+    public:
+        explicit Decimator(size_t max_buckets);
+
+        void add(long time, const char *name, size_t len, double value);
+
+        // a row per bucket: the start time of the bucket and a plot of
+        // width characters with the range of each series marked by '-', its
+        // first value by '+' and its last value by its symbol. min_value
+        // and max_value are included in the range of the plot.
+        void write(std::ostream &out, int width, double min_value, double max_value) const;
+
+        size_t buckets() const { return used; }
+        long bucketWidth() const { return bucket_width; }
+
+    private:
+        struct Summary {
+            double min;
+            double max;
+            double first;
+            double last;
+            bool present;
+        };
+
+        void merge();
+
+        size_t max_buckets;
+        size_t used;
+        bool started;
+        long origin;
+        long bucket_width;
+        double low;
+        double high;
+        std::map<std::string, int> index;
+        std::vector<std::vector<Summary> > series;  // by series, then bucket
+        std::string key;
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include "device_history.h"
+#include <stdio.h>
+
+static const size_t initial_points = 64;
+static const size_t point_bytes = sizeof(uint64_t) + sizeof(double) + sizeof(uint8_t);
+
+DeviceHistory::DeviceHistory(size_t budget_bytes) : budget(budget_bytes), used(0), last_time(0)
+{
+}
+
+DeviceHistory::~DeviceHistory()
+{
+    for (size_t i = 0; i < series.size(); ++i) {
+        delete series[i];
+    }
+}
+
+// the string in the table and as a key of text_ids, with their bookkeeping
+static size_t text_bytes(const std::string &value)
+{
+    return 2 * (value.length() + sizeof(std::string)) + 64;
+}
+
+bool DeviceHistory::textFits(const std::string &value) const
+{
+    return text_ids.count(value) || used + text_bytes(value) <= budget;
+}
+
+int DeviceHistory::textId(const std::string &value)
+{
+    std::map<std::string, int>::iterator found = text_ids.find(value);
+    if (found != text_ids.end()) {
+        ++texts[found->second].points;
+        return found->second;
+    }
+    int id;
+    if (!free_texts.empty()) {
+        id = free_texts.back();
+        free_texts.pop_back();
+    }
+    else {
+        id = texts.size();
+        texts.push_back(Text());
+    }
+    texts[id].value = value;
+    texts[id].points = 1;
+    text_ids[value] = id;
+    used += text_bytes(value);
+    return id;
+}
+
+void DeviceHistory::releaseText(int id)
+{
+    Text &entry = texts[id];
+    if (--entry.points > 0) {
+        return;
+    }
+    used -= text_bytes(entry.value);
+    text_ids.erase(entry.value);
+    std::string().swap(entry.value);
+    free_texts.push_back(id);
+}
+
+void DeviceHistory::releasePoint(Series &s, size_t slot)
+{
+    if (s.kinds[slot] != number) {
+        releaseText((int)s.values[slot]);
+    }
+}
+
+// keeps the newest points that fit in a ring of the new size; each point
+// stays at its position (written count) modulo the size so that a reader
+// part way through the points can carry on
+void DeviceHistory::resize(Series &s, size_t size)
+{
+    uint64_t first = s.written - s.oldest > size ? s.written - size : s.oldest;
+    for (uint64_t position = s.oldest; position < first; ++position) {
+        releasePoint(s, position & s.mask);
+        ++s.dropped;
+    }
+    std::vector<uint64_t> times(size);
+    std::vector<double> values(size);
+    std::vector<uint8_t> kinds(size);
+    uint64_t mask = size - 1;
+    for (uint64_t position = first; position < s.written; ++position) {
+        times[position & mask] = s.times[position & s.mask];
+        values[position & mask] = s.values[position & s.mask];
+        kinds[position & mask] = s.kinds[position & s.mask];
+    }
+    used = used - s.times.size() * point_bytes + size * point_bytes;
+    s.times.swap(times);
+    s.values.swap(values);
+    s.kinds.swap(kinds);
+    s.mask = mask;
+    s.oldest = first;
+}
+
+// halves the largest rings, other than spare, until needed bytes are
+// free; rings are not made smaller than the first allocation
+bool DeviceHistory::reclaim(size_t needed, const Series *spare)
+{
+    while (used + needed > budget) {
+        Series *largest = 0;
+        for (size_t i = 0; i < series.size(); ++i) {
+            if (series[i] && series[i] != spare && (!largest || series[i]->times.size() > largest->times.size())) {
+                largest = series[i];
+            }
+        }
+        if (!largest || largest->times.size() <= initial_points) {
+            return false;
+        }
+        resize(*largest, largest->times.size() / 2);
+    }
+    return true;
+}
+
+// space for a new text is taken from the other devices' rings, then from
+// the oldest points of this device whose text is used by nothing else,
+// and last by halving this device's ring
+bool DeviceHistory::makeRoom(Series &s, const std::string &value)
+{
+    if (textFits(value) || reclaim(text_bytes(value), &s)) {
+        return true;
+    }
+    while (!textFits(value) && s.oldest < s.written) {
+        size_t slot = s.oldest & s.mask;
+        if (s.kinds[slot] == number || texts[(size_t)s.values[slot]].points > 1) {
+            break;      // discarding the point would free nothing
+        }
+        releasePoint(s, slot);
+        ++s.oldest;
+        ++s.dropped;
+    }
+    return textFits(value) || reclaim(text_bytes(value));
+}
+
+bool DeviceHistory::grow(Series &s)
+{
+    size_t size = s.times.empty() ? initial_points : s.times.size() * 2;
+    size_t extra = (size - s.times.size()) * point_bytes;
+    if (used + extra > budget && (!s.times.empty() || !reclaim(extra))) {
+        return false;
+    }
+    resize(s, size);
+    return true;
+}
+
+void DeviceHistory::process(Event &event)
+{
+    if (event.device_id >= 0) {
+        boost::mutex::scoped_lock lock(mutex);
+        if ((size_t)event.device_id >= series.size()) {
+            series.resize(event.device_id + 1, 0);
+        }
+        Series *s = series[event.device_id];
+        if (!s) {
+            s = series[event.device_id] = new Series;
+            by_name[event.name] = s;
+        }
+        if (s->written - s->oldest >= s->times.size() && !grow(*s)) {
+            if (s->times.empty()) {
+                ++s->dropped;   // the budget does not allow any points for this device
+                pass(event);
+                return;
+            }
+            releasePoint(*s, s->oldest++ & s->mask);
+        }
+        bool has_text = event.kind == Event::state_change || !event.numeric;
+        if (has_text && !makeRoom(*s, event.text)) {
+            ++s->dropped;
+            pass(event);
+            return;
+        }
+        size_t slot = s->written & s->mask;
+        s->times[slot] = event.time;
+        if (event.kind == Event::state_change) {
+            s->kinds[slot] = state;
+            s->values[slot] = textId(event.text);
+        }
+        else if (event.numeric) {
+            s->kinds[slot] = number;
+            s->values[slot] = event.value;
+        }
+        else {
+            s->kinds[slot] = text;
+            s->values[slot] = textId(event.text);
+        }
+        ++s->written;
+        last_time = event.time;
+    }
+    pass(event);
+}
+
+uint64_t DeviceHistory::latest()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return last_time;
+}
+
+uint64_t DeviceHistory::dropped(const std::string &device)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    std::map<std::string, Series *>::iterator found = by_name.find(device);
+    return found == by_name.end() ? 0 : found->second->dropped;
+}
+
+size_t DeviceHistory::memoryUsed()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return used;
+}
+
+bool DeviceHistory::read(const std::string &device, uint64_t from, uint64_t to, uint64_t &position,
+        std::string &out, size_t max_points, size_t &points)
+{
+    points = 0;
+    boost::mutex::scoped_lock lock(mutex);
+    std::map<std::string, Series *>::iterator found = by_name.find(device);
+    if (found == by_name.end()) {
+        return false;
+    }
+    const Series &s = *found->second;
+    uint64_t oldest = s.oldest;
+    if (position <= oldest) {
+        // the first batch, or points were overwritten since the last one;
+        // times only increase so the first point wanted can be searched for
+        uint64_t low = oldest;
+        uint64_t high = s.written;
+        while (low < high) {
+            uint64_t mid = low + (high - low) / 2;
+            if (s.times[mid & s.mask] < from) {
+                low = mid + 1;
+            }
+            else {
+                high = mid;
+            }
+        }
+        position = low;
+    }
+    char buf[40];
+    for (; position < s.written && points < max_points; ++position) {
+        size_t slot = position & s.mask;
+        uint64_t t = s.times[slot];
+        if (t < from) {
+            continue;
+        }
+        if (t > to) {
+            position = s.written;
+            break;
+        }
+        out.append(buf, snprintf(buf, sizeof(buf), "%llu\t", (unsigned long long)(t / 1000)));
+        if (s.kinds[slot] == number) {
+            out.append(buf, snprintf(buf, sizeof(buf), "%.15g", s.values[slot]));
+        }
+        else {
+            out += texts[(size_t)s.values[slot]].value;
+        }
+        out += '\n';
+        ++points;
+    }
+    return true;
+}
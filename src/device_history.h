@@ -0,0 +1,98 @@
+#ifndef __device_history_h__
+#define __device_history_h__
+
+/*
+    The recent history of every device, kept in memory so that short term
+    views can be answered without a separate database. Each device has a
+    ring of points held as separate arrays of times, values and kinds. A
+    value is a number, a state or a non-numeric property value; states and
+    text are stored as indices into a shared table of strings, which are
+    counted by the points that use them and freed with the last one.
+
+    The memory budget covers the rings and the strings. Rings start small
+    and double in size while the total stays within it; once it is
+    reached, full rings overwrite their oldest points instead of growing,
+    and room for a new string is taken from the other rings first.
+    A device seen after that takes its first points from the largest ring,
+    which is halved, so every device keeps some history while the budget
+    allows. Points that cannot be kept within the budget are counted as
+    dropped for the device.
+
+    The stage is fed on the sampling thread and read from another thread
+    (the command port), a batch at a time.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include "pipeline.h"
+
+class DeviceHistory : public Stage {
+    public:
+        explicit DeviceHistory(size_t budget_bytes);
+        ~DeviceHistory();
+
+        void process(Event &event);
+
+        // the time of the latest event, in microseconds as Event::time
+        uint64_t latest();
+
+        // appends "time <tab> value" lines for up to max_points points of the
+        // device with from <= time <= to, starting at position (0 for the
+        // oldest), sets points to the number added and advances position.
+        // Times are written in milliseconds. False if the device is unknown.
+        bool read(const std::string &device, uint64_t from, uint64_t to, uint64_t &position,
+                std::string &out, size_t max_points, size_t &points);
+
+        // points of the device lost to the memory budget rather than
+        // overwritten by newer points
+        uint64_t dropped(const std::string &device);
+
+        size_t memoryUsed();
+
+    private:
+        enum Kind { number, state, text };
+
+        struct Series {
+            std::vector<uint64_t> times;
+            std::vector<double> values;
+            std::vector<uint8_t> kinds;
+            uint64_t oldest;    // position (count of points written) of the oldest point kept
+            uint64_t written;
+            uint64_t mask;
+            uint64_t dropped;
+            Series() : oldest(0), written(0), mask(0), dropped(0) {}
+        };
+
+        struct Text {
+            std::string value;
+            size_t points;      // using the text, 0 for a free entry
+        };
+
+        bool textFits(const std::string &value) const;
+        bool makeRoom(Series &series, const std::string &value);
+        int textId(const std::string &value);
+        void releaseText(int id);
+        void releasePoint(Series &series, size_t slot);
+        bool grow(Series &series);
+        bool reclaim(size_t needed, const Series *spare = 0);
+        void resize(Series &series, size_t size);
+
+        boost::mutex mutex;
+        size_t budget;
+        size_t used;
+        uint64_t last_time;
+        std::vector<Series *> series;               // by device id
+        std::map<std::string, Series *> by_name;
+        std::vector<Text> texts;
+        std::map<std::string, int> text_ids;
+        std::vector<int> free_texts;
+
+        DeviceHistory(const DeviceHistory &);
+        DeviceHistory &operator=(const DeviceHistory &);
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "event_queue.h"
+#include <boost/thread/locks.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+void EventBatch::add(long time, const char *dev_name, size_t dev_len, const char *state_name, size_t state_len,
+        double value)
+{
+    Event e;
+    e.time = time;
+    e.dev = text.length();
+    e.dev_len = dev_len;
+    text.append(dev_name, dev_len);
+    e.state = text.length();
+    e.state_len = state_len;
+    text.append(state_name, state_len);
+    e.value = value;
+    events.push_back(e);
+}
+
+EventQueue::EventQueue(size_t capacity)
+    : slots(new EventBatch *[capacity + 1]), capacity(capacity + 1), head(0), tail(0), sleeping(false)
+{
+}
+
+EventQueue::~EventQueue()
+{
+    delete[] slots;
+}
+
+bool EventQueue::push(EventBatch *batch)
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t next = (h + 1) % capacity;
+    if (next == tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    slots[h] = batch;
+    head.store(next, std::memory_order_release);
+    // pairs with the fence in wait() so that either the consumer sees the
+    // new head or we see that it is going to sleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        ready.notify_one();
+    }
+    return true;
+}
+
+bool EventQueue::pop(EventBatch *&batch)
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+        return false;
+    }
+    batch = slots[t];
+    tail.store((t + 1) % capacity, std::memory_order_release);
+    return true;
+}
+
+void EventQueue::wait(int timeout_ms)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire)) {
+        if (timeout_ms < 0) {
+            ready.wait(lock);
+        }
+        else {
+            ready.timed_wait(lock, boost::posix_time::milliseconds(timeout_ms));
+        }
+    }
+    sleeping.store(false, std::memory_order_relaxed);
+}
@@ -0,0 +1,80 @@
+#ifndef __event_queue_h__
+#define __event_queue_h__
+
+/*
+    Hands batches of parsed events from scope's input thread to the thread
+    that keeps the column state and writes the output.
+
+    An EventBatch holds a copy of the text of its events' device and state
+    names, so the input buffer can be reused as soon as a batch is sent.
+    EventQueue is a fixed size single producer, single consumer ring of
+    batch pointers: push and pop only touch an atomic index each, and the
+    consumer sleeps on a condition variable only when it has caught up.
+    Spent batches go back to the producer through a second queue so that
+    batches are reused rather than allocated.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+struct EventBatch {
+    struct Event {
+        long time;
+        uint32_t dev;           // offsets into text
+        uint32_t dev_len;
+        uint32_t state;
+        uint32_t state_len;
+        double value;
+    };
+
+    enum { max_events = 4096, max_text = 128 * 1024 };
+
+    std::string text;
+    std::vector<Event> events;
+    bool last;                  // nothing follows this batch
+
+    EventBatch() : last(false) { events.reserve(max_events); text.reserve(max_text); }
+
+    void clear() { text.clear(); events.clear(); last = false; }
+    void add(long time, const char *dev, size_t dev_len, const char *state, size_t state_len, double value);
+    bool full() const { return events.size() >= max_events || text.length() >= max_text; }
+    const char *dev(const Event &e) const { return text.data() + e.dev; }
+    const char *state(const Event &e) const { return text.data() + e.state; }
+};
+
+class EventQueue {
+    public:
+        explicit EventQueue(size_t capacity);
+        ~EventQueue();
+
+        // false if the queue is full
+        bool push(EventBatch *batch);
+        // false if the queue is empty
+        bool pop(EventBatch *&batch);
+
+        // wait until something has been pushed or timeout_ms (-1 for no
+        // limit) has passed; only the consumer may wait
+        void wait(int timeout_ms);
+
+    private:
+        EventBatch **slots;
+        size_t capacity;
+        char pad0[64];
+        std::atomic<size_t> head;   // next slot to be written, producer only
+        char pad1[64];
+        std::atomic<size_t> tail;   // next slot to be read, consumer only
+        char pad2[64];
+        std::atomic<bool> sleeping;
+        boost::mutex mutex;
+        boost::condition_variable ready;
+
+        EventQueue(const EventQueue &);
+        EventQueue &operator=(const EventQueue &);
+};
+
+#endif
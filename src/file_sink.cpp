@@ -0,0 +1,340 @@
+#include "file_sink.h"
+#include <iostream>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static const size_t buffer_alignment = 4096;
+
+static uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+RotatingFileSink::Config::Config() : prefix("sampler"), max_file_size(256 * 1024 * 1024), rotate_secs(3600),
+    sync_policy(sync_rotate), sync_interval_ms(1000), flush_interval_ms(200),
+    buffer_size(1024 * 1024), max_buffers(64)
+{}
+
+RotatingFileSink::RotatingFileSink(const Config &config_) : config(config_), running(false), stopping(false),
+    current(0), current_started(0), allocated_buffers(0),
+    fd(-1), file_offset(0), file_opened(0), last_sync(0), sequence(0), bytes_written(0), write_errors(0)
+{
+    if (config.buffer_size < buffer_alignment) {
+        config.buffer_size = buffer_alignment;
+    }
+    config.buffer_size = (config.buffer_size + buffer_alignment - 1) & ~(buffer_alignment - 1);
+    if (config.max_buffers < 2) {
+        config.max_buffers = 2;
+    }
+    if (config.flush_interval_ms == 0) {
+        config.flush_interval_ms = 1;
+    }
+}
+
+RotatingFileSink::~RotatingFileSink()
+{
+    stop();
+    if (current) {
+        releaseBuffer(current);
+    }
+    std::list<Buffer *>::iterator iter = free_buffers.begin();
+    while (iter != free_buffers.end()) {
+        Buffer *buf = *iter++;
+        free(buf->data);
+        delete buf;
+    }
+}
+
+bool RotatingFileSink::parseSyncPolicy(const std::string &name, SyncPolicy &policy)
+{
+    if (name == "none") {
+        policy = sync_none;
+    }
+    else if (name == "rotate") {
+        policy = sync_rotate;
+    }
+    else if (name == "batch") {
+        policy = sync_batch;
+    }
+    else if (name == "periodic") {
+        policy = sync_periodic;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+bool RotatingFileSink::start(std::string &error)
+{
+    if (mkdir(config.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        error = "cannot create output directory " + config.directory + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (stat(config.directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        error = config.directory + " is not a directory";
+        return false;
+    }
+    running = true;
+    writer = boost::thread(&RotatingFileSink::run, this);
+    return true;
+}
+
+void RotatingFileSink::stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!running) {
+            return;
+        }
+        stopping = true;
+        work_ready.notify_one();
+        space_ready.notify_all();
+    }
+    writer.join();
+    running = false;
+    closeFile();
+}
+
+RotatingFileSink::Buffer *RotatingFileSink::allocateBuffer(boost::unique_lock<boost::mutex> &lock, size_t needed)
+{
+    size_t capacity = config.buffer_size;
+    if (needed > capacity) {
+        // an oversized line gets a buffer of its own that is not returned to the pool
+        capacity = (needed + buffer_alignment - 1) & ~(buffer_alignment - 1);
+    }
+    else {
+        while (free_buffers.empty() && allocated_buffers >= config.max_buffers && !stopping) {
+            space_ready.wait(lock);
+        }
+        if (!free_buffers.empty()) {
+            Buffer *buf = free_buffers.front();
+            free_buffers.pop_front();
+            buf->used = 0;
+            return buf;
+        }
+        ++allocated_buffers;
+    }
+    Buffer *buf = new Buffer;
+    void *data = 0;
+    if (posix_memalign(&data, buffer_alignment, capacity) != 0) {
+        throw std::bad_alloc();
+    }
+    buf->data = (char *)data;
+    buf->used = 0;
+    buf->capacity = capacity;
+    return buf;
+}
+
+void RotatingFileSink::releaseBuffer(Buffer *buf)
+{
+    if (buf->capacity != config.buffer_size) {
+        free(buf->data);
+        delete buf;
+        return;
+    }
+    buf->used = 0;
+    free_buffers.push_back(buf);
+}
+
+void RotatingFileSink::write(const char *data, size_t len)
+{
+    size_t needed = len + 1;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (stopping) {
+        return;
+    }
+    if (current && current->used + needed > current->capacity) {
+        full_buffers.push_back(current);
+        current = 0;
+        work_ready.notify_one();
+    }
+    if (!current) {
+        current = allocateBuffer(lock, needed);
+        current_started = monotonic_ms();
+    }
+    memcpy(current->data + current->used, data, len);
+    current->used += len;
+    current->data[current->used++] = '\n';
+}
+
+bool RotatingFileSink::openFile()
+{
+    char stamp[40];
+    time_t now = time(0);
+    struct tm tm_now;
+    gmtime_r(&now, &tm_now);
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &tm_now);
+    for (int attempts = 0; attempts < 1000; ++attempts) {
+        char name[60];
+        snprintf(name, sizeof(name), "-%s-%06u.log", stamp, ++sequence);
+        std::string path = config.directory + "/" + config.prefix + name;
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            file_offset = 0;
+            file_opened = monotonic_ms();
+            last_sync = file_opened;
+            return true;
+        }
+        if (errno != EEXIST) {
+            std::cerr << "error opening " << path << ": " << strerror(errno) << "\n";
+            return false;
+        }
+    }
+    return false;
+}
+
+void RotatingFileSink::closeFile()
+{
+    if (fd < 0) {
+        return;
+    }
+    if (config.sync_policy != sync_none) {
+        fsync(fd);
+    }
+    close(fd);
+    fd = -1;
+}
+
+bool RotatingFileSink::rotationDue(size_t pending) const
+{
+    if (fd < 0 || file_offset == 0) {
+        return false;
+    }
+    if (config.max_file_size && file_offset + pending > config.max_file_size) {
+        return true;
+    }
+    return config.rotate_secs && monotonic_ms() - file_opened >= (uint64_t)config.rotate_secs * 1000;
+}
+
+void RotatingFileSink::writeBatch(std::list<Buffer *> &batch)
+{
+    std::vector<struct iovec> iov;
+    iov.reserve(batch.size() < IOV_MAX ? batch.size() : IOV_MAX);
+    size_t pending = 0;
+    std::list<Buffer *>::iterator iter = batch.begin();
+    while (iter != batch.end() || !iov.empty()) {
+        Buffer *buf = (iter != batch.end()) ? *iter : 0;
+        bool flush = !buf || iov.size() == IOV_MAX;
+        if (buf && !flush && !iov.empty() && rotationDue(pending + buf->used)) {
+            flush = true;
+        }
+        if (flush && !iov.empty()) {
+            size_t start = 0;
+            while (start < iov.size()) {
+                ssize_t n = pwritev(fd, &iov[start], (int)(iov.size() - start), file_offset);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (write_errors++ == 0) {
+                        std::cerr << "error writing output file: " << strerror(errno) << "\n";
+                    }
+                    closeFile();
+                    break;
+                }
+                file_offset += n;
+                bytes_written += n;
+                while (n > 0 && start < iov.size()) {
+                    if ((size_t)n >= iov[start].iov_len) {
+                        n -= iov[start].iov_len;
+                        ++start;
+                    }
+                    else {
+                        iov[start].iov_base = (char *)iov[start].iov_base + n;
+                        iov[start].iov_len -= n;
+                        n = 0;
+                    }
+                }
+            }
+            iov.clear();
+            pending = 0;
+            continue;
+        }
+        if (!buf) {
+            break;
+        }
+        if (rotationDue(buf->used)) {
+            closeFile();
+        }
+        if (fd < 0 && !openFile()) {
+            ++write_errors;
+            ++iter;
+            continue;
+        }
+        struct iovec item;
+        item.iov_base = buf->data;
+        item.iov_len = buf->used;
+        iov.push_back(item);
+        pending += buf->used;
+        ++iter;
+    }
+    if (fd >= 0) {
+        if (config.sync_policy == sync_batch) {
+            fdatasync(fd);
+        }
+        else if (config.sync_policy == sync_periodic && monotonic_ms() - last_sync >= config.sync_interval_ms) {
+            fdatasync(fd);
+            last_sync = monotonic_ms();
+        }
+    }
+}
+
+void RotatingFileSink::run()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (;;) {
+        if (full_buffers.empty() && !stopping) {
+            work_ready.timed_wait(lock, boost::posix_time::milliseconds(config.flush_interval_ms));
+        }
+        if (current && current->used
+                && (stopping || monotonic_ms() - current_started >= config.flush_interval_ms)) {
+            full_buffers.push_back(current);
+            current = 0;
+        }
+        if (full_buffers.empty()) {
+            if (stopping) {
+                break;
+            }
+            // idle: time based rotation and syncing still apply
+            lock.unlock();
+            if (rotationDue(0)) {
+                closeFile();
+            }
+            else if (fd >= 0 && config.sync_policy == sync_periodic
+                    && monotonic_ms() - last_sync >= config.sync_interval_ms) {
+                fdatasync(fd);
+                last_sync = monotonic_ms();
+            }
+            lock.lock();
+            continue;
+        }
+        std::list<Buffer *> batch;
+        batch.swap(full_buffers);
+        lock.unlock();
+        writeBatch(batch);
+        lock.lock();
+        std::list<Buffer *>::iterator iter = batch.begin();
+        while (iter != batch.end()) {
+            releaseBuffer(*iter++);
+        }
+        space_ready.notify_all();
+    }
+}
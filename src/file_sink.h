@@ -0,0 +1,98 @@
+#ifndef __file_sink_h__
+#define __file_sink_h__
+
+/*
+    RotatingFileSink collects formatted output lines into large page-aligned
+    buffers and hands full buffers to a dedicated writer thread that writes
+    them with pwritev. The caller only ever copies into memory; file I/O,
+    rotation and syncing happen on the writer thread.
+
+    Files are named <prefix>-<YYYYMMDDTHHMMSSZ>-<sequence>.log so that a
+    lexical sort of the directory is also a chronological sort.
+*/
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <boost/thread.hpp>
+
+class RotatingFileSink {
+    public:
+        enum SyncPolicy {
+            sync_none,      // leave flushing to the operating system
+            sync_rotate,    // fsync each file when it is closed
+            sync_batch,     // fdatasync after every batch of buffers
+            sync_periodic   // fdatasync at most every sync_interval_ms
+        };
+
+        struct Config {
+            std::string directory;
+            std::string prefix;
+            uint64_t max_file_size;     // rotate when a file reaches this many bytes (0 = never)
+            unsigned int rotate_secs;   // rotate when a file is this old (0 = never)
+            SyncPolicy sync_policy;
+            unsigned int sync_interval_ms;
+            unsigned int flush_interval_ms; // maximum time data waits in a partially filled buffer
+            size_t buffer_size;
+            size_t max_buffers;         // the producer waits if this many buffers are queued
+            Config();
+        };
+
+        explicit RotatingFileSink(const Config &config);
+        ~RotatingFileSink();
+
+        bool start(std::string &error);
+        void stop();
+
+        // append a line; a newline is added after the data
+        void write(const char *data, size_t len);
+        void write(const std::string &line) { write(line.data(), line.length()); }
+
+        uint64_t bytesWritten() const { return bytes_written; }
+        uint64_t writeErrors() const { return write_errors; }
+
+        static bool parseSyncPolicy(const std::string &name, SyncPolicy &policy);
+
+    private:
+        struct Buffer {
+            char *data;
+            size_t used;
+            size_t capacity;
+        };
+
+        void run();
+        Buffer *allocateBuffer(boost::unique_lock<boost::mutex> &lock, size_t needed);
+        void releaseBuffer(Buffer *buf);
+        bool openFile();
+        void closeFile();
+        bool rotationDue(size_t pending) const;
+        void writeBatch(std::list<Buffer *> &batch);
+
+        Config config;
+        boost::mutex mutex;
+        boost::condition_variable work_ready;
+        boost::condition_variable space_ready;
+        boost::thread writer;
+        bool running;
+        bool stopping;
+
+        Buffer *current;
+        uint64_t current_started;  // monotonic ms when the current buffer received data
+        std::list<Buffer *> full_buffers;
+        std::list<Buffer *> free_buffers;
+        size_t allocated_buffers;
+
+        // owned by the writer thread
+        int fd;
+        uint64_t file_offset;
+        uint64_t file_opened;
+        uint64_t last_sync;
+        unsigned int sequence;
+        uint64_t bytes_written;
+        uint64_t write_errors;
+
+        RotatingFileSink(const RotatingFileSink &);
+        RotatingFileSink &operator=(const RotatingFileSink &);
+};
+
+#endif
@@ -1,22 +1,862 @@
 #include <iostream>
+#include <fstream>
 #include <regular_expressions.h>
+#include <deque>
 #include <list>
+#include <vector>
+#include <errno.h>
+#include <signal.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "context_window.h"
 #include "convert_date.h"
+#include "filter_stats.h"
+#include "line_io.h"
+#include "literal_scan.h"
+#include "pattern_set.h"
+#include "pipeline.h"
+#include "predicate.h"
+#include "route_set.h"
+#include "shm_ring.h"
+
+struct FallbackPattern {
+    std::string text;
+    rexp_info *info;
+    std::string literal; // every match contains this, so it is checked before running the regex
+    int id; // index into FilterStats::fallback
+};
+
+// the compiled patterns along with the scratch space used to match a line.
+// Neither the lazy DFA nor rexp_info may be shared between threads, so each
+// worker thread matches with its own copy (see clone()).
+struct Matcher {
+    Predicate *where; // --where condition on the fields of the line
+    PatternFilter combined; // patterns the single pass matcher can handle
+    std::list<FallbackPattern> patterns; // everything else
+    RouteSet *routes; // --route patterns, used instead of the above
+    const std::vector<int> *destinations; // where the selected line is to go when routing
+    std::string terminated; // nul terminated copy of a line for the regex library
+    std::string updated; // line with its time rewritten by --fix-time
+    LocalTimeConverter local_time;
+    FilterStats stats;
+    unsigned int since_reorder; // fallback passes since the list was last sorted
+
+    Matcher() : where(0), routes(0), destinations(0), since_reorder(0) {}
+    // true if the line is to be output; line and len are updated to the
+    // text to write
+    bool select(const char *&line, size_t &len, bool is_terminated);
+    bool matches(const char *text, size_t len, bool is_terminated);
+    void reorder();
+    Matcher *clone() const;
+    void release();
+};
+
+static bool fix_time = false; // don't rewrite the timestamp
+static Matcher matcher;
+static LiteralScanner prefilter; // a line that contains none of these cannot match any pattern
+static bool use_prefilter = false;
+static bool line_buffered = false; // flush after every matching line
+static unsigned int flush_interval = 100; // ms that matched output may wait in the buffer
+static OutputBuffer output(STDOUT_FILENO);
+static std::vector<OutputBuffer *> outputs; // by route destination, or just stdout
+
+// --trigger: output the selected lines within a time window around those
+// that match a trigger pattern
+static PatternSet trigger_set;
+static std::vector<rexp_info *> trigger_regexes; // triggers the combined matcher cannot take
+static ContextWindow *context = 0; // selected lines waiting to see if a trigger follows
+static int64_t context_after = 0; // microseconds to keep writing after a trigger
+static int64_t forward_until = 0;
+static bool forwarding = false;
+static int64_t last_time = 0;
+static int64_t time_unit = 1000; // microseconds per unit of a numeric timestamp, ms as sampler writes by default
+
+static bool timed = false; // time the cheap stages as well as the fallback regexes (--stats)
+static std::string stats_path; // --stats destination, - for stderr
+static std::string where_expression;
+static std::vector<PatternDescription> descriptions; // in command line order
+static uint64_t start_ns;
+static volatile sig_atomic_t report_requested = 0;
+
+static const unsigned int reorder_interval = 4096;
+
+bool Matcher::matches(const char *text, size_t len, bool is_terminated)
+{
+    if (combined.empty() && patterns.empty()) {
+        return true;
+    }
+    if (use_prefilter) {
+        uint64_t begin = timed ? stats_clock_ns() : 0;
+        bool candidate = prefilter.contains(text, len);
+        if (timed) {
+            stats.prefilter_ns += stats_clock_ns() - begin;
+        }
+        if (!candidate) {
+            ++stats.prefilter_rejected;
+            return false;
+        }
+    }
+    if (!combined.empty()) {
+        uint64_t begin = timed ? stats_clock_ns() : 0;
+        int idx = combined.match(text, len);
+        if (timed) {
+            stats.combined.time_ns += stats_clock_ns() - begin;
+        }
+        ++stats.combined.evaluations;
+        if (idx >= 0) {
+            ++stats.combined.hits;
+            ++stats.combined_hits[idx];
+            return true;
+        }
+    }
+    if (patterns.empty()) {
+        return false;
+    }
+    // regexes are slow enough that timing them is always worthwhile, and
+    // the times let the list be kept in its most profitable order
+    if (++since_reorder >= reorder_interval) {
+        reorder();
+    }
+    std::list<FallbackPattern>::iterator iter = patterns.begin();
+    while (iter != patterns.end()) {
+        const FallbackPattern &pattern = *iter++;
+        PatternStats &ps = stats.fallback[pattern.id];
+        uint64_t begin = stats_clock_ns();
+        bool found = false;
+        if (LiteralScanner::find(text, len, pattern.literal)) {
+            if (!is_terminated) {
+                terminated.assign(text, len);
+                text = terminated.c_str();
+                is_terminated = true;
+            }
+            found = execute_pattern(pattern.info, text) == 0;
+        }
+        ps.time_ns += stats_clock_ns() - begin;
+        ++ps.evaluations;
+        if (found) {
+            ++ps.hits;
+            return true;
+        }
+    }
+    return false;
+}
+
+// try first the patterns that settle the most lines per unit of time. The
+// order can only change which pattern is credited with a line, not
+// whether the line is output.
+void Matcher::reorder()
+{
+    since_reorder = 0;
+    const std::vector<PatternStats> &fallback = stats.fallback;
+    patterns.sort([&fallback](const FallbackPattern &a, const FallbackPattern &b) {
+        const PatternStats &x = fallback[a.id];
+        const PatternStats &y = fallback[b.id];
+        // x.hits / x.time > y.hits / y.time
+        return (double)x.hits * (y.time_ns + 1) > (double)y.hits * (x.time_ns + 1);
+    });
+}
+
+Matcher *Matcher::clone() const
+{
+    Matcher *copy = new Matcher;
+    if (where) {
+        copy->where = where->clone();
+    }
+    if (routes) {
+        copy->routes = routes->clone();
+    }
+    copy->combined = combined;
+    copy->stats.resize(stats.combined_hits.size(), stats.fallback.size(), stats.route_hits.size());
+    std::list<FallbackPattern>::const_iterator iter = patterns.begin();
+    while (iter != patterns.end()) {
+        FallbackPattern fallback = *iter++;
+        fallback.info = create_pattern(fallback.text.c_str());
+        copy->patterns.push_back(fallback);
+    }
+    return copy;
+}
+
+void Matcher::release()
+{
+    std::list<FallbackPattern>::iterator iter = patterns.begin();
+    while (iter != patterns.end()) {
+        release_pattern((*iter++).info);
+    }
+    patterns.clear();
+    delete where;
+    where = 0;
+    delete routes;
+    routes = 0;
+}
+
+bool Matcher::select(const char *&line, size_t &len, bool is_terminated)
+{
+    ++stats.lines_in;
+    stats.bytes_in += len + 1;
+    if (where) {
+        uint64_t begin = timed ? stats_clock_ns() : 0;
+        bool selected = where->matches(line, len);
+        if (timed) {
+            stats.where_ns += stats_clock_ns() - begin;
+        }
+        if (!selected) {
+            ++stats.where_rejected;
+            return false;
+        }
+    }
+    if (fix_time && rewrite_time(line, len, local_time, updated)) {
+        line = updated.c_str();
+        len = updated.length();
+        is_terminated = true;
+    }
+    if (routes) {
+        uint64_t begin = timed ? stats_clock_ns() : 0;
+        destinations = &routes->route(line, len, is_terminated);
+        if (timed) {
+            stats.route_ns += stats_clock_ns() - begin;
+        }
+        const std::vector<int> &hits = routes->matchedRoutes();
+        for (size_t i = 0; i < hits.size(); ++i) {
+            ++stats.route_hits[hits[i]];
+        }
+        if (hits.empty() && !destinations->empty()) {
+            ++stats.route_default;
+        }
+        if (destinations->empty()) {
+            return false;
+        }
+    }
+    else if (!matches(line, len, is_terminated)) {
+        return false;
+    }
+    ++stats.lines_out;
+    stats.bytes_out += len + 1;
+    return true;
+}
+
+static void report(const FilterStats &stats)
+{
+    double elapsed = (stats_clock_ns() - start_ns) / 1e9;
+    std::vector<std::string> routes;
+    for (size_t i = 0; matcher.routes && i < matcher.routes->size(); ++i) {
+        routes.push_back(matcher.routes->spec(i));
+    }
+    if (stats_path.empty() || stats_path == "-") {
+        write_stats_json(std::cerr, stats, descriptions, routes, where_expression, use_prefilter, timed, elapsed);
+        return;
+    }
+    std::ofstream out(stats_path.c_str(), std::ios::app);
+    if (!out) {
+        std::cerr << "filter: cannot write statistics to " << stats_path << "\n";
+        return;
+    }
+    write_stats_json(out, stats, descriptions, routes, where_expression, use_prefilter, timed, elapsed);
+}
+
+static void request_report(int)
+{
+    report_requested = 1;
+}
+
+// flushes outputs whose matched lines have waited long enough and returns
+// how long the caller may wait before calling again, -1 for no limit
+static int flush_idle_outputs()
+{
+    int timeout = -1;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        int wait = outputs[i]->flushTimeout(flush_interval);
+        if (wait >= 0 && (timeout < 0 || wait < timeout)) {
+            timeout = wait;
+        }
+    }
+    return timeout;
+}
+
+static int flush_outputs()
+{
+    int result = 0;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        if (!outputs[i]->flush() || outputs[i]->failed()) {
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// line must be nul terminated at line[len]
+static bool is_trigger(const char *line, size_t len)
+{
+    if (!trigger_set.empty() && trigger_set.matches(line, len)) {
+        return true;
+    }
+    for (size_t i = 0; i < trigger_regexes.size(); ++i) {
+        if (execute_pattern(trigger_regexes[i], line) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// line must be nul terminated at line[len]
+static void capture_line(const char *line, size_t len)
+{
+    int64_t time;
+    if (!leading_time(line, len, time_unit, time)) {
+        time = last_time;   // untimed lines stay with the line before them
+    }
+    last_time = time;
+    if (!matcher.select(line, len, true)) {
+        return;
+    }
+    // the line only counts as output if it is written
+    FilterStats &stats = matcher.stats;
+    --stats.lines_out;
+    stats.bytes_out -= len + 1;
+    if (is_trigger(line, len)) {
+        context->release(time, output, stats.lines_out, stats.bytes_out);
+        if (!forwarding || forward_until < time + context_after) {
+            forward_until = time + context_after;
+        }
+        forwarding = true;
+    }
+    else if (!forwarding || time > forward_until) {
+        forwarding = false;
+        context->add(time, line, len);
+        return;
+    }
+    output.appendLine(line, len);
+    ++stats.lines_out;
+    stats.bytes_out += len + 1;
+    if (line_buffered) {
+        output.flush();
+    }
+}
+
+static void report_dropped_context()
+{
+    if (context && context->dropped()) {
+        std::cerr << "filter: " << context->dropped() << " lines were dropped from the --before window to stay within --context-limit\n";
+    }
+}
+
+// line must be nul terminated at line[len]
+static void process_line(const char *line, size_t len)
+{
+    if (context) {
+        capture_line(line, len);
+        return;
+    }
+    if (!matcher.select(line, len, true)) {
+        return;
+    }
+    if (!matcher.routes) {
+        output.appendLine(line, len);
+        if (line_buffered) {
+            output.flush();
+        }
+        return;
+    }
+    const std::vector<int> &destinations = *matcher.destinations;
+    for (size_t i = 0; i < destinations.size(); ++i) {
+        OutputBuffer *out = outputs[destinations[i]];
+        out->appendLine(line, len);
+        if (line_buffered) {
+            out->flush();
+        }
+    }
+}
+
+// format a ring event the way sampler writes its std output
+static void format_event(const RingEvent &event, std::string &buf)
+{
+    char prefix[40];
+    snprintf(prefix, sizeof(prefix), "%llu\t", (unsigned long long)(event.time / 1000));
+    buf = prefix;
+    buf.append(event.name, event.name_len);
+    if (event.kind == ring_state) {
+        buf += "\t";
+        buf.append(event.text, event.text_len);
+        snprintf(prefix, sizeof(prefix), "\t%d", event.state_id);
+        buf += prefix;
+    }
+    else {
+        buf += "\tvalue\t";
+        buf.append(event.text, event.text_len);
+    }
+}
+
+static int read_ring(const std::string &name)
+{
+    ShmRing ring;
+    std::string error;
+    if (!ring.attach(name, error)) {
+        std::cerr << "error: " << error << "\n";
+        return 1;
+    }
+    RingEvent event;
+    std::string buf;
+    unsigned int idle = 0;
+    while (!ring.finished()) {
+        if (report_requested) {
+            report_requested = 0;
+            report(matcher.stats);
+        }
+        if (ring.next(event)) {
+            idle = 0;
+            format_event(event, buf);
+            process_line(buf.c_str(), buf.length());
+        }
+        else if (++idle > 1000) {
+            flush_idle_outputs();
+            usleep(1000);   // the ring has been empty for a while
+        }
+    }
+    flush_outputs();
+    report_dropped_context();
+    if (ring.lost()) {
+        std::cerr << "filter: " << ring.lost() << " events were overwritten before they were read\n";
+    }
+    if (!stats_path.empty()) {
+        report(matcher.stats);
+    }
+    return 0;
+}
+
+static int read_lines()
+{
+    LineReader input(STDIN_FILENO);
+    for (;;) {
+        char *line;
+        size_t len;
+        LineReader::Status status = input.next(line, len);
+        if (status == LineReader::line_ready) {
+            process_line(line, len);
+            continue;
+        }
+        if (status == LineReader::end_of_input) {
+            break;
+        }
+        if (report_requested) {
+            report_requested = 0;
+            report(matcher.stats);
+        }
+        // out of buffered input: don't let matched lines sit in the buffer
+        // while waiting for more
+        int timeout = flush_idle_outputs();
+        if (input.fill(timeout) == LineReader::read_error) {
+            perror("filter: read");
+            break;
+        }
+    }
+    int result = flush_outputs();
+    report_dropped_context();
+    if (!stats_path.empty()) {
+        report(matcher.stats);
+    }
+    return result;
+}
+
+/*
+    Parallel filtering for offline processing. The input is cut into line
+    aligned chunks that are matched by a pool of worker threads, each with
+    its own Matcher, and the matching lines of each chunk are written in
+    input order. A regular file is mapped so that chunks point straight
+    into the page cache; other input is read into recycled chunk buffers.
+*/
+
+static const size_t chunk_size = 4 * 1024 * 1024;
+
+struct Chunk {
+    const char *data;
+    size_t len;
+    std::vector<char> storage; // holds the data when the input is not mapped
+    std::vector<std::string> out; // matched lines by output
+    bool done;
+};
+
+class ChunkPool {
+    public:
+        ChunkPool(int threads);
+        ~ChunkPool();
+
+        // waits for earlier chunks to be written if too many are outstanding
+        Chunk *allocate();
+        // chunks may complete in any order but are written in submission order
+        void submit(Chunk *chunk);
+        void finish();
+
+        // the statistics of all the workers as of their last completed chunk
+        FilterStats totals();
+
+    private:
+        void run(int worker, Matcher *local);
+        void writeOldest();
+
+        boost::mutex mutex;
+        boost::condition_variable work_ready;
+        boost::condition_variable chunk_done;
+        std::deque<Chunk *> work;
+        std::deque<Chunk *> in_flight; // submission order, only used by the submitting thread
+        std::vector<Chunk *> spare;
+        std::vector<boost::thread *> workers;
+        std::vector<FilterStats> snapshots; // by worker
+        size_t max_in_flight;
+        bool stopping;
+};
+
+ChunkPool::ChunkPool(int threads) : snapshots(threads), max_in_flight(threads * 2), stopping(false)
+{
+    for (int i = 0; i < threads; ++i) {
+        // patterns are compiled here rather than in the threads in case
+        // the regex library is not safe to call concurrently
+        workers.push_back(new boost::thread(&ChunkPool::run, this, i, matcher.clone()));
+    }
+}
+
+ChunkPool::~ChunkPool()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->join();
+        delete workers[i];
+    }
+    for (size_t i = 0; i < spare.size(); ++i) {
+        delete spare[i];
+    }
+}
+
+Chunk *ChunkPool::allocate()
+{
+    while (in_flight.size() >= max_in_flight) {
+        writeOldest();
+    }
+    Chunk *chunk;
+    if (spare.empty()) {
+        chunk = new Chunk;
+    }
+    else {
+        chunk = spare.back();
+        spare.pop_back();
+    }
+    chunk->data = 0;
+    chunk->len = 0;
+    chunk->out.resize(outputs.size());
+    for (size_t i = 0; i < chunk->out.size(); ++i) {
+        chunk->out[i].clear();
+    }
+    chunk->done = false;
+    return chunk;
+}
+
+void ChunkPool::submit(Chunk *chunk)
+{
+    in_flight.push_back(chunk);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        work.push_back(chunk);
+    }
+    work_ready.notify_one();
+}
+
+void ChunkPool::writeOldest()
+{
+    Chunk *chunk = in_flight.front();
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!chunk->done) {
+            chunk_done.wait(lock);
+        }
+    }
+    in_flight.pop_front();
+    for (size_t i = 0; i < chunk->out.size(); ++i) {
+        if (chunk->out[i].empty()) {
+            continue;
+        }
+        outputs[i]->append(chunk->out[i].data(), chunk->out[i].length());
+        if (line_buffered) {
+            outputs[i]->flush();
+        }
+    }
+    spare.push_back(chunk);
+}
+
+void ChunkPool::finish()
+{
+    while (!in_flight.empty()) {
+        writeOldest();
+    }
+}
+
+FilterStats ChunkPool::totals()
+{
+    FilterStats total;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (size_t i = 0; i < snapshots.size(); ++i) {
+        total.add(snapshots[i]);
+    }
+    return total;
+}
+
+void ChunkPool::run(int worker, Matcher *local)
+{
+    for (;;) {
+        Chunk *chunk;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (work.empty() && !stopping) {
+                work_ready.wait(lock);
+            }
+            if (work.empty()) {
+                break;
+            }
+            chunk = work.front();
+            work.pop_front();
+        }
+        const char *p = chunk->data;
+        const char *end = p + chunk->len;
+        while (p < end) {
+            const char *nl = (const char *)memchr(p, '\n', end - p);
+            size_t len = (nl ? nl : end) - p;
+            const char *line = p;
+            p += len + 1;
+            if (!local->select(line, len, false)) {
+                continue;
+            }
+            if (!local->routes) {
+                chunk->out[0].append(line, len);
+                chunk->out[0] += '\n';
+                continue;
+            }
+            const std::vector<int> &destinations = *local->destinations;
+            for (size_t i = 0; i < destinations.size(); ++i) {
+                chunk->out[destinations[i]].append(line, len);
+                chunk->out[destinations[i]] += '\n';
+            }
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            chunk->done = true;
+            snapshots[worker] = local->stats;
+        }
+        chunk_done.notify_all();
+    }
+    local->release();
+    delete local;
+}
+
+static void check_report(ChunkPool &pool)
+{
+    if (report_requested) {
+        report_requested = 0;
+        report(pool.totals());
+    }
+}
+
+static int filter_mapped(ChunkPool &pool, const char *data, size_t size)
+{
+    size_t pos = 0;
+    while (pos < size) {
+        check_report(pool);
+        size_t end = pos + chunk_size;
+        if (end >= size) {
+            end = size;
+        }
+        else {
+            const char *nl = (const char *)memchr(data + end, '\n', size - end);
+            end = nl ? nl - data + 1 : size;
+        }
+        Chunk *chunk = pool.allocate();
+        chunk->data = data + pos;
+        chunk->len = end - pos;
+        pool.submit(chunk);
+        pos = end;
+    }
+    pool.finish();
+    return flush_outputs();
+}
+
+static int filter_stream(ChunkPool &pool)
+{
+    std::vector<char> carry; // partial line at the end of the previous chunk
+    bool eof = false;
+    while (!eof) {
+        check_report(pool);
+        Chunk *chunk = pool.allocate();
+        std::vector<char> &buf = chunk->storage;
+        buf.resize(chunk_size + carry.size());
+        if (!carry.empty()) {
+            memcpy(buf.data(), carry.data(), carry.size());
+        }
+        size_t used = carry.size();
+        size_t scanned = used;  // the carried partial line has no newline
+        size_t keep = used;
+        for (;;) {
+            while (used < buf.size()) {
+                ssize_t n = read(STDIN_FILENO, buf.data() + used, buf.size() - used);
+                if (n < 0 && errno == EINTR) {
+                    check_report(pool);
+                    continue;
+                }
+                if (n < 0) {
+                    perror("filter: read");
+                }
+                if (n <= 0) {
+                    eof = true;
+                    break;
+                }
+                used += n;
+            }
+            keep = used;
+            if (eof) {
+                break;
+            }
+            while (keep > scanned && buf[keep - 1] != '\n') {
+                --keep;
+            }
+            if (keep > scanned) {
+                break;
+            }
+            // a line longer than the chunk: grow it until the line ends,
+            // as LineReader::fill does, rather than match part of a line
+            scanned = used;
+            buf.resize(buf.size() * 2);
+        }
+        carry.assign(buf.begin() + keep, buf.begin() + used);
+        chunk->data = buf.data();
+        chunk->len = keep;
+        pool.submit(chunk);
+    }
+    pool.finish();
+    return flush_outputs();
+}
+
+static int read_chunks(int threads)
+{
+    ChunkPool pool(threads);
+    int result = -1;
+    struct stat st;
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            result = filter_mapped(pool, (const char *)data, st.st_size);
+            munmap(data, st.st_size);
+        }
+    }
+    if (result < 0) {
+        result = filter_stream(pool);
+    }
+    if (!stats_path.empty()) {
+        report(pool.totals());
+    }
+    return result;
+}
 
 int main(int argc, char *argv[])
 {
-    bool fix_time = false; // don't rewrite the timestamp
-    std::list<rexp_info *>patterns;
+    std::string ring_name;
+    int threads = 1;
+    std::vector<std::string> route_specs;
+    std::string default_route;
+    std::vector<std::string> triggers;
+    long before_ms = 0;
+    long after_ms = 0;
+    size_t context_limit = 64; // MB
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "--fix-time") == 0) {
             fix_time = true;
             continue;
         }
+        if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            ring_name = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--line-buffered") == 0) {
+            line_buffered = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--flush-interval") == 0 && i + 1 < argc) {
+            flush_interval = strtoul(argv[++i], 0, 10);
+            continue;
+        }
+        if (strcmp(argv[i], "--where") == 0 && i + 1 < argc) {
+            // several conditions must all hold
+            where_expression = where_expression.empty() ? argv[++i] : "(" + where_expression + ") && (" + argv[++i] + ")";
+            continue;
+        }
+        if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            stats_path = argv[++i];
+            timed = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads <= 0) {
+                threads = boost::thread::hardware_concurrency();
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--route") == 0 && i + 1 < argc) {
+            route_specs.push_back(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--default") == 0 && i + 1 < argc) {
+            default_route = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--trigger") == 0 && i + 1 < argc) {
+            triggers.push_back(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--before") == 0 && i + 1 < argc) {
+            before_ms = strtol(argv[++i], 0, 10);
+            continue;
+        }
+        if (strcmp(argv[i], "--after") == 0 && i + 1 < argc) {
+            after_ms = strtol(argv[++i], 0, 10);
+            continue;
+        }
+        if (strcmp(argv[i], "--context-limit") == 0 && i + 1 < argc) {
+            context_limit = strtoul(argv[++i], 0, 10);
+            continue;
+        }
+        if (strcmp(argv[i], "--time-unit") == 0 && i + 1 < argc) {
+            const char *unit = argv[++i];
+            time_unit = strcmp(unit, "s") == 0 ? 1000000 : strcmp(unit, "ms") == 0 ? 1000 : 1;
+            if (time_unit == 1 && strcmp(unit, "us") != 0) {
+                std::cerr << "filter: --time-unit must be s, ms or us\n";
+                return 1;
+            }
+            continue;
+        }
         rexp_info *info = create_pattern(argv[i]);
         if (info->compilation_result == 0) {
-            patterns.push_back(info);
+            std::string literal = PatternSet::requiredLiteral(argv[i]);
+            prefilter.add(literal);
+            PatternDescription description = { argv[i], true, matcher.combined.add(argv[i]) };
+            if (description.index >= 0) {
+                release_pattern(info);
+            }
+            else {
+                description.combined = false;
+                description.index = matcher.patterns.size();
+                FallbackPattern fallback = { argv[i], info, literal, description.index };
+                matcher.patterns.push_back(fallback);
+            }
+            descriptions.push_back(description);
         }
         else {
             std::cerr << "failed to compile regexp: " << argv[i] << "\n";
@@ -24,44 +864,90 @@ int main(int argc, char *argv[])
         }
     }
 
-    while (!std::cin.eof()) {
-        std::string buf;
-        while (std::getline(std::cin, buf)) {
-            if (fix_time) {
-                DateTime dt;
-                auto error = parse_8601_datetime(buf, dt);
-                if (error == none) {
-                    size_t buflen = buf.length() + 40;
-                    std::vector<char> updated(buflen);
-                    time_t local_time = timegm(&dt.datetime);
-                    localtime_r(&local_time, &dt.datetime);
-                    const auto &t = dt.datetime;
-                    snprintf(updated.data(), buflen, "%04d-%02d-%02d %02d:%02d:%02d.%06d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, dt.frac_sec);
-                    int len = strlen(updated.data());
-                    const char *data_start = strchr(buf.c_str(), ' ');
-                    if (data_start == nullptr) { data_start = strchr(buf.c_str(), '\t'); }
-                    if (data_start == nullptr) {
-                        data_start = buf.c_str();
-                    }
-                    snprintf(updated.data() + len, buflen - len, "%s", data_start);
-                    buf = updated.data();
-                }
+    if (!where_expression.empty()) {
+        std::string error;
+        matcher.where = new Predicate;
+        if (!matcher.where->compile(where_expression, error)) {
+            std::cerr << "filter: --where: " << error << "\n";
+            return 1;
+        }
+    }
+
+    if (!route_specs.empty() || !default_route.empty()) {
+        if (!descriptions.empty()) {
+            std::cerr << "filter: patterns cannot be combined with --route; use --route 'pattern => -' to write to stdout\n";
+            return 1;
+        }
+        matcher.routes = new RouteSet;
+        for (size_t i = 0; i < route_specs.size(); ++i) {
+            std::string error;
+            if (!matcher.routes->add(route_specs[i], error)) {
+                std::cerr << "filter: --route: " << error << "\n";
+                return 1;
             }
+        }
+        if (!default_route.empty()) {
+            matcher.routes->setDefault(default_route);
+        }
+        for (size_t i = 0; i < matcher.routes->destinationCount(); ++i) {
+            const std::string &path = matcher.routes->destination(i);
+            if (path == "-") {
+                outputs.push_back(&output);
+                continue;
+            }
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd < 0) {
+                std::cerr << "filter: cannot open " << path << ": " << strerror(errno) << "\n";
+                return 1;
+            }
+            outputs.push_back(new OutputBuffer(fd));
+        }
+    }
+    else {
+        outputs.push_back(&output);
+    }
 
-            if (!patterns.empty()) {
-                std::list<rexp_info *>::iterator iter = patterns.begin();
-                while (iter != patterns.end()) {
-                    rexp_info *info = *iter++;
-                    if (execute_pattern(info, buf.c_str()) == 0) {
-                        std::cout << buf << "\n" << std::flush;
-                        break;
-                    }
-                }
+    if (!triggers.empty()) {
+        if (matcher.routes) {
+            std::cerr << "filter: --trigger cannot be combined with --route\n";
+            return 1;
+        }
+        for (size_t i = 0; i < triggers.size(); ++i) {
+            rexp_info *info = create_pattern(triggers[i].c_str());
+            if (info->compilation_result != 0) {
+                std::cerr << "filter: --trigger: failed to compile regexp: " << triggers[i] << "\n";
+                release_pattern(info);
+                return 1;
+            }
+            if (trigger_set.add(triggers[i].c_str()) >= 0) {
+                release_pattern(info);
             }
             else {
-                std::cout << buf << "\n" << std::flush;
+                trigger_regexes.push_back(info);
             }
         }
+        context = new ContextWindow(before_ms * 1000, context_limit * 1024 * 1024);
+        context_after = after_ms * 1000;
     }
-    return 0;
+
+    // the combined matcher is already a single pass over the line, so the
+    // prefilter only pays for itself in front of regexes or a small pattern set
+    use_prefilter = prefilter.selective() && (!matcher.patterns.empty() || matcher.combined.size() <= 8);
+    matcher.stats.resize(matcher.combined.size(), matcher.patterns.size(), matcher.routes ? matcher.routes->size() : 0);
+
+    // no SA_RESTART, so that a blocking read returns to notice the request
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_report;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, 0);
+    start_ns = stats_clock_ns();
+
+    if (!ring_name.empty()) {
+        return read_ring(ring_name);
+    }
+    if (threads > 1 && !context) {
+        return read_chunks(threads);
+    }
+    return read_lines();
 }
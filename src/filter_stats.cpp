@@ -0,0 +1,146 @@
+#include "filter_stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+void FilterStats::clear()
+{
+    lines_in = bytes_in = lines_out = bytes_out = 0;
+    where_rejected = where_ns = 0;
+    prefilter_rejected = prefilter_ns = 0;
+    route_default = route_ns = 0;
+    memset(&combined, 0, sizeof(combined));
+    combined_hits.assign(combined_hits.size(), 0);
+    PatternStats zero = { 0, 0, 0 };
+    fallback.assign(fallback.size(), zero);
+    route_hits.assign(route_hits.size(), 0);
+}
+
+void FilterStats::resize(size_t combined_patterns, size_t fallback_patterns, size_t routes)
+{
+    PatternStats zero = { 0, 0, 0 };
+    combined_hits.resize(combined_patterns, 0);
+    fallback.resize(fallback_patterns, zero);
+    route_hits.resize(routes, 0);
+}
+
+static void add_pattern(PatternStats &total, const PatternStats &other)
+{
+    total.evaluations += other.evaluations;
+    total.hits += other.hits;
+    total.time_ns += other.time_ns;
+}
+
+void FilterStats::add(const FilterStats &other)
+{
+    lines_in += other.lines_in;
+    bytes_in += other.bytes_in;
+    lines_out += other.lines_out;
+    bytes_out += other.bytes_out;
+    where_rejected += other.where_rejected;
+    where_ns += other.where_ns;
+    prefilter_rejected += other.prefilter_rejected;
+    prefilter_ns += other.prefilter_ns;
+    route_default += other.route_default;
+    route_ns += other.route_ns;
+    add_pattern(combined, other.combined);
+    resize(other.combined_hits.size() > combined_hits.size() ? other.combined_hits.size() : combined_hits.size(),
+        other.fallback.size() > fallback.size() ? other.fallback.size() : fallback.size(),
+        other.route_hits.size() > route_hits.size() ? other.route_hits.size() : route_hits.size());
+    for (size_t i = 0; i < other.combined_hits.size(); ++i) {
+        combined_hits[i] += other.combined_hits[i];
+    }
+    for (size_t i = 0; i < other.fallback.size(); ++i) {
+        add_pattern(fallback[i], other.fallback[i]);
+    }
+    for (size_t i = 0; i < other.route_hits.size(); ++i) {
+        route_hits[i] += other.route_hits[i];
+    }
+}
+
+uint64_t stats_clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_json_string(std::ostream &out, const std::string &s)
+{
+    out << '"';
+    for (size_t i = 0; i < s.length(); ++i) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out << buf;
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void write_stats_json(std::ostream &out, const FilterStats &stats, const std::vector<PatternDescription> &patterns,
+        const std::vector<std::string> &routes, const std::string &where, bool prefilter, bool timed, double elapsed_secs)
+{
+    double rate = elapsed_secs > 0 ? 1.0 / elapsed_secs : 0;
+    out << "{\"elapsed_s\":" << elapsed_secs
+        << ",\"lines_in\":" << stats.lines_in
+        << ",\"bytes_in\":" << stats.bytes_in
+        << ",\"lines_out\":" << stats.lines_out
+        << ",\"bytes_out\":" << stats.bytes_out
+        << ",\"lines_per_s\":" << (uint64_t)(stats.lines_in * rate)
+        << ",\"bytes_per_s\":" << (uint64_t)(stats.bytes_in * rate)
+        << ",\"timed\":" << (timed ? "true" : "false");
+    if (!where.empty()) {
+        out << ",\"where\":{\"expression\":";
+        write_json_string(out, where);
+        out << ",\"rejected\":" << stats.where_rejected << ",\"time_ns\":" << stats.where_ns << "}";
+    }
+    if (prefilter) {
+        out << ",\"prefilter\":{\"rejected\":" << stats.prefilter_rejected << ",\"time_ns\":" << stats.prefilter_ns << "}";
+    }
+    out << ",\"combined\":{\"evaluations\":" << stats.combined.evaluations
+        << ",\"hits\":" << stats.combined.hits
+        << ",\"time_ns\":" << stats.combined.time_ns << "}";
+    out << ",\"patterns\":[";
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        const PatternDescription &pattern = patterns[i];
+        if (i) {
+            out << ",";
+        }
+        out << "{\"pattern\":";
+        write_json_string(out, pattern.text);
+        if (pattern.combined) {
+            uint64_t hits = pattern.index < (int)stats.combined_hits.size() ? stats.combined_hits[pattern.index] : 0;
+            out << ",\"engine\":\"combined\",\"hits\":" << hits << "}";
+        }
+        else {
+            PatternStats ps = { 0, 0, 0 };
+            if (pattern.index < (int)stats.fallback.size()) {
+                ps = stats.fallback[pattern.index];
+            }
+            out << ",\"engine\":\"regex\",\"evaluations\":" << ps.evaluations
+                << ",\"hits\":" << ps.hits << ",\"time_ns\":" << ps.time_ns << "}";
+        }
+    }
+    out << "]";
+    if (!routes.empty()) {
+        out << ",\"routes\":{\"time_ns\":" << stats.route_ns << ",\"default\":" << stats.route_default << ",\"routes\":[";
+        for (size_t i = 0; i < routes.size(); ++i) {
+            if (i) {
+                out << ",";
+            }
+            out << "{\"route\":";
+            write_json_string(out, routes[i]);
+            out << ",\"hits\":" << (i < stats.route_hits.size() ? stats.route_hits[i] : 0) << "}";
+        }
+        out << "]}";
+    }
+    out << "}\n";
+}
@@ -0,0 +1,62 @@
+#ifndef __filter_stats_h__
+#define __filter_stats_h__
+
+/*
+    Counters kept by filter while it matches lines, reported as a single
+    line of JSON so that a run can be inspected while it is in progress
+    (SIGUSR1) and when it finishes (--stats).
+
+    Each thread keeps its own FilterStats; reports add them together. A
+    line is credited to the first pattern found to match it, so a pattern
+    with no hits never decided the fate of a line and can be removed. A
+    route, on the other hand, counts every line it sent.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct PatternStats {
+    uint64_t evaluations;
+    uint64_t hits;
+    uint64_t time_ns;
+};
+
+struct FilterStats {
+    uint64_t lines_in;
+    uint64_t bytes_in;
+    uint64_t lines_out;
+    uint64_t bytes_out;
+    uint64_t where_rejected;
+    uint64_t where_ns;
+    uint64_t prefilter_rejected;
+    uint64_t prefilter_ns;
+    PatternStats combined;                  // the single pass matcher as a whole
+    std::vector<uint64_t> combined_hits;    // by PatternSet index
+    std::vector<PatternStats> fallback;     // by fallback pattern id
+    std::vector<uint64_t> route_hits;       // lines sent by each --route
+    uint64_t route_default;                 // lines no route matched
+    uint64_t route_ns;
+
+    FilterStats() { clear(); }
+    void clear();
+    void resize(size_t combined_patterns, size_t fallback_patterns, size_t routes = 0);
+    void add(const FilterStats &other);
+};
+
+// how each command line pattern is evaluated, for reporting
+struct PatternDescription {
+    std::string text;
+    bool combined;
+    int index;      // PatternSet index or fallback id
+};
+
+// monotonic nanoseconds, for timing evaluation
+uint64_t stats_clock_ns();
+
+void write_stats_json(std::ostream &out, const FilterStats &stats, const std::vector<PatternDescription> &patterns,
+        const std::vector<std::string> &routes, const std::string &where, bool prefilter, bool timed, double elapsed_secs);
+
+#endif
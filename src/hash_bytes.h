@@ -0,0 +1,20 @@
+#ifndef __hash_bytes_h__
+#define __hash_bytes_h__
+
+/*
+    FNV-1a, for the hash tables of literals, names and field values.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+inline uint64_t hash_bytes(const char *p, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+#endif
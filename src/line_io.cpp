@@ -0,0 +1,190 @@
+#include "line_io.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <new>
+
+static uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+LineReader::LineReader(int fd_, size_t buffer_size) : fd(fd_), capacity(buffer_size),
+    start(0), scan(0), end(0), eof(false), bytes_read(0)
+{
+    // one extra byte so that a final unterminated line can be nul terminated
+    buffer = (char *)malloc(capacity + 1);
+    if (!buffer) {
+        throw std::bad_alloc();
+    }
+}
+
+LineReader::~LineReader()
+{
+    free(buffer);
+}
+
+LineReader::Status LineReader::next(char *&line, size_t &len)
+{
+    char *nl = (char *)memchr(buffer + scan, '\n', end - scan);
+    if (nl) {
+        line = buffer + start;
+        len = nl - line;
+        *nl = 0;
+        start = scan = nl - buffer + 1;
+        return line_ready;
+    }
+    scan = end;
+    if (!eof) {
+        return need_input;
+    }
+    if (start < end) {
+        line = buffer + start;
+        len = end - start;
+        buffer[end] = 0;
+        start = scan = end;
+        return line_ready;
+    }
+    return end_of_input;
+}
+
+LineReader::FillResult LineReader::fill(int timeout_ms)
+{
+    if (eof) {
+        return at_eof;
+    }
+    if (start > 0) {
+        memmove(buffer, buffer + start, end - start);
+        end -= start;
+        scan -= start;
+        start = 0;
+    }
+    if (end == capacity) {
+        // a single line longer than the buffer
+        char *bigger = (char *)realloc(buffer, capacity * 2 + 1);
+        if (!bigger) {
+            throw std::bad_alloc();
+        }
+        buffer = bigger;
+        capacity *= 2;
+    }
+    if (timeout_ms >= 0) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int n = poll(&pfd, 1, timeout_ms);
+        if (n == 0) {
+            return timed_out;
+        }
+        if (n < 0) {
+            return (errno == EINTR) ? interrupted : read_error;
+        }
+    }
+    ssize_t n = read(fd, buffer + end, capacity - end);
+    if (n < 0) {
+        return (errno == EINTR) ? interrupted : read_error;
+    }
+    if (n == 0) {
+        eof = true;
+        return at_eof;
+    }
+    end += n;
+    bytes_read += n;
+    return filled;
+}
+
+OutputBuffer::OutputBuffer(int fd_, size_t capacity_) : fd(fd_), capacity(capacity_), used(0),
+    pending_since(0), bytes_written(0), write_failed(false)
+{
+    buffer = (char *)malloc(capacity);
+    if (!buffer) {
+        throw std::bad_alloc();
+    }
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    flush();
+    free(buffer);
+}
+
+void OutputBuffer::append(const char *data, size_t len)
+{
+    if (used == 0) {
+        pending_since = monotonic_ms();
+    }
+    while (len > 0) {
+        if (used == capacity && !flush()) {
+            used = 0;   // the destination has gone; discard rather than grow forever
+        }
+        size_t n = capacity - used;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buffer + used, data, n);
+        used += n;
+        data += n;
+        len -= n;
+    }
+}
+
+bool OutputBuffer::flush()
+{
+    size_t done = 0;
+    while (done < used) {
+        ssize_t n = write(fd, buffer + done, used - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            write_failed = true;
+            used = 0;
+            return false;
+        }
+        done += n;
+    }
+    bytes_written += used;
+    used = 0;
+    return true;
+}
+
+int OutputBuffer::flushTimeout(unsigned int interval_ms)
+{
+    if (used == 0) {
+        return -1;
+    }
+    uint64_t age = monotonic_ms() - pending_since;
+    if (age >= interval_ms) {
+        flush();
+        return -1;
+    }
+    return (int)(interval_ms - age);
+}
+
+int split_fields(const char *line, size_t len, LineField *fields, int max)
+{
+    const char *p = line;
+    const char *end = line + len;
+    int n = 0;
+    while (n < max) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            ++p;
+        }
+        if (p == end) {
+            break;
+        }
+        fields[n].text = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r') {
+            ++p;
+        }
+        fields[n].len = p - fields[n].text;
+        ++n;
+    }
+    return n;
+}
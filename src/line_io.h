@@ -0,0 +1,90 @@
+#ifndef __line_io_h__
+#define __line_io_h__
+
+/*
+    Block oriented line input and buffered output for the text tools.
+
+    LineReader reads large chunks with read() and hands out lines in place:
+    the newline is replaced with a nul so each line can be used as a C
+    string without being copied. next() never performs I/O; when it runs
+    out of complete lines the caller decides how long it is prepared to
+    wait and calls fill().
+
+    OutputBuffer collects output and writes it when the buffer fills, when
+    asked to, or when the oldest unwritten byte is older than the caller's
+    flush interval (see flushTimeout()).
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+class LineReader {
+    public:
+        enum Status { line_ready, need_input, end_of_input };
+        enum FillResult { filled, timed_out, interrupted, at_eof, read_error };
+
+        explicit LineReader(int fd, size_t buffer_size = 1024 * 1024);
+        ~LineReader();
+
+        Status next(char *&line, size_t &len);
+
+        // wait up to timeout_ms (-1 to block) for more input and read it
+        FillResult fill(int timeout_ms = -1);
+
+        uint64_t bytesRead() const { return bytes_read; }
+
+    private:
+        int fd;
+        char *buffer;
+        size_t capacity;
+        size_t start;   // first byte not yet returned
+        size_t scan;    // bytes before this are known not to contain a newline
+        size_t end;     // end of valid data
+        bool eof;
+        uint64_t bytes_read;
+
+        LineReader(const LineReader &);
+        LineReader &operator=(const LineReader &);
+};
+
+class OutputBuffer {
+    public:
+        explicit OutputBuffer(int fd, size_t capacity = 256 * 1024);
+        ~OutputBuffer();
+
+        void append(const char *data, size_t len);
+        void appendLine(const char *data, size_t len) { append(data, len); append("\n", 1); }
+        bool flush();
+        bool pending() const { return used > 0; }
+
+        // flushes if unwritten output is older than interval_ms and returns
+        // how long the caller may wait before calling again, -1 for no limit
+        int flushTimeout(unsigned int interval_ms);
+
+        uint64_t bytesWritten() const { return bytes_written; }
+        bool failed() const { return write_failed; }
+
+    private:
+        int fd;
+        char *buffer;
+        size_t capacity;
+        size_t used;
+        uint64_t pending_since;
+        uint64_t bytes_written;
+        bool write_failed;
+
+        OutputBuffer(const OutputBuffer &);
+        OutputBuffer &operator=(const OutputBuffer &);
+};
+
+// a field of a line, not nul terminated
+struct LineField {
+    const char *text;
+    size_t len;
+};
+
+// split up to max whitespace separated fields out of the line in place;
+// returns the number found
+int split_fields(const char *line, size_t len, LineField *fields, int max);
+
+#endif
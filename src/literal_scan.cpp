@@ -0,0 +1,218 @@
+#include "literal_scan.h"
+#include "hash_bytes.h"
+#include <algorithm>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// rough relative byte frequencies in sampler output; lower is rarer
+static int byte_frequency(unsigned char c)
+{
+    if (c >= '0' && c <= '9') {
+        return 90;
+    }
+    if (c == '\t' || c == ' ' || c == '.') {
+        return 80;
+    }
+    if (strchr("etaoinsrlcdu", c)) {
+        return 60;
+    }
+    if (c >= 'a' && c <= 'z') {
+        return 30;
+    }
+    if (c >= 'A' && c <= 'Z') {
+        return 20;
+    }
+    if (c == '_' || c == '-' || c == ':' || c == '"') {
+        return 15;
+    }
+    return 5;
+}
+
+static const int max_simd_anchors = 8;
+static const size_t max_groups_per_anchor = 4;
+
+LiteralScanner::LiteralScanner() : match_all(false), prepared(false), anchor_count(0)
+{
+    memset(anchors, 0, sizeof(anchors));
+    memset(is_anchor, 0, sizeof(is_anchor));
+}
+
+void LiteralScanner::add(const std::string &literal)
+{
+    if (literal.empty()) {
+        match_all = true;
+    }
+    else {
+        literals.push_back(literal);
+    }
+    prepared = false;
+}
+
+void LiteralScanner::prepare() const
+{
+    for (int i = 0; i < 256; ++i) {
+        by_anchor[i].clear();
+    }
+    memset(is_anchor, 0, sizeof(is_anchor));
+    anchor_count = 0;
+    for (size_t i = 0; i < literals.size(); ++i) {
+        const std::string &lit = literals[i];
+        // reuse an anchor byte that is already being scanned for when the
+        // literal contains one, otherwise take the literal's rarest byte
+        size_t best = 0;
+        bool shared = false;
+        for (size_t j = 0; j < lit.length(); ++j) {
+            unsigned char c = lit[j];
+            unsigned char b = lit[best];
+            if (is_anchor[c] && (!shared || byte_frequency(c) < byte_frequency(b))) {
+                best = j;
+                shared = true;
+            }
+            else if (!shared && byte_frequency(c) < byte_frequency(b)) {
+                best = j;
+            }
+        }
+        unsigned char anchor = lit[best];
+        if (!is_anchor[anchor]) {
+            is_anchor[anchor] = true;
+            if (anchor_count < (int)sizeof(anchors)) {
+                anchors[anchor_count] = anchor;
+            }
+            ++anchor_count;
+        }
+        std::vector<Group> &groups = by_anchor[anchor];
+        size_t g = 0;
+        while (g < groups.size() && (groups[g].anchor_offset != best || groups[g].length != lit.length())) {
+            ++g;
+        }
+        if (g == groups.size()) {
+            Group group;
+            group.anchor_offset = best;
+            group.length = lit.length();
+            groups.push_back(group);
+        }
+        groups[g].hashes.push_back(std::make_pair(hash_bytes(lit.data(), lit.length()), i));
+    }
+    for (int c = 0; c < 256; ++c) {
+        for (size_t g = 0; g < by_anchor[c].size(); ++g) {
+            std::sort(by_anchor[c][g].hashes.begin(), by_anchor[c][g].hashes.end());
+        }
+    }
+    prepared = true;
+}
+
+bool LiteralScanner::selective() const
+{
+    if (match_all) {
+        return false;
+    }
+    if (!prepared) {
+        prepare();
+    }
+    for (int i = 0; i < 256; ++i) {
+        if (by_anchor[i].size() > max_groups_per_anchor) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LiteralScanner::verify(const char *text, size_t len, size_t pos) const
+{
+    const std::vector<Group> &groups = by_anchor[(unsigned char)text[pos]];
+    for (size_t g = 0; g < groups.size(); ++g) {
+        const Group &group = groups[g];
+        if (pos < group.anchor_offset || pos - group.anchor_offset + group.length > len) {
+            continue;
+        }
+        const char *start = text + pos - group.anchor_offset;
+        if (group.hashes.size() <= 2) {
+            for (size_t i = 0; i < group.hashes.size(); ++i) {
+                if (memcmp(start, literals[group.hashes[i].second].data(), group.length) == 0) {
+                    return true;
+                }
+            }
+            continue;
+        }
+        std::pair<uint64_t, size_t> key(hash_bytes(start, group.length), 0);
+        std::vector<std::pair<uint64_t, size_t> >::const_iterator iter
+            = std::lower_bound(group.hashes.begin(), group.hashes.end(), key);
+        while (iter != group.hashes.end() && iter->first == key.first) {
+            if (memcmp(start, literals[iter->second].data(), group.length) == 0) {
+                return true;
+            }
+            ++iter;
+        }
+    }
+    return false;
+}
+
+bool LiteralScanner::contains(const char *text, size_t len) const
+{
+    if (match_all) {
+        return true;
+    }
+    if (!prepared) {
+        prepare();
+    }
+    if (literals.empty()) {
+        return false;
+    }
+    size_t pos = 0;
+#if defined(__SSE2__)
+    if (anchor_count <= max_simd_anchors) {
+        __m128i needles[max_simd_anchors];
+        for (int i = 0; i < anchor_count; ++i) {
+            needles[i] = _mm_set1_epi8((char)anchors[i]);
+        }
+        for (; pos + 16 <= len; pos += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(text + pos));
+            __m128i hits = _mm_cmpeq_epi8(block, needles[0]);
+            for (int i = 1; i < anchor_count; ++i) {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[i]));
+            }
+            unsigned int mask = _mm_movemask_epi8(hits);
+            while (mask) {
+                int bit = __builtin_ctz(mask);
+                if (verify(text, len, pos + bit)) {
+                    return true;
+                }
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+    for (; pos < len; ++pos) {
+        if (is_anchor[(unsigned char)text[pos]] && verify(text, len, pos)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LiteralScanner::find(const char *text, size_t len, const std::string &literal)
+{
+    size_t n = literal.length();
+    if (n == 0) {
+        return true;
+    }
+    if (n > len) {
+        return false;
+    }
+    const char first = literal[0];
+    const char *p = text;
+    const char *last = text + len - n;
+    while (p <= last) {
+        p = (const char *)memchr(p, first, last - p + 1);
+        if (!p) {
+            return false;
+        }
+        if (memcmp(p, literal.data(), n) == 0) {
+            return true;
+        }
+        ++p;
+    }
+    return false;
+}
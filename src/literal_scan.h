@@ -0,0 +1,59 @@
+#ifndef __literal_scan_h__
+#define __literal_scan_h__
+
+/*
+    LiteralScanner answers "does this text contain any of these strings?"
+    quickly enough to be used as a prefilter in front of the regular
+    expression engines. Each literal is anchored on its least common byte;
+    the text is scanned for the anchor bytes sixteen at a time with SSE2
+    where available and only the positions that hit an anchor are checked.
+    Literals sharing an anchor byte are grouped by the position of the anchor
+    and their length so that a check costs one hash lookup per group rather
+    than a comparison per literal.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class LiteralScanner {
+    public:
+        LiteralScanner();
+
+        // an empty literal makes every text a candidate
+        void add(const std::string &literal);
+        bool empty() const { return literals.empty() && !match_all; }
+        bool matchesAll() const { return match_all; }
+
+        // true if the text contains at least one of the literals
+        bool contains(const char *text, size_t len) const;
+
+        // false when so many literals share anchor bytes that verifying
+        // candidates would cost more than the scan saves
+        bool selective() const;
+
+        // single literal search, used to guard an individual pattern
+        static bool find(const char *text, size_t len, const std::string &literal);
+
+    private:
+        struct Group {
+            size_t anchor_offset;
+            size_t length;
+            std::vector<std::pair<uint64_t, size_t> > hashes;   // (hash, literal index), sorted
+        };
+
+        void prepare() const;
+        bool verify(const char *text, size_t len, size_t pos) const;
+
+        std::vector<std::string> literals;
+        bool match_all;
+
+        mutable bool prepared;
+        mutable std::vector<Group> by_anchor[256];
+        mutable uint8_t anchors[16];
+        mutable int anchor_count;
+        mutable bool is_anchor[256];
+};
+
+#endif
@@ -0,0 +1,29 @@
+#include "message_decoder.h"
+#include "sample_output.h"
+
+bool decode_command(const std::string &op, const std::list<Value> &params, uint64_t time, Event &event)
+{
+    std::list<Value>::const_iterator param = params.begin();
+    if (op == "STATE" && params.size() == 2) {
+        std::string machine = (*param++).asString();
+        event.setState(time, machine, (*param).asString());
+        return true;
+    }
+    if (op == "PROPERTY" && params.size() == 3) {
+        std::string machine = (*param++).asString();
+        std::string prop = (*param++).asString();
+        const Value &val = *param;
+        std::string value_str;
+        if (val.kind == Value::t_string) {
+            value_str = "\"";
+            value_str += escapeNonprintables(val.asString().c_str());
+            value_str += "\"";
+        }
+        else {
+            value_str = escapeNonprintables(val.asString().c_str());
+        }
+        event.setProperty(time, machine, prop, value_str);
+        return true;
+    }
+    return false;
+}
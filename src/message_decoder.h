@@ -0,0 +1,20 @@
+#ifndef __message_decoder_h__
+#define __message_decoder_h__
+
+/*
+    Turns the STATE and PROPERTY commands that clockwork publishes into
+    pipeline Events (see pipeline.h). Property values are escaped as
+    sampler writes them, with string values in quotes.
+*/
+
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <value.h>
+#include "pipeline.h"
+
+// false if the command is not a STATE or PROPERTY change with the right
+// number of parameters
+bool decode_command(const std::string &op, const std::list<Value> &params, uint64_t time, Event &event);
+
+#endif
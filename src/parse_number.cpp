@@ -0,0 +1,93 @@
+#include "parse_number.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+bool parse_number(const char *p, size_t len, double &result)
+{
+    const char *start = p;
+    const char *end = p + len;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;     // significant digits in mantissa
+    int scale = 0;
+    bool any = false;
+    for (; p < end && isdigit((unsigned char)*p); ++p) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) {
+                ++digits;
+            }
+        }
+        else {
+            ++scale;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && isdigit((unsigned char)*p); ++p) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) {
+                    ++digits;
+                }
+                --scale;
+            }
+        }
+    }
+    if (!any) {
+        return false;
+    }
+    if (p == end && digits <= 15 && scale >= -22 && scale <= 22) {
+        // both operands are exact so the result is correctly rounded
+        double value = (double)mantissa;
+        value = scale < 0 ? value / powers_of_ten[-scale] : value * powers_of_ten[scale];
+        result = negative ? -value : value;
+        return true;
+    }
+    if (p < end && *p != 'e' && *p != 'E') {
+        return false;
+    }
+    char buf[64];
+    if (len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, start, len);
+    buf[len] = 0;
+    char *stop;
+    result = strtod(buf, &stop);
+    return stop == buf + len;
+}
+
+bool parse_integer(const char *p, size_t len, long &result)
+{
+    const char *end = p + len;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    if (p == end || end - p > 18) {
+        return false;
+    }
+    long value = 0;
+    for (; p < end; ++p) {
+        if (!isdigit((unsigned char)*p)) {
+            return false;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    result = negative ? -value : value;
+    return true;
+}
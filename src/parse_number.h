@@ -0,0 +1,16 @@
+#ifndef __parse_number_h__
+#define __parse_number_h__
+
+/*
+    Number parsing for fields that have already been split out of a line,
+    so the text is not nul terminated. The whole of the text must be the
+    number. Common cases (integers and decimals of up to 15 significant
+    digits) are converted exactly without calling strtod.
+*/
+
+#include <stddef.h>
+
+bool parse_number(const char *p, size_t len, double &result);
+bool parse_integer(const char *p, size_t len, long &result);
+
+#endif
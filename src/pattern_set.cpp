@@ -0,0 +1,951 @@
+#include "pattern_set.h"
+#include <algorithm>
+#include <ctype.h>
+#include <string.h>
+
+static const size_t max_nfa_states = 100000;
+static const size_t max_dfa_states = 4096;
+static const int max_repeat = 255;
+static const int max_depth = 200;
+
+enum { bol_marker = -1, match_marker = -2 };   // match_marker - i: pattern i has matched
+
+class PatternSet::Parser {
+    public:
+        // a lenient parser accepts any construct, representing the ones the
+        // matcher cannot handle as opaque nodes; used for literal extraction
+        Parser(const char *pattern, std::vector<Node> &nodes_, std::vector<CharSet> &charsets_, bool lenient_ = false)
+            : p(pattern), nodes(nodes_), charsets(charsets_), depth(0), lenient(lenient_) {}
+        int parse();
+
+    private:
+        int parseAlt();
+        int parseCat();
+        int parseRepeat();
+        int parseAtom();
+        bool parseBracket(CharSet &cs);
+        bool parseNumber(int &val);
+        int node(Node::Type type, int left = -1, int right = -1);
+        int charNode(const CharSet &cs);
+
+        const char *p;
+        std::vector<Node> &nodes;
+        std::vector<CharSet> &charsets;
+        int depth;
+        bool lenient;
+};
+
+int PatternSet::Parser::node(Node::Type type, int left, int right)
+{
+    Node n;
+    n.type = type;
+    n.set = -1;
+    n.left = left;
+    n.right = right;
+    n.min = 0;
+    n.max = 0;
+    nodes.push_back(n);
+    return (int)nodes.size() - 1;
+}
+
+int PatternSet::Parser::charNode(const CharSet &cs)
+{
+    charsets.push_back(cs);
+    int n = node(Node::chars);
+    nodes[n].set = (int)charsets.size() - 1;
+    return n;
+}
+
+int PatternSet::Parser::parse()
+{
+    int root = parseAlt();
+    if (root < 0 || *p) {
+        return -1;    // includes an unbalanced ')'
+    }
+    return root;
+}
+
+int PatternSet::Parser::parseAlt()
+{
+    if (++depth > max_depth) {
+        return -1;
+    }
+    int left = parseCat();
+    while (left >= 0 && *p == '|') {
+        ++p;
+        int right = parseCat();
+        if (right < 0) {
+            return -1;
+        }
+        left = node(Node::alt, left, right);
+    }
+    --depth;
+    return left;
+}
+
+int PatternSet::Parser::parseCat()
+{
+    int result = -1;
+    while (*p && *p != '|' && *p != ')') {
+        int item = parseRepeat();
+        if (item < 0) {
+            return -1;
+        }
+        result = (result < 0) ? item : node(Node::cat, result, item);
+    }
+    if (result < 0) {
+        result = node(Node::empty);
+    }
+    return result;
+}
+
+bool PatternSet::Parser::parseNumber(int &val)
+{
+    if (!isdigit((unsigned char)*p)) {
+        return false;
+    }
+    val = 0;
+    while (isdigit((unsigned char)*p)) {
+        val = val * 10 + *p++ - '0';
+        if (val > max_repeat) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int PatternSet::Parser::parseRepeat()
+{
+    int atom = parseAtom();
+    if (atom < 0) {
+        return -1;
+    }
+    while (*p == '*' || *p == '+' || *p == '?' || *p == '{') {
+        if (nodes[atom].type == Node::bol || nodes[atom].type == Node::eol) {
+            return -1;
+        }
+        int min = 0, max = -1;
+        if (*p == '+') {
+            min = 1;
+        }
+        else if (*p == '?') {
+            max = 1;
+        }
+        else if (*p == '{') {
+            ++p;
+            if (!parseNumber(min)) {
+                return -1;
+            }
+            max = min;
+            if (*p == ',') {
+                ++p;
+                max = -1;
+                if (*p != '}' && (!parseNumber(max) || max < min)) {
+                    return -1;
+                }
+            }
+            if (*p != '}') {
+                return -1;
+            }
+        }
+        ++p;
+        atom = node(Node::repeat, atom);
+        nodes[atom].min = min;
+        nodes[atom].max = max;
+    }
+    return atom;
+}
+
+int PatternSet::Parser::parseAtom()
+{
+    CharSet cs;
+    memset(cs.bits, 0, sizeof(cs.bits));
+    char c = *p++;
+    switch (c) {
+        case '(': {
+            if (*p == ')') {
+                ++p;
+                return node(Node::empty);
+            }
+            int inner = parseAlt();
+            if (inner < 0 || *p != ')') {
+                return -1;
+            }
+            ++p;
+            return inner;
+        }
+        case '[': {
+            const char *restart = p;
+            if (!parseBracket(cs)) {
+                if (!lenient) {
+                    return -1;
+                }
+                // skip to the closing bracket, treating [[:x:]] and friends as one item
+                p = restart;
+                if (*p == '^') {
+                    ++p;
+                }
+                if (*p == ']') {
+                    ++p;
+                }
+                while (*p && *p != ']') {
+                    if (*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+                        const char *end = strchr(p + 2, ']');
+                        p = end ? end : p + 1;
+                    }
+                    ++p;
+                }
+                if (!*p) {
+                    return -1;
+                }
+                ++p;
+                return node(Node::opaque);
+            }
+            return charNode(cs);
+        }
+        case '.':
+            for (int i = 1; i < 256; ++i) {
+                cs.set((unsigned char)i);
+            }
+            return charNode(cs);
+        case '^':
+            return node(Node::bol);
+        case '$':
+            return node(Node::eol);
+        case '\\':
+            c = *p++;
+            if (c && lenient && !strchr(".[]()*+?{}|^$\\/", c)) {
+                return node(Node::opaque);
+            }
+            if (!c || !strchr(".[]()*+?{}|^$\\/", c)) {
+                return -1;    // back references and GNU escapes stay with the regex engine
+            }
+            cs.set((unsigned char)c);
+            return charNode(cs);
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            return -1;
+        default:
+            cs.set((unsigned char)c);
+            return charNode(cs);
+    }
+}
+
+bool PatternSet::Parser::parseBracket(CharSet &cs)
+{
+    bool negate = false;
+    if (*p == '^') {
+        negate = true;
+        ++p;
+    }
+    bool first = true;
+    for (;;) {
+        unsigned char c = *p;
+        if (!c) {
+            return false;
+        }
+        if (c == ']' && !first) {
+            ++p;
+            break;
+        }
+        first = false;
+        if (c == '[' && p[1] == ':') {
+            const char *end = strstr(p + 2, ":]");
+            if (!end) {
+                return false;
+            }
+            std::string name(p + 2, end - p - 2);
+            int (*fn)(int) = 0;
+            if (name == "alpha") fn = isalpha;
+            else if (name == "digit") fn = isdigit;
+            else if (name == "alnum") fn = isalnum;
+            else if (name == "upper") fn = isupper;
+            else if (name == "lower") fn = islower;
+            else if (name == "space") fn = isspace;
+            else if (name == "blank") fn = isblank;
+            else if (name == "punct") fn = ispunct;
+            else if (name == "print") fn = isprint;
+            else if (name == "graph") fn = isgraph;
+            else if (name == "cntrl") fn = iscntrl;
+            else if (name == "xdigit") fn = isxdigit;
+            else {
+                return false;
+            }
+            for (int i = 1; i < 256; ++i) {
+                if (fn(i)) {
+                    cs.set((unsigned char)i);
+                }
+            }
+            p = end + 2;
+            continue;
+        }
+        if (c == '[' && (p[1] == '=' || p[1] == '.')) {
+            return false;    // equivalence classes and collating symbols
+        }
+        ++p;
+        if (*p == '-' && p[1] && p[1] != ']') {
+            unsigned char hi = p[1];
+            if (hi == '[' || hi < c) {
+                return false;
+            }
+            p += 2;
+            for (int i = c; i <= hi; ++i) {
+                cs.set((unsigned char)i);
+            }
+        }
+        else {
+            cs.set(c);
+        }
+    }
+    if (negate) {
+        for (int i = 0; i < 4; ++i) {
+            cs.bits[i] = ~cs.bits[i];
+        }
+    }
+    cs.bits[0] &= ~(uint64_t)1;    // nul never appears inside a line
+    return true;
+}
+
+PatternSet::PatternSet() : start(-1), prepared(false), class_count(0), initial(-1), found_generation(0), generation(0)
+{
+    memset(byte_class, 0, sizeof(byte_class));
+    memset(class_rep, 0, sizeof(class_rep));
+}
+
+int PatternSet::newState(NfaState::Type type, int out, int out1, int arg)
+{
+    NfaState s;
+    s.type = type;
+    s.out = out;
+    s.out1 = out1;
+    s.arg = arg;
+    nfa.push_back(s);
+    return (int)nfa.size() - 1;
+}
+
+int PatternSet::compileNode(const std::vector<Node> &nodes, int n, int next)
+{
+    if (nfa.size() > max_nfa_states) {
+        return -1;
+    }
+    const Node &node = nodes[n];
+    switch (node.type) {
+        case Node::empty:
+            return next;
+        case Node::opaque:
+            return -1;
+        case Node::chars:
+            return newState(NfaState::set, next, -1, node.set);
+        case Node::bol:
+            return newState(NfaState::bol, next, -1, -1);
+        case Node::eol:
+            return newState(NfaState::eol, next, -1, -1);
+        case Node::cat: {
+            int right = compileNode(nodes, node.right, next);
+            return (right < 0) ? -1 : compileNode(nodes, node.left, right);
+        }
+        case Node::alt: {
+            int left = compileNode(nodes, node.left, next);
+            int right = compileNode(nodes, node.right, next);
+            if (left < 0 || right < 0) {
+                return -1;
+            }
+            return newState(NfaState::split, left, right, -1);
+        }
+        case Node::repeat: {
+            int tail = next;
+            if (node.max < 0) {
+                int loop = newState(NfaState::split, -1, next, -1);
+                int body = compileNode(nodes, node.left, loop);
+                if (body < 0) {
+                    return -1;
+                }
+                nfa[loop].out = body;
+                tail = loop;
+            }
+            else {
+                for (int i = node.min; i < node.max; ++i) {
+                    int body = compileNode(nodes, node.left, tail);
+                    if (body < 0) {
+                        return -1;
+                    }
+                    tail = newState(NfaState::split, body, next, -1);
+                }
+            }
+            for (int i = 0; i < node.min; ++i) {
+                tail = compileNode(nodes, node.left, tail);
+                if (tail < 0) {
+                    return -1;
+                }
+            }
+            return tail;
+        }
+    }
+    return -1;
+}
+
+int PatternSet::add(const char *pattern)
+{
+    std::vector<Node> nodes;
+    size_t charset_mark = charsets.size();
+    size_t nfa_mark = nfa.size();
+    Parser parser(pattern, nodes, charsets);
+    int root = parser.parse();
+    int entry = -1;
+    if (root >= 0) {
+        int match = newState(NfaState::match, -1, -1, (int)patterns.size());
+        entry = compileNode(nodes, root, match);
+    }
+    if (entry < 0) {
+        charsets.resize(charset_mark);
+        nfa.resize(nfa_mark);
+        return -1;
+    }
+    starts.push_back(entry);
+    patterns.push_back(pattern);
+    prepared = false;
+    return (int)patterns.size() - 1;
+}
+
+void PatternSet::prepare()
+{
+    // partition the bytes into classes that no character set distinguishes
+    memset(byte_class, 0, sizeof(byte_class));
+    class_count = 1;
+    for (size_t i = 0; i < charsets.size(); ++i) {
+        int remap[512];
+        for (int j = 0; j < 512; ++j) {
+            remap[j] = -1;
+        }
+        int count = 0;
+        for (int b = 0; b < 256; ++b) {
+            int key = byte_class[b] * 2 + (charsets[i].test((unsigned char)b) ? 1 : 0);
+            if (remap[key] < 0) {
+                remap[key] = count++;
+            }
+            byte_class[b] = (uint8_t)remap[key];
+        }
+        class_count = count;
+    }
+    for (int b = 255; b >= 0; --b) {
+        class_rep[byte_class[b]] = (unsigned char)b;
+    }
+
+    // a split chain over every pattern start is the combined entry point
+    start = -1;
+    for (size_t i = starts.size(); i-- > 0;) {
+        start = (start < 0) ? starts[i] : newState(NfaState::split, starts[i], start, -1);
+    }
+    visited.assign(nfa.size(), 0);
+    generation = 0;
+    prepared = true;
+    resetCache();
+}
+
+void PatternSet::resetCache()
+{
+    dstates.clear();
+    transitions.clear();
+    flags.clear();
+    accepted.clear();
+    dstate_index.clear();
+    std::vector<int> seeds(1, start), kept, matched;
+    closure(seeds, true, false, kept, matched);
+    initial = addState(kept, true, matched);
+}
+
+void PatternSet::closure(std::vector<int> &seeds, bool at_bol, bool at_eol, std::vector<int> &kept, std::vector<int> &matched)
+{
+    if (++generation == 0) {
+        std::fill(visited.begin(), visited.end(), 0);
+        generation = 1;
+    }
+    kept.clear();
+    matched.clear();
+    stack.assign(seeds.begin(), seeds.end());
+    while (!stack.empty()) {
+        int s = stack.back();
+        stack.pop_back();
+        if (s < 0 || visited[s] == generation) {
+            continue;
+        }
+        visited[s] = generation;
+        const NfaState &state = nfa[s];
+        switch (state.type) {
+            case NfaState::set:
+                kept.push_back(s);
+                break;
+            case NfaState::split:
+                stack.push_back(state.out1);
+                stack.push_back(state.out);
+                break;
+            case NfaState::bol:
+                if (at_bol) {
+                    stack.push_back(state.out);
+                }
+                break;
+            case NfaState::eol:
+                if (at_eol) {
+                    stack.push_back(state.out);
+                }
+                else {
+                    kept.push_back(s);
+                }
+                break;
+            case NfaState::epsilon:
+                stack.push_back(state.out);
+                break;
+            case NfaState::match:
+                matched.push_back(state.arg);
+                break;
+        }
+    }
+    std::sort(kept.begin(), kept.end());
+    std::sort(matched.begin(), matched.end());
+}
+
+int PatternSet::addState(std::vector<int> &kept, bool at_bol, const std::vector<int> &matched)
+{
+    std::vector<int> key(kept);
+    for (size_t i = 0; i < matched.size(); ++i) {
+        key.insert(key.begin(), match_marker - matched[i]);
+    }
+    if (at_bol) {
+        key.insert(key.begin(), bol_marker);
+    }
+    std::map<std::vector<int>, int>::iterator found = dstate_index.find(key);
+    if (found != dstate_index.end()) {
+        return found->second;
+    }
+    DState ds;
+    ds.nfa = kept;
+    ds.bol = at_bol;
+    ds.matched = matched;
+    dstates.push_back(ds);
+    int idx = (int)dstates.size() - 1;
+    dstate_index[key] = idx;
+    transitions.resize(dstates.size() * class_count, -1);
+
+    // a match is possible at the end of the text if any pending '$' leads to one
+    std::vector<int> seeds, unused;
+    for (size_t i = 0; i < kept.size(); ++i) {
+        if (nfa[kept[i]].type == NfaState::eol) {
+            seeds.push_back(kept[i]);
+        }
+    }
+    std::vector<int> &matched_at_end = dstates.back().matched_at_end;
+    if (!seeds.empty()) {
+        closure(seeds, at_bol, true, unused, matched_at_end);
+    }
+    if (!matched.empty()) {
+        flags.push_back(accept_now | accept_at_end);
+        accepted.push_back(matched.front());
+    }
+    else {
+        flags.push_back(matched_at_end.empty() ? 0 : accept_at_end);
+        accepted.push_back(matched_at_end.empty() ? -1 : matched_at_end.front());
+    }
+    return idx;
+}
+
+int PatternSet::computeTransition(int state, int cls)
+{
+    if (dstates.size() >= max_dfa_states) {
+        DState keep = dstates[state];
+        resetCache();
+        state = addState(keep.nfa, keep.bol, keep.matched);
+    }
+    unsigned char c = class_rep[cls];
+    std::vector<int> seeds, kept;
+    const std::vector<int> &current = dstates[state].nfa;
+    for (size_t i = 0; i < current.size(); ++i) {
+        const NfaState &s = nfa[current[i]];
+        if (s.type == NfaState::set && charsets[s.arg].test(c)) {
+            seeds.push_back(s.out);
+        }
+    }
+    seeds.push_back(start);    // a match may begin at any position
+    std::vector<int> matched;
+    closure(seeds, false, false, kept, matched);
+    int next = addState(kept, false, matched);
+    transitions[state * class_count + cls] = next;
+    return next;
+}
+
+static const std::string &longest(const std::string &a, const std::string &b)
+{
+    return (b.length() > a.length()) ? b : a;
+}
+
+static std::string common_prefix(const std::string &a, const std::string &b)
+{
+    size_t n = 0;
+    while (n < a.length() && n < b.length() && a[n] == b[n]) {
+        ++n;
+    }
+    return a.substr(0, n);
+}
+
+static std::string common_suffix(const std::string &a, const std::string &b)
+{
+    size_t n = 0;
+    while (n < a.length() && n < b.length() && a[a.length() - n - 1] == b[b.length() - n - 1]) {
+        ++n;
+    }
+    return a.substr(a.length() - n);
+}
+
+void PatternSet::literals(const std::vector<Node> &nodes, const std::vector<CharSet> &sets, int n, Literals &result)
+{
+    const Node &node = nodes[n];
+    result.exact = false;
+    result.all.clear();
+    result.prefix.clear();
+    result.suffix.clear();
+    result.required.clear();
+    switch (node.type) {
+        case Node::empty:
+        case Node::bol:
+        case Node::eol:
+            result.exact = true;
+            return;
+        case Node::opaque:
+            return;
+        case Node::chars: {
+            const CharSet &cs = sets[node.set];
+            int count = 0, only = 0;
+            for (int c = 0; c < 256 && count < 2; ++c) {
+                if (cs.test((unsigned char)c)) {
+                    only = c;
+                    ++count;
+                }
+            }
+            if (count == 1) {
+                result.exact = true;
+                result.all = std::string(1, (char)only);
+                result.prefix = result.suffix = result.required = result.all;
+            }
+            return;
+        }
+        case Node::cat: {
+            Literals left, right;
+            literals(nodes, sets, node.left, left);
+            literals(nodes, sets, node.right, right);
+            result.exact = left.exact && right.exact;
+            if (result.exact) {
+                result.all = left.all + right.all;
+            }
+            result.prefix = left.exact ? left.all + right.prefix : left.prefix;
+            result.suffix = right.exact ? left.suffix + right.all : right.suffix;
+            result.required = longest(longest(left.required, right.required), left.suffix + right.prefix);
+            result.required = longest(result.required, longest(result.prefix, result.suffix));
+            return;
+        }
+        case Node::alt: {
+            Literals left, right;
+            literals(nodes, sets, node.left, left);
+            literals(nodes, sets, node.right, right);
+            result.exact = left.exact && right.exact && left.all == right.all;
+            result.all = result.exact ? left.all : std::string();
+            result.prefix = common_prefix(left.prefix, right.prefix);
+            result.suffix = common_suffix(left.suffix, right.suffix);
+            result.required = longest(result.prefix, result.suffix);
+            return;
+        }
+        case Node::repeat: {
+            if (node.min == 0) {
+                return;
+            }
+            Literals child;
+            literals(nodes, sets, node.left, child);
+            result.prefix = child.prefix;
+            result.suffix = child.suffix;
+            result.required = child.required;
+            if (child.exact && node.min == node.max) {
+                result.exact = true;
+                for (int i = 0; i < node.min; ++i) {
+                    result.all += child.all;
+                }
+                result.prefix = result.suffix = result.required = result.all;
+            }
+            return;
+        }
+    }
+}
+
+std::string PatternSet::requiredLiteral(const char *pattern)
+{
+    std::vector<Node> nodes;
+    std::vector<CharSet> sets;
+    Parser parser(pattern, nodes, sets, true);
+    int root = parser.parse();
+    if (root < 0) {
+        return "";
+    }
+    Literals result;
+    literals(nodes, sets, root, result);
+    return result.exact ? result.all : result.required;
+}
+
+int PatternSet::match(const char *text, size_t len)
+{
+    if (patterns.empty()) {
+        return -1;
+    }
+    if (!prepared) {
+        prepare();
+    }
+    int s = initial;
+    if (flags[s] & accept_now) {
+        return accepted[s];
+    }
+    const unsigned char *p = (const unsigned char *)text;
+    const unsigned char *end = p + len;
+    while (p < end) {
+        int cls = byte_class[*p++];
+        int next = transitions[s * class_count + cls];
+        if (next < 0) {
+            next = computeTransition(s, cls);
+        }
+        s = next;
+        if (flags[s] & accept_now) {
+            return accepted[s];
+        }
+    }
+    return (flags[s] & accept_at_end) ? accepted[s] : -1;
+}
+
+void PatternSet::collect(const std::vector<int> &matched, std::vector<int> &found)
+{
+    for (size_t i = 0; i < matched.size(); ++i) {
+        int idx = matched[i];
+        if (found_mark[idx] != found_generation) {
+            found_mark[idx] = found_generation;
+            found.push_back(idx);
+        }
+    }
+}
+
+size_t PatternSet::matchAll(const char *text, size_t len, std::vector<int> &found)
+{
+    found.clear();
+    if (patterns.empty()) {
+        return 0;
+    }
+    if (!prepared) {
+        prepare();
+    }
+    if (found_mark.size() != patterns.size()) {
+        found_mark.assign(patterns.size(), 0);
+        found_generation = 0;
+    }
+    if (++found_generation == 0) {
+        std::fill(found_mark.begin(), found_mark.end(), 0);
+        found_generation = 1;
+    }
+    int s = initial;
+    collect(dstates[s].matched, found);
+    const unsigned char *p = (const unsigned char *)text;
+    const unsigned char *end = p + len;
+    while (p < end && found.size() < patterns.size()) {
+        int cls = byte_class[*p++];
+        int next = transitions[s * class_count + cls];
+        if (next < 0) {
+            next = computeTransition(s, cls);
+        }
+        s = next;
+        if (flags[s] & accept_now) {
+            collect(dstates[s].matched, found);
+        }
+    }
+    if (p == end) {
+        collect(dstates[s].matched_at_end, found);
+    }
+    return found.size();
+}
+
+#ifdef TESTING
+#include "literal_scan.h"
+#include <iostream>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_secs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::string random_pattern()
+{
+    static const char *atoms[] = { "a", "b", "c", ".", "[ab]", "[^a]", "(a|bc)", "\\.", "[[:digit:]]", "()", "x" };
+    static const char *quantifiers[] = { "", "", "", "*", "+", "?", "{2}", "{1,3}", "{0,}" };
+    std::string result;
+    if (rand() % 5 == 0) {
+        result += "^";
+    }
+    int n = 1 + rand() % 4;
+    for (int i = 0; i < n; ++i) {
+        result += atoms[rand() % (sizeof(atoms) / sizeof(*atoms))];
+        result += quantifiers[rand() % (sizeof(quantifiers) / sizeof(*quantifiers))];
+        if (rand() % 10 == 0) {
+            result += "|";
+        }
+    }
+    if (rand() % 5 == 0) {
+        result += "$";
+    }
+    return result;
+}
+
+// compare the combined matcher against regexec on random patterns and text
+static int check(int rounds)
+{
+    const char *alphabet = "abcx.1\t";
+    int failures = 0;
+    for (int r = 0; r < rounds; ++r) {
+        PatternSet set;
+        std::vector<regex_t> regexes;
+        int count = 1 + rand() % 4;
+        for (int i = 0; i < count; ++i) {
+            std::string pat = random_pattern();
+            regex_t re;
+            if (regcomp(&re, pat.c_str(), REG_EXTENDED | REG_NOSUB) != 0) {
+                continue;
+            }
+            if (set.add(pat.c_str()) < 0) {
+                std::cerr << "unsupported: " << pat << "\n";
+                regfree(&re);
+                continue;
+            }
+            regexes.push_back(re);
+        }
+        for (int t = 0; t < 50; ++t) {
+            std::string text;
+            int len = rand() % 12;
+            for (int i = 0; i < len; ++i) {
+                text += alphabet[rand() % 7];
+            }
+            bool expected = false;
+            std::vector<int> all_expected, all_found;
+            for (size_t i = 0; i < regexes.size(); ++i) {
+                if (regexec(&regexes[i], text.c_str(), 0, 0, 0) != 0) {
+                    continue;
+                }
+                expected = true;
+                all_expected.push_back(i);
+                std::string literal = PatternSet::requiredLiteral(set.pattern(i).c_str());
+                if (text.find(literal) == std::string::npos) {
+                    ++failures;
+                    std::cerr << "'" << text << "' matches /" << set.pattern(i) << "/ without '" << literal << "'\n";
+                }
+            }
+            set.matchAll(text.data(), text.length(), all_found);
+            std::sort(all_found.begin(), all_found.end());
+            if (all_found != all_expected) {
+                ++failures;
+                std::cerr << "'" << text << "' matchAll found " << all_found.size() << " of " << all_expected.size() << " matching patterns\n";
+            }
+            int credited = set.match(text.data(), text.length());
+            if (credited >= 0 && regexec(&regexes[credited], text.c_str(), 0, 0, 0) != 0) {
+                ++failures;
+                std::cerr << "'" << text << "' credited to /" << set.pattern(credited) << "/ which does not match\n";
+            }
+            if (set.matches(text) != expected) {
+                ++failures;
+                std::cerr << "mismatch on '" << text << "' expected " << expected << " for:";
+                for (size_t i = 0; i < set.size(); ++i) {
+                    std::cerr << " /" << set.pattern(i) << "/";
+                }
+                std::cerr << "\n";
+            }
+        }
+        for (size_t i = 0; i < regexes.size(); ++i) {
+            regfree(&regexes[i]);
+        }
+    }
+    std::cout << rounds << " rounds, " << failures << " mismatches\n";
+    return failures ? 1 : 0;
+}
+
+// per line cost of the regex loop and the combined matcher as the pattern count grows
+static void benchmark(int lines)
+{
+    std::vector<std::string> input;
+    char buf[200];
+    for (int i = 0; i < lines; ++i) {
+        if (i % 3) {
+            snprintf(buf, sizeof(buf), "%d\tconveyor%03d\trunning\t%d", i * 7, rand() % 400, rand() % 20);
+        }
+        else {
+            snprintf(buf, sizeof(buf), "%d\tconveyor%03d.speed\tvalue\t%d", i * 7, rand() % 400, rand() % 1000);
+        }
+        input.push_back(buf);
+    }
+    const int counts[] = { 1, 2, 5, 10, 20, 50, 100 };
+    std::cout << "patterns\tregex ns/line\tcombined ns/line\tprefiltered ns/line\trejected\tmatched\n";
+    for (size_t c = 0; c < sizeof(counts) / sizeof(*counts); ++c) {
+        PatternSet set;
+        LiteralScanner prefilter;
+        std::vector<regex_t> regexes;
+        for (int i = 0; i < counts[c]; ++i) {
+            snprintf(buf, sizeof(buf), (i % 2) ? "conveyor%03d\\.speed" : "\tconveyor%03d\t(running|stopped)", (i * 7) % 400);
+            regex_t re;
+            regcomp(&re, buf, REG_EXTENDED | REG_NOSUB);
+            regexes.push_back(re);
+            set.add(buf);
+            prefilter.add(PatternSet::requiredLiteral(buf));
+        }
+        size_t regex_matches = 0, set_matches = 0, rejected = 0;
+        bool selective = prefilter.selective();
+        double t0 = now_secs();
+        for (size_t i = 0; i < input.size(); ++i) {
+            for (size_t j = 0; j < regexes.size(); ++j) {
+                if (regexec(&regexes[j], input[i].c_str(), 0, 0, 0) == 0) {
+                    ++regex_matches;
+                    break;
+                }
+            }
+        }
+        double t1 = now_secs();
+        for (size_t i = 0; i < input.size(); ++i) {
+            if (set.matches(input[i])) {
+                ++set_matches;
+            }
+        }
+        double t2 = now_secs();
+        for (size_t i = 0; i < input.size(); ++i) {
+            if (selective && !prefilter.contains(input[i].data(), input[i].length())) {
+                ++rejected;
+            }
+            else {
+                set.matches(input[i]);
+            }
+        }
+        double t3 = now_secs();
+        std::cout << counts[c] << "\t" << (t1 - t0) * 1e9 / input.size()
+                << "\t" << (t2 - t1) * 1e9 / input.size()
+                << "\t" << (t3 - t2) * 1e9 / input.size()
+                << "\t" << (100.0 * rejected / input.size()) << "%"
+                << "\t" << set_matches << (set_matches == regex_matches ? "" : " (MISMATCH)") << "\n";
+        for (size_t j = 0; j < regexes.size(); ++j) {
+            regfree(&regexes[j]);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    srand(42);
+    if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+        return check(argc > 2 ? atoi(argv[2]) : 2000);
+    }
+    benchmark(argc > 1 ? atoi(argv[1]) : 100000);
+    return EXIT_SUCCESS;
+}
+#endif
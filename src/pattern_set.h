@@ -0,0 +1,136 @@
+#ifndef __pattern_set_h__
+#define __pattern_set_h__
+
+/*
+    PatternSet compiles a list of POSIX extended regular expressions into a
+    single automaton so that a line can be tested against all of them in one
+    left to right scan. The patterns are combined into one Thompson NFA that
+    is converted to a DFA lazily, one transition at a time, as input is seen.
+    The DFA cache is bounded and is discarded and rebuilt when it grows too
+    large.
+
+    Only the common subset of the ERE syntax is handled: literals, '.',
+    bracket expressions (including [:class:] names), anchors, grouping,
+    alternation and the *, +, ? and {m,n} repetitions. add() returns -1 for
+    a pattern that uses anything else (back references, GNU escapes such as
+    \w or \b, collating elements) and the caller should keep evaluating that
+    pattern with the regular_expressions interface.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class PatternSet {
+    public:
+        PatternSet();
+
+        // returns the index of the pattern in the set, or -1 if the pattern
+        // uses a construct that the combined matcher does not support
+        int add(const char *pattern);
+        size_t size() const { return patterns.size(); }
+        bool empty() const { return patterns.empty(); }
+        const std::string &pattern(size_t idx) const { return patterns[idx]; }
+
+        // true if any pattern in the set matches somewhere in the text
+        bool matches(const char *text, size_t len) { return match(text, len) >= 0; }
+        bool matches(const std::string &text) { return matches(text.data(), text.length()); }
+
+        // the index of the pattern that matches earliest in the text (the
+        // lowest index if several complete at the same position), or -1
+        int match(const char *text, size_t len);
+
+        // every pattern that matches somewhere in the text, in no particular
+        // order; returns the number found
+        size_t matchAll(const char *text, size_t len, std::vector<int> &found);
+
+        size_t cachedStates() const { return dstates.size(); }
+
+        // the longest string that appears in every text the pattern matches,
+        // empty if there is none. Works for any pattern regcomp accepts.
+        static std::string requiredLiteral(const char *pattern);
+
+    private:
+        struct Node {
+            enum Type { empty, chars, cat, alt, repeat, bol, eol, opaque };
+            Type type;
+            int set;
+            int left;
+            int right;
+            int min;
+            int max;    // -1 for unbounded repetition
+        };
+
+        struct NfaState {
+            enum Type { set, split, bol, eol, epsilon, match };
+            Type type;
+            int out;
+            int out1;
+            int arg;    // byte set index or pattern index
+        };
+
+        struct CharSet {
+            uint64_t bits[4];
+            bool test(unsigned char c) const { return (bits[c >> 6] >> (c & 63)) & 1; }
+            void set(unsigned char c) { bits[c >> 6] |= (uint64_t)1 << (c & 63); }
+        };
+
+        struct DState {
+            std::vector<int> nfa;   // set and eol states, sorted
+            bool bol;
+            std::vector<int> matched;           // patterns matched on entering the state
+            std::vector<int> matched_at_end;    // patterns matched if the text ends here
+        };
+
+        enum { accept_now = 1, accept_at_end = 2 };
+
+        struct Literals {
+            bool exact;             // the node only ever matches 'all'
+            std::string all;
+            std::string prefix;     // every match starts with this
+            std::string suffix;     // every match ends with this
+            std::string required;   // every match contains this
+        };
+
+        class Parser;
+
+        static void literals(const std::vector<Node> &nodes, const std::vector<CharSet> &sets, int node, Literals &result);
+
+        int compileNode(const std::vector<Node> &nodes, int node, int next);
+        int newState(NfaState::Type type, int out, int out1, int arg);
+        void prepare();
+        void closure(std::vector<int> &seeds, bool at_bol, bool at_eol, std::vector<int> &kept, std::vector<int> &matched);
+        int addState(std::vector<int> &nfa, bool at_bol, const std::vector<int> &matched);
+        void collect(const std::vector<int> &matched, std::vector<int> &found);
+        int computeTransition(int state, int byte_class);
+        void resetCache();
+
+        std::vector<std::string> patterns;
+        std::vector<CharSet> charsets;
+        std::vector<NfaState> nfa;
+        std::vector<int> starts;        // start state of each pattern
+        int start;                      // split chain over all pattern starts
+
+        bool prepared;
+        uint8_t byte_class[256];
+        int class_count;
+        unsigned char class_rep[256];
+
+        std::vector<DState> dstates;
+        std::vector<int> transitions;   // dstates.size() * class_count, -1 = not yet computed
+        std::vector<uint8_t> flags;
+        std::vector<int> accepted;      // the pattern credited when a state's flags accept
+        std::map<std::vector<int>, int> dstate_index;
+        int initial;
+
+        std::vector<unsigned int> found_mark;  // generation at which a pattern was found by matchAll
+        unsigned int found_generation;
+
+        std::vector<unsigned int> visited;
+        unsigned int generation;
+        std::vector<int> stack;
+};
+
+#endif
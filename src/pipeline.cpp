@@ -0,0 +1,489 @@
+#include "pipeline.h"
+#include <iomanip>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "decimator.h"
+#include "shm_ring.h"
+#include "terminal_renderer.h"
+
+void Event::setState(uint64_t when, const std::string &machine_name, const std::string &state_name)
+{
+    kind = state_change;
+    time = when;
+    machine = machine_name;
+    property.clear();
+    name = machine_name;
+    text = state_name;
+    value = 0;
+    numeric = true;
+    device_id = -1;
+    state_id = -1;
+}
+
+void Event::setProperty(uint64_t when, const std::string &machine_name, const std::string &property_name,
+        const std::string &formatted_value)
+{
+    kind = property_change;
+    time = when;
+    machine = machine_name;
+    property = property_name;
+    name = machine_name;
+    if (!property_name.empty()) {
+        name += '.';
+        name += property_name;
+    }
+    text = formatted_value;
+    char *end;
+    value = strtod(text.c_str(), &end);
+    numeric = !text.empty() && *end == 0;
+    if (!numeric) {
+        value = 0;
+    }
+    device_id = -1;
+    state_id = -1;
+}
+
+void Event::setValue(uint64_t when, const char *name_text, size_t name_len, const char *value_text, size_t text_len,
+        double new_value, int device)
+{
+    kind = state_change;
+    time = when;
+    machine.clear();
+    property.clear();
+    name.assign(name_text, name_len);
+    text.assign(value_text, text_len);
+    value = new_value;
+    numeric = true;
+    device_id = device;
+    state_id = -1;
+}
+
+Interner::Interner(void (*new_state)()) : next_device(0), next_state(0), new_state(new_state)
+{
+}
+
+int Interner::device(const std::string &name)
+{
+    return lookupName(device_map, name, next_device);
+}
+
+int Interner::state(const std::string &name)
+{
+    int known = next_state;
+    int id = lookupName(state_map, name, next_state);
+    if (next_state != known && new_state) {
+        new_state();
+    }
+    return id;
+}
+
+void Interner::process(Event &event)
+{
+    if (event.kind == Event::state_change) {
+        event.state_id = state(event.text);
+        event.value = event.state_id;
+    }
+    event.device_id = device(event.name);
+    pass(event);
+}
+
+PatternFilter::PatternFilter()
+{
+}
+
+int PatternFilter::add(const char *pattern)
+{
+    return patterns.add(pattern);
+}
+
+void PatternFilter::process(Event &event)
+{
+    key = event.name;
+    key += '\t';
+    key += event.text;
+    if (patterns.matches(key)) {
+        pass(event);
+    }
+}
+
+static const std::string value_label("value");
+
+void TextFormatter::process(Event &event)
+{
+    if (event.kind == Event::state_change) {
+        formatState(out, format, event.time, event.machine, event.text, event.state_id);
+    }
+    else {
+        // a value of the machine itself is labelled as sampler's VALUE lines are
+        const std::string &label = event.property.empty() ? value_label : event.property;
+        formatProperty(out, format, event.time, event.machine, label, event.name, event.text);
+    }
+    if (lines) {
+        out << "\n";
+    }
+    pass(event);
+}
+
+void TextFormatter::idle()
+{
+    out.flush();
+    Stage::idle();
+}
+
+void fill_ring_event(const Event &event, RingEvent &record)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    record.time = event.time;
+    record.epoch_time = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+    record.kind = event.kind == Event::state_change ? ring_state : ring_property;
+    record.device_id = event.device_id;
+    record.state_id = event.state_id;
+    record.value = event.value;
+    record.numeric = event.numeric;
+    record.setName(event.name.data(), event.name.length());
+    record.setText(event.text.data(), event.text.length());
+}
+
+void RingWriter::process(Event &event)
+{
+    RingEvent record;
+    fill_ring_event(event, record);
+    ring.publish(record);
+    pass(event);
+}
+
+ScopeRows::ScopeRows(std::ostream &out, Mode mode) : out(out), mode(mode), vcd(out),
+    state_names(false), state_ids(true), square_wave(false), last_t(0)
+{
+}
+
+void ScopeRows::setFormat(bool names, bool ids)
+{
+    state_names = names;
+    state_ids = ids || !names;
+}
+
+void ScopeRows::start()
+{
+    columns.setFormat(state_names, state_ids);
+    written_state.assign(columns.size(), "");
+    written_id.assign(columns.size(), 0);
+    run_start.assign(columns.size(), 0);
+    if (mode == value_change_dump) {
+        vcd.header(columns);
+        return;
+    }
+    if (mode == column_runs) {
+        out << "\"Column\"\t\"Start\"\t\"End\"\t\"Value\"\n" << std::flush;
+        return;
+    }
+    out << "\"Time\"";
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (state_names) {
+            out << "\t\"" << columns.name(i) << ".state\"";
+        }
+        if (state_ids) {
+            out << "\t\"" << columns.name(i) << "\"";
+        }
+    }
+    out << "\n" << std::flush;
+}
+
+void ScopeRows::startAt(long time)
+{
+    last_t = time;
+    if (mode == column_runs) {
+        for (size_t col = 0; col < columns.size(); ++col) {
+            setWritten(col);
+            run_start[col] = time;
+        }
+        columns.clearDirty();
+    }
+}
+
+// a dirty column may have changed and changed back since it was written,
+// or changed in a way that is not written
+bool ScopeRows::changedSinceWritten(int col) const
+{
+    return (state_ids && columns.stateId(col) != written_id[col])
+        || (state_names && columns.stateName(col) != written_state[col]);
+}
+
+void ScopeRows::setWritten(int col)
+{
+    written_state[col] = columns.stateName(col);
+    written_id[col] = columns.stateId(col);
+}
+
+// -C: time followed by label=value for each column that changed
+void ScopeRows::emitChanges()
+{
+    bool any = false;
+    for (int col = columns.nextDirty(-1); col >= 0; col = columns.nextDirty(col)) {
+        if (!changedSinceWritten(col)) {
+            continue;
+        }
+        if (!any) {
+            out << last_t;
+            any = true;
+        }
+        setWritten(col);
+        if (state_names) {
+            out << "\t" << columns.name(col) << ".state=" << columns.stateName(col);
+        }
+        if (state_ids) {
+            out << "\t" << columns.name(col) << "=" << columns.stateId(col);
+        }
+    }
+    if (any) {
+        out << "\n";
+    }
+    columns.clearDirty();
+}
+
+// -L: label start end value for each run of a column, end not included
+void ScopeRows::writeRun(size_t col, long end)
+{
+    if (state_names) {
+        out << columns.name(col) << ".state\t" << run_start[col] << "\t" << end << "\t" << written_state[col] << "\n";
+    }
+    if (state_ids) {
+        out << columns.name(col) << "\t" << run_start[col] << "\t" << end << "\t" << written_id[col] << "\n";
+    }
+}
+
+void ScopeRows::emitRuns()
+{
+    for (int col = columns.nextDirty(-1); col >= 0; col = columns.nextDirty(col)) {
+        if (!changedSinceWritten(col)) {
+            continue;
+        }
+        writeRun(col, last_t);
+        run_start[col] = last_t;
+        setWritten(col);
+    }
+    columns.clearDirty();
+}
+
+void ScopeRows::emit()
+{
+    if (mode == changed_columns) {
+        emitChanges();
+        return;
+    }
+    if (mode == column_runs) {
+        emitRuns();
+        return;
+    }
+    if (mode == value_change_dump) {
+        vcd.changes(last_t, columns);
+        columns.clearDirty();
+        return;
+    }
+    const std::string &row = columns.row();
+    out << last_t;
+    out.write(row.data(), row.length());
+    out << "\n";
+    columns.clearDirty();
+}
+
+void ScopeRows::process(Event &event)
+{
+    long t = (int64_t)event.time / 1000;
+    if (t != last_t) {
+        emit();
+        if (square_wave && t > last_t + 1) {
+            last_t = t - 1;
+            emit();
+        }
+        last_t = t;
+    }
+    int col = columns.findDevice(event.device_id, event.name.data(), event.name.length());
+    if (col >= 0) {
+        columns.update(col, event.text.data(), event.text.length(), event.value);
+    }
+    pass(event);
+}
+
+void ScopeRows::idle()
+{
+    out.flush();
+    Stage::idle();
+}
+
+void ScopeRows::finish()
+{
+    emit();
+    if (mode == column_runs) {
+        for (size_t col = 0; col < columns.size(); ++col) {
+            writeRun(col, last_t + 1);
+        }
+    }
+    if (mode == value_change_dump) {
+        vcd.finish(last_t + 1);
+    }
+    else {
+        out << "End of Scope\n";
+    }
+    out.flush();
+    Stage::finish();
+}
+
+// the line per change view: each series is plotted as a symbol in a row of
+// text, written when a symbol moves to a column it was not in before
+struct ScopeGraph::LineGraph {
+    enum { screen_width = 140 };
+
+    std::ostream &out;
+    long min_value;
+    long max_value;
+    char row[screen_width + 1];
+    char last_row[screen_width + 1];
+    std::map<std::string, long> series;
+
+    LineGraph(std::ostream &out, long min_y, long max_y) : out(out), min_value(min_y), max_value(max_y) {
+        memset(row, ' ', screen_width);
+        row[screen_width] = 0;
+        memset(last_row, ' ', screen_width);
+        last_row[screen_width] = 0;
+    }
+    void emit(long time);
+    bool plot(long v, char symbol);
+    bool rescale(long val);
+};
+
+bool ScopeGraph::LineGraph::rescale(long val)
+{
+    bool rescaled = false;
+    if (val > max_value) {
+        max_value = ((val > 0) ? 1.1f : 0.9f) * val;
+        rescaled = true;
+    }
+    if (val < min_value) {
+        min_value = ((val > 0) ? 0.9f : 1.1f) * val;
+        rescaled = true;
+    }
+    if (rescaled) {
+        memset(last_row, ' ', screen_width);    // every column has moved
+    }
+    return rescaled;
+}
+
+bool ScopeGraph::LineGraph::plot(long v, char symbol)
+{
+    bool changed = false;
+    int col = (int)(0.95f * screen_width * (v - min_value) / (max_value - min_value));
+    if (col >= 0 && col < screen_width) {
+        if (last_row[col] == ' ') {
+            changed = true;
+        }
+        row[col] = symbol;
+    }
+    else {
+        out << " col: " << col << "\n";
+    }
+    return changed;
+}
+
+void ScopeGraph::LineGraph::emit(long time)
+{
+    const char *symbols = "*@#%ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    int max_sym = strlen(symbols) - 1;
+    if (max_value <= min_value) {
+        out << "\n";
+        return;
+    }
+
+    std::map<std::string, long>::const_iterator iter = series.begin();
+    int symbol_idx = 0;
+    bool changed = false;
+    while (iter != series.end()) {
+        const std::pair<std::string, long> &pt = *iter++;
+        changed |= plot(pt.second, symbols[symbol_idx]);
+        if (symbol_idx++ > max_sym) {
+            symbol_idx = max_sym;
+        }
+    }
+    if (changed) {
+        out << std::setw(8) << time << " " << row << "\n";
+        memcpy(last_row, row, screen_width);
+        memset(row, ' ', screen_width);
+        if (min_value <= 0 && max_value >= 0) {
+            plot(0, '|');
+        }
+        for (long x = -30000; x <= 30000; x += 10000) {
+            if (min_value <= x && max_value >= x) {
+                plot(x, (x == 0) ? '|' : '!');
+            }
+        }
+    }
+}
+
+ScopeGraph::ScopeGraph(TerminalRenderer &renderer) : renderer(&renderer), decimator(0), lines(0), out(0),
+    min_y(0), max_y(0), since_tick(0)
+{
+}
+
+ScopeGraph::ScopeGraph(Decimator &decimator, std::ostream &out, long min_y, long max_y) : renderer(0),
+    decimator(&decimator), lines(0), out(&out), min_y(min_y), max_y(max_y), since_tick(0)
+{
+}
+
+ScopeGraph::ScopeGraph(std::ostream &out, long min_y, long max_y) : renderer(0), decimator(0),
+    lines(new LineGraph(out, min_y, max_y)), out(&out), min_y(min_y), max_y(max_y), since_tick(0)
+{
+}
+
+ScopeGraph::~ScopeGraph()
+{
+    delete lines;
+}
+
+void ScopeGraph::process(Event &event)
+{
+    if (event.numeric) {
+        long t = (int64_t)event.time / 1000;
+        if (renderer) {
+            renderer->update(t, event.name.data(), event.name.length(), event.value);
+        }
+        else if (decimator) {
+            decimator->add(t, event.name.data(), event.name.length(), event.value);
+        }
+        else {
+            lines->series[event.name] = event.value;
+            if (lines->rescale(event.value)) {
+                *out << "...\n";
+            }
+            lines->emit(t);
+        }
+    }
+    if (renderer && ++since_tick >= 64) {
+        since_tick = 0;
+        renderer->tick();
+    }
+    pass(event);
+}
+
+void ScopeGraph::idle()
+{
+    if (renderer) {
+        renderer->tick();
+    }
+    else {
+        out->flush();
+    }
+    Stage::idle();
+}
+
+void ScopeGraph::finish()
+{
+    if (decimator) {
+        decimator->write(*out, LineGraph::screen_width, min_y, max_y);
+    }
+    if (out) {
+        *out << "End of Scope\n" << std::flush;
+    }
+    Stage::finish();
+}
@@ -0,0 +1,235 @@
+#ifndef __pipeline_h__
+#define __pipeline_h__
+
+/*
+    The stages of sampler, filter and scope as a library. Instead of
+    formatting each change as a line of text for the next program to parse
+    again, a stage handles an Event and passes it to the next stage in the
+    chain, or drops it. The Event is reused from one message to the next,
+    so once its strings have grown no stage allocates.
+
+    Stages:
+        Interner        numbers devices and states as sampler does
+        PatternFilter   keeps events that match any of a set of patterns
+        TextFormatter   writes sampler's std, kv or kvq output
+        RingWriter      publishes to a shared memory ring for scope
+        ScopeRows       scope's text output, one column per device
+        ScopeGraph      scope's graphs of values
+
+    message_decoder.h turns clockwork messages into Events.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "column_store.h"
+#include "pattern_set.h"
+#include "sample_output.h"
+#include "vcd_writer.h"
+
+class Decimator;
+struct RingEvent;
+class ShmRing;
+class TerminalRenderer;
+
+struct Event {
+    enum Kind { state_change = 1, property_change = 2 };  // as RingEventKind
+
+    Kind kind;
+    uint64_t time;          // microseconds since the first message
+    std::string machine;
+    std::string property;   // empty for a state change
+    std::string name;       // machine, or machine.property
+    std::string text;       // state name or formatted property value
+    double value;           // state number, or the value of a numeric property
+    bool numeric;
+    int device_id;          // -1 until interned
+    int state_id;           // -1 until interned, and for properties
+
+    Event() : kind(state_change), time(0), value(0), numeric(false), device_id(-1), state_id(-1) {}
+
+    void setState(uint64_t time, const std::string &machine, const std::string &state);
+    // an empty property is a value of the machine itself, named after it
+    void setProperty(uint64_t time, const std::string &machine, const std::string &property, const std::string &value);
+    // a change read by scope, which only knows the column name and the text
+    // and value of the change; machine and property are left empty
+    void setValue(uint64_t time, const char *name, size_t name_len, const char *text, size_t text_len,
+            double value, int device_id = -1);
+};
+
+class Stage {
+    public:
+        Stage() : next(0) {}
+        virtual ~Stage() {}
+
+        // the stage that events are passed to; returns it so that chains
+        // can be written a.then(b).then(c)
+        Stage &then(Stage &stage) { next = &stage; return stage; }
+
+        virtual void process(Event &event) = 0;
+        // called when there are no events, for stages that work to a clock
+        virtual void idle() { if (next) next->idle(); }
+        // the end of the input
+        virtual void finish() { if (next) next->finish(); }
+
+    protected:
+        void pass(Event &event) { if (next) next->process(event); }
+
+    private:
+        Stage *next;
+};
+
+class Interner : public Stage {
+    public:
+        // new_state is called after a state is seen for the first time
+        explicit Interner(void (*new_state)() = 0);
+
+        void process(Event &event);
+
+        int device(const std::string &name);
+        int state(const std::string &name);
+        const std::map<std::string, int> &devices() const { return device_map; }
+        const std::map<std::string, int> &states() const { return state_map; }
+
+    private:
+        std::map<std::string, int> device_map;
+        std::map<std::string, int> state_map;
+        int next_device;
+        int next_state;
+        void (*new_state)();
+};
+
+// patterns are matched against the name, a tab and the text of the event
+class PatternFilter : public Stage {
+    public:
+        PatternFilter();
+
+        // the index of the pattern, -1 if it is not supported (see pattern_set.h)
+        int add(const char *pattern);
+        size_t size() const { return patterns.size(); }
+        bool empty() const { return patterns.empty(); }
+        // the first pattern matching a line of text, -1 if none do, for
+        // callers that filter lines rather than Events
+        int match(const char *text, size_t len) { return patterns.match(text, len); }
+
+        void process(Event &event);
+
+    private:
+        PatternSet patterns;
+        std::string key;
+};
+
+class TextFormatter : public Stage {
+    public:
+        // without lines the caller ends each event's text itself
+        TextFormatter(std::ostream &out, const SampleFormat &format, bool lines = true)
+            : out(out), format(format), lines(lines) {}
+
+        void process(Event &event);
+        // flushes the output while waiting for events
+        void idle();
+
+    private:
+        std::ostream &out;
+        SampleFormat format;
+        bool lines;
+};
+
+// the ring's copy of an event, stamped with the time now
+void fill_ring_event(const Event &event, RingEvent &record);
+
+class RingWriter : public Stage {
+    public:
+        explicit RingWriter(ShmRing &ring) : ring(ring) {}
+
+        void process(Event &event);
+
+    private:
+        ShmRing &ring;
+};
+
+// scope's text output for the columns added, written when the millisecond
+// changes: by default a row of every column, or with the other modes only
+// the columns that changed (-C), the runs of each column (-L) or a value
+// change dump (--vcd)
+class ScopeRows : public Stage {
+    public:
+        enum Mode { dense_rows, changed_columns, column_runs, value_change_dump };
+
+        explicit ScopeRows(std::ostream &out, Mode mode = dense_rows);
+
+        void setMode(Mode new_mode) { mode = new_mode; }
+        // what is written for each column, as scope's -S and -I
+        void setFormat(bool state_names, bool state_ids);
+        // -R: repeat the previous row 1ms before a change
+        void setSquareWave(bool on) { square_wave = on; }
+        void addColumn(const std::string &name, int id) { columns.add(name, id); }
+        // for readers that restore the columns' state directly
+        ColumnStore &columnStore() { return columns; }
+
+        // call after adding the columns; writes the labels
+        void start();
+        // the output starts at time (ms) with the current state of the
+        // columns, as for scope --from
+        void startAt(long time);
+        void process(Event &event);
+        void idle();
+        void finish();
+
+    private:
+        bool changedSinceWritten(int col) const;
+        void setWritten(int col);
+        void emit();
+        void emitChanges();
+        void emitRuns();
+        void writeRun(size_t col, long end);
+
+        std::ostream &out;
+        Mode mode;
+        ColumnStore columns;
+        VcdWriter vcd;
+        bool state_names;
+        bool state_ids;
+        bool square_wave;
+        long last_t;
+        // -C and -L: the state last written for each column, and for -L
+        // the time from which the column has had that state
+        std::vector<std::string> written_state;
+        std::vector<int> written_id;
+        std::vector<long> run_start;
+};
+
+// scope's graphs of values: the live terminal view, the whole input in a
+// fixed number of rows (-D), or a line per change
+class ScopeGraph : public Stage {
+    public:
+        explicit ScopeGraph(TerminalRenderer &renderer);
+        // the decimator's rows are written at the end of the input
+        ScopeGraph(Decimator &decimator, std::ostream &out, long min_y, long max_y);
+        // a line per change, scaled to min_y..max_y until a value falls outside
+        ScopeGraph(std::ostream &out, long min_y, long max_y);
+        ~ScopeGraph();
+
+        void process(Event &event);
+        void idle();
+        void finish();
+
+    private:
+        struct LineGraph;
+
+        TerminalRenderer *renderer;
+        Decimator *decimator;
+        LineGraph *lines;
+        std::ostream *out;
+        long min_y;
+        long max_y;
+        unsigned int since_tick;
+
+        ScopeGraph(const ScopeGraph &);
+        ScopeGraph &operator=(const ScopeGraph &);
+};
+
+#endif
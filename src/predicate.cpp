@@ -0,0 +1,573 @@
+#include "predicate.h"
+#include "convert_date.h"
+#include "hash_bytes.h"
+#include "parse_number.h"
+#include "pattern_set.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool test_order(int cmp, int op)
+{
+    switch (op) {
+        case 0: return cmp == 0;    // op_eq
+        case 1: return cmp != 0;
+        case 2: return cmp < 0;
+        case 3: return cmp <= 0;
+        case 4: return cmp > 0;
+        case 5: return cmp >= 0;
+    }
+    return false;
+}
+
+void Predicate::StringSet::add(const std::string &s)
+{
+    strings.push_back(s);
+    hashes.push_back(hash_bytes(s.data(), s.length()));
+    rehash();
+}
+
+void Predicate::StringSet::rehash()
+{
+    size_t size = 16;
+    while (size < strings.size() * 2) {
+        size *= 2;
+    }
+    table.assign(size, -1);
+    for (size_t i = 0; i < strings.size(); ++i) {
+        size_t slot = hashes[i] & (size - 1);
+        while (table[slot] >= 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = i;
+    }
+}
+
+bool Predicate::StringSet::contains(const char *s, size_t len) const
+{
+    uint64_t h = hash_bytes(s, len);
+    size_t mask = table.size() - 1;
+    for (size_t slot = h & mask; table[slot] >= 0; slot = (slot + 1) & mask) {
+        int idx = table[slot];
+        if (hashes[idx] == h && strings[idx].length() == len && memcmp(strings[idx].data(), s, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+class Predicate::Parser {
+    public:
+        Parser(Predicate &owner, const std::string &source) : predicate(owner), src(source), pos(0) {}
+
+        int parse()
+        {
+            int node = parseOr();
+            skipSpace();
+            if (node >= 0 && pos < src.length()) {
+                return fail("unexpected '" + src.substr(pos) + "'");
+            }
+            return node;
+        }
+
+        std::string error;
+
+    private:
+        Predicate &predicate;
+        const std::string &src;
+        size_t pos;
+
+        int fail(const std::string &message)
+        {
+            if (error.empty()) {
+                error = message;
+            }
+            return -1;
+        }
+
+        void skipSpace()
+        {
+            while (pos < src.length() && isspace((unsigned char)src[pos])) {
+                ++pos;
+            }
+        }
+
+        bool accept(const char *token)
+        {
+            skipSpace();
+            size_t n = strlen(token);
+            if (src.compare(pos, n, token) == 0) {
+                pos += n;
+                return true;
+            }
+            return false;
+        }
+
+        int newNode(Node::Type type)
+        {
+            Node node;
+            node.type = type;
+            node.field = f_name;
+            node.op = op_eq;
+            node.is_number = false;
+            node.number = 0;
+            node.is_time = false;
+            node.time = 0;
+            node.pattern = 0;
+            node.fallback = 0;
+            node.negated = false;
+            node.set = 0;
+            predicate.nodes.push_back(node);
+            return predicate.nodes.size() - 1;
+        }
+
+        int combine(Node::Type type, int left, int right)
+        {
+            if (left < 0 || right < 0) {
+                return -1;
+            }
+            if (predicate.nodes[left].type == type) {
+                predicate.nodes[left].children.push_back(right);
+                return left;
+            }
+            int node = newNode(type);
+            predicate.nodes[node].children.push_back(left);
+            predicate.nodes[node].children.push_back(right);
+            return node;
+        }
+
+        int parseOr()
+        {
+            int node = parseAnd();
+            while (node >= 0 && accept("||")) {
+                node = combine(Node::any, node, parseAnd());
+            }
+            return node;
+        }
+
+        int parseAnd()
+        {
+            int node = parseUnary();
+            while (node >= 0 && accept("&&")) {
+                node = combine(Node::all, node, parseUnary());
+            }
+            return node;
+        }
+
+        int parseUnary()
+        {
+            if (accept("!")) {
+                int operand = parseUnary();
+                if (operand < 0) {
+                    return -1;
+                }
+                int node = newNode(Node::negate);
+                predicate.nodes[node].children.push_back(operand);
+                return node;
+            }
+            if (accept("(")) {
+                int node = parseOr();
+                if (node >= 0 && !accept(")")) {
+                    return fail("missing ')'");
+                }
+                return node;
+            }
+            return parseComparison();
+        }
+
+        bool parseField(Field &field)
+        {
+            static const char *names[] = { "time", "name", "machine", "property", "state", "value", "kind" };
+            skipSpace();
+            size_t start = pos;
+            while (pos < src.length() && (isalnum((unsigned char)src[pos]) || src[pos] == '_')) {
+                ++pos;
+            }
+            std::string name = src.substr(start, pos - start);
+            for (int i = 0; i < field_count; ++i) {
+                if (name == names[i]) {
+                    field = (Field)i;
+                    return true;
+                }
+            }
+            if (name.empty()) {
+                fail(pos < src.length() ? "expected a field name at '" + src.substr(pos) + "'" : "expected a field name");
+            }
+            else {
+                fail("unknown field '" + name + "'");
+            }
+            return false;
+        }
+
+        bool parseOperand(std::string &operand)
+        {
+            skipSpace();
+            if (pos == src.length()) {
+                fail("missing value");
+                return false;
+            }
+            char quote = src[pos];
+            if (quote == '"' || quote == '\'') {
+                for (++pos; pos < src.length() && src[pos] != quote; ++pos) {
+                    if (src[pos] == '\\' && pos + 1 < src.length() && (src[pos + 1] == quote || src[pos + 1] == '\\')) {
+                        ++pos;
+                    }
+                    operand += src[pos];
+                }
+                if (pos == src.length()) {
+                    fail("unterminated string");
+                    return false;
+                }
+                ++pos;
+                return true;
+            }
+            // a bare word runs to white space, an unbalanced ')', a ',' or && or ||
+            int depth = 0;
+            while (pos < src.length()) {
+                char c = src[pos];
+                if (isspace((unsigned char)c)) {
+                    break;
+                }
+                if (depth == 0 && (c == ')' || c == ',')) {
+                    break;
+                }
+                if (src.compare(pos, 2, "&&") == 0 || src.compare(pos, 2, "||") == 0) {
+                    break;
+                }
+                if (c == '(') {
+                    ++depth;
+                }
+                else if (c == ')') {
+                    --depth;
+                }
+                operand += c;
+                ++pos;
+            }
+            if (operand.empty()) {
+                fail("missing value");
+                return false;
+            }
+            return true;
+        }
+
+        int comparison(Field field, Op op, const std::string &operand)
+        {
+            int idx = newNode(Node::compare);
+            Node &node = predicate.nodes[idx];
+            node.field = field;
+            node.op = op;
+            node.operand = operand;
+            if (field == f_time && operand.length() >= 8 && parse_8601_usec(operand.data(), operand.length(), node.time)) {
+                node.is_time = true;
+            }
+            else {
+                node.is_number = parse_number(operand.data(), operand.length(), node.number);
+            }
+            return idx;
+        }
+
+        int regex(Field field, bool negated, const std::string &operand)
+        {
+            rexp_info *info = create_pattern(operand.c_str());
+            if (info->compilation_result != 0) {
+                release_pattern(info);
+                return fail("invalid regular expression '" + operand + "'");
+            }
+            int idx = newNode(Node::regex);
+            Node &node = predicate.nodes[idx];
+            node.field = field;
+            node.negated = negated;
+            node.operand = operand;
+            node.pattern = new PatternSet;
+            if (node.pattern->add(operand.c_str()) >= 0) {
+                release_pattern(info);
+            }
+            else {
+                delete node.pattern;
+                node.pattern = 0;
+                node.fallback = info;
+            }
+            return idx;
+        }
+
+        int parseComparison()
+        {
+            Field field;
+            if (!parseField(field)) {
+                return -1;
+            }
+            skipSpace();
+            size_t save = pos;
+            if (accept("in") && pos < src.length() && (src[pos] == '(' || isspace((unsigned char)src[pos]))) {
+                if (!accept("(")) {
+                    return fail("expected '(' after in");
+                }
+                int node = -1;
+                do {
+                    std::string operand;
+                    if (!parseOperand(operand)) {
+                        return -1;
+                    }
+                    int item = comparison(field, op_eq, operand);
+                    node = node < 0 ? item : combine(Node::any, node, item);
+                } while (accept(","));
+                if (!accept(")")) {
+                    return fail("missing ')' after in list");
+                }
+                return node;
+            }
+            pos = save;
+
+            static const struct { const char *token; int op; } ops[] = {
+                { "=~", -1 }, { "!~", -2 }, { "==", op_eq }, { "!=", op_ne },
+                { "<=", op_le }, { ">=", op_ge }, { "=", op_eq }, { "<", op_lt }, { ">", op_gt }
+            };
+            for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+                if (accept(ops[i].token)) {
+                    std::string operand;
+                    if (!parseOperand(operand)) {
+                        return -1;
+                    }
+                    if (ops[i].op < 0) {
+                        return regex(field, ops[i].op == -2, operand);
+                    }
+                    return comparison(field, (Op)ops[i].op, operand);
+                }
+            }
+            return fail(pos < src.length() ? "expected a comparison at '" + src.substr(pos) + "'" : "expected a comparison");
+        }
+};
+
+Predicate::Predicate() : root(-1)
+{
+}
+
+Predicate::~Predicate()
+{
+    clear();
+}
+
+void Predicate::clear()
+{
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        delete nodes[i].pattern;
+        delete nodes[i].set;
+        if (nodes[i].fallback) {
+            release_pattern(nodes[i].fallback);
+        }
+    }
+    nodes.clear();
+    root = -1;
+}
+
+bool Predicate::compile(const std::string &expression, std::string &error)
+{
+    clear();
+    text = expression;
+    Parser parser(*this, text);
+    int node = parser.parse();
+    if (node < 0) {
+        error = parser.error;
+        clear();
+        return false;
+    }
+    root = optimise(node);
+    return true;
+}
+
+Predicate *Predicate::clone() const
+{
+    Predicate *copy = new Predicate;
+    std::string error;
+    copy->compile(text, error);
+    return copy;
+}
+
+// merge alternatives that test the same field for equality with a string
+// into a single hash lookup
+int Predicate::optimise(int idx)
+{
+    for (size_t i = 0; i < nodes[idx].children.size(); ++i) {
+        int child = optimise(nodes[idx].children[i]);
+        nodes[idx].children[i] = child;
+    }
+    if (nodes[idx].type != Node::any) {
+        return idx;
+    }
+    for (int field = 0; field < field_count; ++field) {
+        std::vector<int> equalities;
+        std::vector<int> others;
+        const std::vector<int> &children = nodes[idx].children;
+        for (size_t i = 0; i < children.size(); ++i) {
+            const Node &child = nodes[children[i]];
+            if (child.type == Node::compare && child.field == field && child.op == op_eq
+                    && !child.is_number && !child.is_time) {
+                equalities.push_back(children[i]);
+            }
+            else {
+                others.push_back(children[i]);
+            }
+        }
+        if (equalities.size() < 2) {
+            continue;
+        }
+        Node &merged = nodes[equalities[0]];
+        merged.type = Node::member;
+        merged.set = new StringSet;
+        for (size_t i = 0; i < equalities.size(); ++i) {
+            merged.set->add(nodes[equalities[i]].operand);
+        }
+        others.push_back(equalities[0]);
+        nodes[idx].children = others;
+    }
+    if (nodes[idx].children.size() == 1) {
+        return nodes[idx].children[0];
+    }
+    return idx;
+}
+
+bool Predicate::numberOf(Line &line, Field field, double &value)
+{
+    if (line.number_state[field] == 0) {
+        line.number_state[field] = parse_number(line.start[field], line.len[field], line.number[field]) ? 1 : 2;
+    }
+    value = line.number[field];
+    return line.number_state[field] == 1;
+}
+
+bool Predicate::timeOf(Line &line, int64_t &value)
+{
+    if (line.time_state == 0) {
+        line.time_state = parse_8601_usec(line.start[f_time], line.len[f_time], line.time) ? 1 : 2;
+    }
+    value = line.time;
+    return line.time_state == 1;
+}
+
+bool Predicate::evaluate(int idx, Line &line)
+{
+    Node &node = nodes[idx];
+    switch (node.type) {
+        case Node::all:
+            for (size_t i = 0; i < node.children.size(); ++i) {
+                if (!evaluate(node.children[i], line)) {
+                    return false;
+                }
+            }
+            return true;
+        case Node::any:
+            for (size_t i = 0; i < node.children.size(); ++i) {
+                if (evaluate(node.children[i], line)) {
+                    return true;
+                }
+            }
+            return false;
+        case Node::negate:
+            return !evaluate(node.children[0], line);
+        case Node::member:
+            return node.set->contains(line.start[node.field], line.len[node.field]);
+        case Node::regex: {
+            const char *text = line.start[node.field];
+            size_t len = line.len[node.field];
+            bool found;
+            if (node.pattern) {
+                found = node.pattern->matches(text, len);
+            }
+            else {
+                scratch.assign(text, len);
+                found = execute_pattern(node.fallback, scratch.c_str()) == 0;
+            }
+            return found != node.negated;
+        }
+        case Node::compare:
+            if (node.is_time) {
+                int64_t t;
+                if (!timeOf(line, t)) {
+                    return node.op == op_ne;
+                }
+                return test_order(t < node.time ? -1 : t > node.time ? 1 : 0, node.op);
+            }
+            if (node.is_number) {
+                double v;
+                if (numberOf(line, node.field, v)) {
+                    return test_order(v < node.number ? -1 : v > node.number ? 1 : 0, node.op);
+                }
+                if (node.op != op_eq && node.op != op_ne) {
+                    return false;
+                }
+            }
+            {
+                size_t len = line.len[node.field];
+                size_t n = len < node.operand.length() ? len : node.operand.length();
+                int cmp = memcmp(line.start[node.field], node.operand.data(), n);
+                if (cmp == 0) {
+                    cmp = len < node.operand.length() ? -1 : len > node.operand.length() ? 1 : 0;
+                }
+                return test_order(cmp, node.op);
+            }
+    }
+    return false;
+}
+
+bool Predicate::matches(const char *text, size_t len)
+{
+    if (root < 0) {
+        return true;
+    }
+    Line line;
+    const char *end = text + len;
+    const char *fields[4];
+    size_t lengths[4];
+    const char *p = text;
+    for (int i = 0; i < 4; ++i) {
+        const char *tab = i < 3 ? (const char *)memchr(p, '\t', end - p) : 0;
+        const char *stop = tab ? tab : end;
+        fields[i] = p;
+        lengths[i] = stop - p;
+        p = tab ? tab + 1 : end;
+    }
+    line.is_property = lengths[2] == 5 && memcmp(fields[2], "value", 5) == 0;
+    line.start[f_time] = fields[0];
+    line.len[f_time] = lengths[0];
+    line.start[f_name] = fields[1];
+    line.len[f_name] = lengths[1];
+    line.start[f_machine] = fields[1];
+    line.len[f_machine] = lengths[1];
+    line.start[f_property] = end;
+    line.len[f_property] = 0;
+    line.start[f_value] = fields[3];
+    line.len[f_value] = lengths[3];
+    if (line.is_property) {
+        static const char property_kind[] = "property";
+        const char *dot = 0;
+        for (const char *q = fields[1] + lengths[1]; q > fields[1]; --q) {
+            if (q[-1] == '.') {
+                dot = q - 1;
+                break;
+            }
+        }
+        if (dot) {
+            line.len[f_machine] = dot - fields[1];
+            line.start[f_property] = dot + 1;
+            line.len[f_property] = fields[1] + lengths[1] - dot - 1;
+        }
+        line.start[f_state] = end;
+        line.len[f_state] = 0;
+        if (lengths[3] >= 2 && fields[3][0] == '"' && fields[3][lengths[3] - 1] == '"') {
+            line.start[f_value] = fields[3] + 1;
+            line.len[f_value] = lengths[3] - 2;
+        }
+        line.start[f_kind] = property_kind;
+        line.len[f_kind] = sizeof(property_kind) - 1;
+    }
+    else {
+        static const char state_kind[] = "state";
+        line.start[f_state] = fields[2];
+        line.len[f_state] = lengths[2];
+        line.start[f_kind] = state_kind;
+        line.len[f_kind] = sizeof(state_kind) - 1;
+    }
+    memset(line.number_state, 0, sizeof(line.number_state));
+    line.time_state = 0;
+    return evaluate(root, line);
+}
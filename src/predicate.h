@@ -0,0 +1,115 @@
+#ifndef __predicate_h__
+#define __predicate_h__
+
+/*
+    Predicate evaluates a boolean expression over the fields of a line in
+    sampler's std format:
+
+        time <tab> machine <tab> state <tab> state number
+        time <tab> machine.property <tab> value <tab> value
+
+    The fields that can be tested are time, name, machine, property, state,
+    value and kind (state or property). On state lines value is the state
+    number. Comparisons are =, !=, <, <=, >, >=, =~ and !~ (regular
+    expression match), 'field in (a, b, ...)' and they are combined with
+    &&, || and ! and grouped with parentheses, for example
+
+        machine =~ ^conveyor && value > 100
+        state in (running, stopping) || time >= 2023-03-01T10:00:00Z
+
+    An operand that is a number is compared numerically with a numeric
+    field, an ISO 8601 time is compared with the time of the line (times
+    without a zone are UTC, as sampler writes them) and anything else is
+    compared as a string. Operands containing spaces or operator characters
+    can be quoted with " or '.
+
+    The line is split into fields once and numbers are parsed at most once
+    per line. Equality tests against several names are merged into a single
+    hash lookup. Evaluation caches regular expression state, so a Predicate
+    must not be shared between threads; use clone() to make another.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <regular_expressions.h>
+
+class PatternSet;
+
+class Predicate {
+    public:
+        Predicate();
+        ~Predicate();
+
+        // returns false and sets error if the expression cannot be compiled
+        bool compile(const std::string &expression, std::string &error);
+        const std::string &expression() const { return text; }
+
+        bool matches(const char *line, size_t len);
+
+        Predicate *clone() const;
+
+    private:
+        enum Field { f_time, f_name, f_machine, f_property, f_state, f_value, f_kind, field_count };
+        enum Op { op_eq, op_ne, op_lt, op_le, op_gt, op_ge };
+
+        class StringSet {
+            public:
+                void add(const std::string &s);
+                bool contains(const char *s, size_t len) const;
+                size_t size() const { return strings.size(); }
+            private:
+                void rehash();
+                std::vector<std::string> strings;
+                std::vector<uint64_t> hashes;
+                std::vector<int> table;    // indices into strings, -1 for empty
+        };
+
+        struct Node {
+            enum Type { all, any, negate, compare, regex, member };
+            Type type;
+            std::vector<int> children;  // for all, any and negate
+            Field field;
+            Op op;
+            std::string operand;
+            bool is_number;
+            double number;
+            bool is_time;
+            int64_t time;               // microseconds since the epoch
+            PatternSet *pattern;        // or, if unsupported by PatternSet:
+            rexp_info *fallback;
+            bool negated;               // !~
+            StringSet *set;
+        };
+
+        struct Line {
+            const char *start[field_count];
+            size_t len[field_count];
+            bool is_property;
+            int number_state[field_count];  // 0 not parsed, 1 number, 2 not a number
+            double number[field_count];
+            int time_state;
+            int64_t time;
+        };
+
+        class Parser;
+
+        void clear();
+        int optimise(int node);
+        bool evaluate(int node, Line &line);
+        bool numberOf(Line &line, Field field, double &value);
+        bool timeOf(Line &line, int64_t &value);
+
+        std::string text;
+        std::vector<Node> nodes;
+        int root;
+        std::string scratch;    // nul terminated copy of a field for the regex library
+
+        Predicate(const Predicate &);
+        Predicate &operator=(const Predicate &);
+
+        friend class Parser;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "receive_stats.h"
+#include <math.h>
+#include <string.h>
+
+void LatencyStats::clear()
+{
+    count = 0;
+    min = 0;
+    max = 0;
+    sum = 0;
+    sum_sq = 0;
+    memset(bucket_counts, 0, sizeof(bucket_counts));
+}
+
+void ReceiveStats::clear()
+{
+    messages = 0;
+    spin_hits = 0;
+    spin_misses = 0;
+    untimed = 0;
+    receive.clear();
+    transport.clear();
+}
+
+// the bucket of a latency: bucket n holds latencies below 2^n us
+static int latency_bucket(int64_t us)
+{
+    int bucket = 0;
+    if (us > 0) {
+        bucket = 1;
+        while (bucket < LatencyStats::buckets - 1 && (uint64_t)us >= (1ULL << bucket)) {
+            ++bucket;
+        }
+    }
+    return bucket;
+}
+
+// the counters have a single writer, so an increment need not be atomic
+template <typename T>
+static void add(std::atomic<T> &counter, T amount)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+void ReceiveCounters::Latency::add(int64_t us)
+{
+    uint64_t n = count.load(std::memory_order_relaxed);
+    if (n == 0 || us < min.load(std::memory_order_relaxed)) {
+        min.store(us, std::memory_order_relaxed);
+    }
+    if (n == 0 || us > max.load(std::memory_order_relaxed)) {
+        max.store(us, std::memory_order_relaxed);
+    }
+    ::add<double>(sum, us);
+    ::add<double>(sum_sq, (double)us * us);
+    ::add<uint64_t>(bucket_counts[latency_bucket(us)], 1);
+    count.store(n + 1, std::memory_order_relaxed);
+}
+
+void ReceiveCounters::Latency::clear()
+{
+    count.store(0, std::memory_order_relaxed);
+    min.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    sum_sq.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < LatencyStats::buckets; ++i) {
+        bucket_counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void ReceiveCounters::Latency::read(LatencyStats &stats) const
+{
+    stats.count = count.load(std::memory_order_relaxed);
+    stats.min = min.load(std::memory_order_relaxed);
+    stats.max = max.load(std::memory_order_relaxed);
+    stats.sum = sum.load(std::memory_order_relaxed);
+    stats.sum_sq = sum_sq.load(std::memory_order_relaxed);
+    for (int i = 0; i < LatencyStats::buckets; ++i) {
+        stats.bucket_counts[i] = bucket_counts[i].load(std::memory_order_relaxed);
+    }
+}
+
+ReceiveCounters::ReceiveCounters() : clear_requested(true)
+{
+    clearIfRequested();
+}
+
+void ReceiveCounters::clearIfRequested()
+{
+    if (!clear_requested.load(std::memory_order_relaxed) || !clear_requested.exchange(false)) {
+        return;
+    }
+    messages.store(0, std::memory_order_relaxed);
+    spin_hits.store(0, std::memory_order_relaxed);
+    spin_misses.store(0, std::memory_order_relaxed);
+    untimed.store(0, std::memory_order_relaxed);
+    receive.clear();
+    transport.clear();
+}
+
+void ReceiveCounters::addSpin(bool hit)
+{
+    clearIfRequested();
+    add<uint64_t>(hit ? spin_hits : spin_misses, 1);
+}
+
+void ReceiveCounters::addMessage(int64_t receive_us, bool timed, int64_t transport_us)
+{
+    clearIfRequested();
+    add<uint64_t>(messages, 1);
+    receive.add(receive_us);
+    if (timed) {
+        transport.add(transport_us);
+    }
+    else {
+        add<uint64_t>(untimed, 1);
+    }
+}
+
+void ReceiveCounters::read(ReceiveStats &stats) const
+{
+    stats.messages = messages.load(std::memory_order_relaxed);
+    stats.spin_hits = spin_hits.load(std::memory_order_relaxed);
+    stats.spin_misses = spin_misses.load(std::memory_order_relaxed);
+    stats.untimed = untimed.load(std::memory_order_relaxed);
+    receive.read(stats.receive);
+    transport.read(stats.transport);
+}
+
+// the upper bound of the bucket that holds the given fraction of latencies
+static uint64_t percentile(const LatencyStats &stats, double fraction)
+{
+    uint64_t wanted = (uint64_t)ceil(stats.count * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < LatencyStats::buckets; ++i) {
+        seen += stats.bucket_counts[i];
+        if (seen >= wanted) {
+            return i == 0 ? 0 : 1ULL << i;
+        }
+    }
+    return 1ULL << (LatencyStats::buckets - 1);
+}
+
+static void write_latency_json(std::ostream &out, const LatencyStats &stats)
+{
+    out << "{\"count\":" << stats.count;
+    if (stats.count) {
+        double mean = stats.sum / stats.count;
+        double variance = stats.sum_sq / stats.count - mean * mean;
+        out << ",\"min\":" << stats.min
+            << ",\"mean\":" << (int64_t)mean
+            << ",\"max\":" << stats.max
+            << ",\"jitter\":" << (int64_t)(variance > 0 ? sqrt(variance) : 0)
+            << ",\"p50_below\":" << percentile(stats, 0.5)
+            << ",\"p99_below\":" << percentile(stats, 0.99);
+    }
+    out << "}";
+}
+
+void write_receive_stats_json(std::ostream &out, const ReceiveStats &stats, bool low_latency)
+{
+    out << "{\"messages\":" << stats.messages
+        << ",\"low_latency\":" << (low_latency ? "true" : "false");
+    if (low_latency) {
+        out << ",\"spin_hits\":" << stats.spin_hits << ",\"spin_misses\":" << stats.spin_misses;
+    }
+    out << ",\"receive_us\":";
+    write_latency_json(out, stats.receive);
+    out << ",\"transport_us\":";
+    write_latency_json(out, stats.transport);
+    out << ",\"untimed\":" << stats.untimed << "}";
+}
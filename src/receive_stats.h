@@ -0,0 +1,104 @@
+#ifndef __receive_stats_h__
+#define __receive_stats_h__
+
+/*
+    Counters kept by sampler's receive loop, reported as a single line of
+    JSON by the STATS command.
+
+    The receive loop may run at real time priority, so it never waits for
+    the command thread: each counter in ReceiveCounters is an atomic that
+    only the receive loop writes, with a plain store rather than a locked
+    read-modify-write. STATS reads them one at a time, so a message may be
+    counted in one figure and not yet in the next. STATS RESET asks for the
+    counters to be cleared, which the receive loop does at its next update.
+
+    Two latencies are kept for each message:
+
+        receive     from the moment the message was known to be ready (the
+                    spin that found it, or the return from poll) to the
+                    moment sampler took its timestamp, on the monotonic
+                    clock. Its spread is the jitter that sampler itself
+                    adds to the timestamps.
+        transport   from the send time in the message header, taken by the
+                    publisher, to sampler's timestamp, on the wall clock.
+                    This includes any offset between the two hosts'
+                    clocks. Messages whose header has no send time are
+                    counted as untimed instead.
+
+    Latencies are also counted in power of two buckets of microseconds for
+    the percentiles.
+*/
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+
+struct LatencyStats {
+    enum { buckets = 32 };
+
+    uint64_t count;
+    int64_t min;                // microseconds
+    int64_t max;
+    double sum;
+    double sum_sq;
+    uint64_t bucket_counts[buckets];    // bucket n holds latencies below 2^n us, 0 holds <= 0
+
+    LatencyStats() { clear(); }
+    void clear();
+};
+
+struct ReceiveStats {
+    uint64_t messages;
+    uint64_t spin_hits;         // messages found while spinning (--low-latency)
+    uint64_t spin_misses;       // spins that ended without a message
+    uint64_t untimed;           // messages without a send time
+    LatencyStats receive;
+    LatencyStats transport;
+
+    ReceiveStats() { clear(); }
+    void clear();
+};
+
+class ReceiveCounters {
+    public:
+        ReceiveCounters();
+
+        // receive loop only; transport_us is not used for an untimed message
+        void addSpin(bool hit);
+        void addMessage(int64_t receive_us, bool timed, int64_t transport_us);
+
+        // any thread
+        void read(ReceiveStats &stats) const;
+        void requestClear() { clear_requested.store(true, std::memory_order_relaxed); }
+
+    private:
+        struct Latency {
+            std::atomic<uint64_t> count;
+            std::atomic<int64_t> min;
+            std::atomic<int64_t> max;
+            std::atomic<double> sum;
+            std::atomic<double> sum_sq;
+            std::atomic<uint64_t> bucket_counts[LatencyStats::buckets];
+
+            void add(int64_t us);
+            void clear();
+            void read(LatencyStats &stats) const;
+        };
+
+        void clearIfRequested();
+
+        std::atomic<bool> clear_requested;
+        std::atomic<uint64_t> messages;
+        std::atomic<uint64_t> spin_hits;
+        std::atomic<uint64_t> spin_misses;
+        std::atomic<uint64_t> untimed;
+        Latency receive;
+        Latency transport;
+
+        ReceiveCounters(const ReceiveCounters &);
+        ReceiveCounters &operator=(const ReceiveCounters &);
+};
+
+void write_receive_stats_json(std::ostream &out, const ReceiveStats &stats, bool low_latency);
+
+#endif
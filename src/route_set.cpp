@@ -0,0 +1,138 @@
+#include "route_set.h"
+#include <algorithm>
+
+// spaces around the arrow are for readability; a tab may be part of the pattern
+static std::string trim(const std::string &s)
+{
+    size_t first = s.find_first_not_of(" ");
+    if (first == std::string::npos) {
+        return "";
+    }
+    size_t last = s.find_last_not_of(" ");
+    return s.substr(first, last - first + 1);
+}
+
+RouteSet::RouteSet() : default_destination(-1), generation(0)
+{
+}
+
+RouteSet::~RouteSet()
+{
+    for (size_t i = 0; i < routes.size(); ++i) {
+        if (routes[i].fallback) {
+            release_pattern(routes[i].fallback);
+        }
+    }
+}
+
+int RouteSet::destinationIndex(const std::string &name)
+{
+    std::vector<std::string>::iterator found = std::find(destinations.begin(), destinations.end(), name);
+    if (found != destinations.end()) {
+        return found - destinations.begin();
+    }
+    destinations.push_back(name);
+    result_mark.push_back(0);
+    return destinations.size() - 1;
+}
+
+bool RouteSet::add(const std::string &spec, std::string &error)
+{
+    // the last => separates the pattern from the destination
+    size_t arrow = spec.rfind("=>");
+    if (arrow == std::string::npos) {
+        error = "expected 'pattern => destination' in '" + spec + "'";
+        return false;
+    }
+    Route route;
+    route.spec = spec;
+    route.pattern = trim(spec.substr(0, arrow));
+    std::string destination = trim(spec.substr(arrow + 2));
+    if (destination.empty()) {
+        error = "missing destination in '" + spec + "'";
+        return false;
+    }
+    route.fallback = create_pattern(route.pattern.c_str());
+    if (route.fallback->compilation_result != 0) {
+        release_pattern(route.fallback);
+        error = "failed to compile regexp: " + route.pattern;
+        return false;
+    }
+    int idx = combined.add(route.pattern.c_str());
+    if (idx >= 0) {
+        release_pattern(route.fallback);
+        route.fallback = 0;
+        combined_route.push_back(routes.size());
+    }
+    else {
+        fallback_routes.push_back(routes.size());
+    }
+    route.destination = destinationIndex(destination);
+    routes.push_back(route);
+    return true;
+}
+
+void RouteSet::setDefault(const std::string &destination)
+{
+    default_destination = destinationIndex(destination);
+}
+
+const std::vector<int> &RouteSet::route(const char *text, size_t len, bool is_terminated)
+{
+    if (++generation == 0) {
+        std::fill(result_mark.begin(), result_mark.end(), 0);
+        generation = 1;
+    }
+    matched.clear();
+    result.clear();
+    if (!combined.empty()) {
+        combined.matchAll(text, len, found);
+        for (size_t i = 0; i < found.size(); ++i) {
+            int r = combined_route[found[i]];
+            matched.push_back(r);
+            int destination = routes[r].destination;
+            if (result_mark[destination] != generation) {
+                result_mark[destination] = generation;
+                result.push_back(destination);
+            }
+        }
+    }
+    for (size_t i = 0; i < fallback_routes.size(); ++i) {
+        const Route &route = routes[fallback_routes[i]];
+        if (result_mark[route.destination] == generation) {
+            continue;   // already going there
+        }
+        if (!is_terminated) {
+            terminated.assign(text, len);
+            text = terminated.c_str();
+            is_terminated = true;
+        }
+        if (execute_pattern(route.fallback, text) == 0) {
+            matched.push_back(fallback_routes[i]);
+            result_mark[route.destination] = generation;
+            result.push_back(route.destination);
+        }
+    }
+    if (result.empty() && default_destination >= 0) {
+        result.push_back(default_destination);
+    }
+    return result;
+}
+
+RouteSet *RouteSet::clone() const
+{
+    RouteSet *copy = new RouteSet;
+    copy->routes = routes;
+    for (size_t i = 0; i < copy->routes.size(); ++i) {
+        if (copy->routes[i].fallback) {
+            copy->routes[i].fallback = create_pattern(copy->routes[i].pattern.c_str());
+        }
+    }
+    copy->destinations = destinations;
+    copy->default_destination = default_destination;
+    copy->combined = combined;
+    copy->combined_route = combined_route;
+    copy->fallback_routes = fallback_routes;
+    copy->result_mark.assign(destinations.size(), 0);
+    return copy;
+}
@@ -0,0 +1,77 @@
+#ifndef __route_set_h__
+#define __route_set_h__
+
+/*
+    RouteSet decides which outputs a line is written to. Each route is a
+    regular expression and a destination name ("pattern => destination");
+    a line goes to every destination that has a route matching it, once,
+    and to the default destination if no route matches. All the patterns
+    that the combined matcher supports are tested in a single scan of the
+    line.
+
+    Matching caches automaton state, so each thread needs its own copy
+    (see clone()).
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <regular_expressions.h>
+#include "pattern_set.h"
+
+class RouteSet {
+    public:
+        RouteSet();
+        ~RouteSet();
+
+        // returns false and sets error if the route cannot be used
+        bool add(const std::string &spec, std::string &error);
+        void setDefault(const std::string &destination);
+
+        size_t size() const { return routes.size(); }
+        const std::string &spec(size_t route) const { return routes[route].spec; }
+
+        // destinations are numbered in the order they are first named
+        size_t destinationCount() const { return destinations.size(); }
+        const std::string &destination(size_t idx) const { return destinations[idx]; }
+
+        // the destinations for the text, each listed once. is_terminated
+        // says whether text[len] is a nul. The routes found to match are in
+        // matchedRoutes() until the next call; a regex route is not tried
+        // when its destination already has the line.
+        const std::vector<int> &route(const char *text, size_t len, bool is_terminated);
+        const std::vector<int> &matchedRoutes() const { return matched; }
+
+        RouteSet *clone() const;
+
+    private:
+        struct Route {
+            std::string spec;
+            std::string pattern;
+            int destination;
+            rexp_info *fallback;    // when the combined matcher cannot take the pattern
+        };
+
+        int destinationIndex(const std::string &name);
+
+        std::vector<Route> routes;
+        std::vector<std::string> destinations;
+        int default_destination;
+
+        PatternSet combined;
+        std::vector<int> combined_route;    // PatternSet index to route
+        std::vector<int> fallback_routes;
+
+        std::vector<int> found;
+        std::vector<int> matched;
+        std::vector<int> result;
+        std::vector<unsigned int> result_mark;
+        unsigned int generation;
+        std::string terminated;
+
+        RouteSet(const RouteSet &);
+        RouteSet &operator=(const RouteSet &);
+};
+
+#endif
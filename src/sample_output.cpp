@@ -0,0 +1,123 @@
+#include "sample_output.h"
+#include <ctype.h>
+#include <string.h>
+#include <time.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+int lookupName(std::map<std::string, int> &names, const std::string &name, int &next_num)
+{
+    std::map<std::string, int>::iterator idx = names.find(name);
+    if (idx == names.end()) {
+        names[name] = next_num;
+        return next_num++;
+    }
+    return (*idx).second;
+}
+
+std::string escapeNonprintables(const char *buf)
+{
+    const char *hex = "0123456789ABCDEF";
+    std::string res;
+    while (*buf) {
+        if (isprint(*buf)) {
+            res += *buf;
+        }
+        else if (*buf == '\015') {
+            res += "\\r";
+        }
+        else if (*buf == '\012') {
+            res += "\\n";
+        }
+        else if (*buf == '\010') {
+            res += "\\t";
+        }
+        else {
+            const char tmp[3] = { hex[(*buf & 0xf0) >> 4], hex[(*buf & 0x0f)], 0 };
+            res = res + "#{" + tmp + "}";
+        }
+        ++buf;
+    }
+    return res;
+}
+
+std::ostream &timestamp(std::ostream &out, uint64_t offset, long scale, bool use_datetime, const std::string &dateformat)
+{
+    using namespace boost::posix_time;
+    if (use_datetime) {
+        if (dateformat == "posix") {
+            time_t rawtime;
+            struct tm timeinfo;
+
+            time(&rawtime);
+            localtime_r(&rawtime, &timeinfo);
+            char buf[40];
+            asctime_r(&timeinfo, buf);
+            size_t n = strlen(buf);
+            if (n > 1 && buf[n - 1] == '\n') {
+                buf[n - 1] = 0;
+            }
+            out << buf << " " << timeinfo.tm_zone;
+        }
+        else if (dateformat == "iso8601") {
+            ptime t = microsec_clock::universal_time();
+            out << to_iso_string(t) << "Z";
+        }
+        else {
+            out << "unknown date format: " << dateformat;
+        }
+    }
+    else {
+        return out << offset / scale;
+    }
+    return out;
+}
+
+void formatState(std::ostream &out, const SampleFormat &f, uint64_t offset,
+        const std::string &machine, const std::string &state, int state_num)
+{
+    if (f.format == "std") {
+        timestamp(out, offset, f.scale, f.use_datetime, f.date_format);
+        out << "\t" << machine << "\t" << state << "\t" << state_num;
+    }
+    else if (f.format == "kv") {
+        out << "machine: " << machine << ", state: " << state << ", timestamp: ";
+        timestamp(out, offset, f.scale, f.use_datetime, f.date_format);
+    }
+    else if (f.format == "kvq") {
+        out << "\"machine\": \""
+                << machine << "\", \"state\": \""
+                << state << "\", \"timestamp\": ";
+        if (f.use_datetime) {
+            out << "\"";
+        }
+        timestamp(out, offset, f.scale, f.use_datetime, f.date_format);
+        if (f.use_datetime) {
+            out << "\"";
+        }
+    }
+}
+
+void formatProperty(std::ostream &out, const SampleFormat &f, uint64_t offset,
+        const std::string &machine, const std::string &prop, const std::string &property, const std::string &value)
+{
+    if (f.format == "std") {
+        timestamp(out, offset, f.scale, f.use_datetime, f.date_format);
+        out << "\t" << property << "\tvalue\t" << value;
+    }
+    else if (f.format == "kv") {
+        out << "machine: " << machine << ", " << prop << ": " << value << ", timestamp: ";
+        timestamp(out, offset, f.scale, f.use_datetime, f.date_format);
+    }
+    else if (f.format == "kvq") {
+        out << "\"machine\": \""
+                << machine << "\", \"" << prop << "\": "
+                << value << ", \"timestamp\": ";
+        if (f.use_datetime) {
+            out << "\"";
+        }
+        timestamp(out, offset, f.scale, f.use_datetime, f.date_format);
+        if (f.use_datetime) {
+            out << "\"";
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef __sample_output_h__
+#define __sample_output_h__
+
+/*
+    The text sampler writes for each event, kept apart from the messaging
+    code so that it can be measured on its own (see benchmarks.cpp).
+*/
+
+#include <stdint.h>
+#include <map>
+#include <ostream>
+#include <string>
+
+struct SampleFormat {
+    std::string format;         // std, kv or kvq
+    long scale;                 // 1 for microseconds, 1000 for milliseconds
+    bool use_datetime;          // the time of day instead of the offset
+    std::string date_format;    // posix or iso8601
+};
+
+// the number of a name, giving a new name the next number
+int lookupName(std::map<std::string, int> &names, const std::string &name, int &next_num);
+
+// printable text with \r, \n and \t escaped and other bytes as #{XX}
+std::string escapeNonprintables(const char *buf);
+
+std::ostream &timestamp(std::ostream &out, uint64_t offset, long scale, bool use_datetime, const std::string &dateformat);
+
+void formatState(std::ostream &out, const SampleFormat &format, uint64_t offset,
+        const std::string &machine, const std::string &state, int state_num);
+// property is machine.prop, value the escaped (and for strings quoted) value
+void formatProperty(std::ostream &out, const SampleFormat &format, uint64_t offset,
+        const std::string &machine, const std::string &prop, const std::string &property, const std::string &value);
+
+#endif
@@ -54,6 +54,17 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <map>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "device_history.h"
+#include "file_sink.h"
+#include "message_decoder.h"
+#include "pipeline.h"
+#include "receive_stats.h"
+#include "sample_output.h"
+#include "shm_ring.h"
+#include "trigger_capture.h"
 
 using namespace std;
 
@@ -71,15 +82,16 @@ void interrupt_handler(int sig)
     exit(0);
 }
 
-map<string, int> state_map;
-map<string, int> device_map;
+void save_state_names();
+
+Interner interner(save_state_names);
 std::string current_channel;
 
 void save_devices()
 {
     ofstream device_file("devices.dat");
-    map<string, int>::iterator iter = device_map.begin();
-    while (iter != device_map.end()) {
+    map<string, int>::const_iterator iter = interner.devices().begin();
+    while (iter != interner.devices().end()) {
         device_file << (*iter).first << "\t" << (*iter).second << "\n";
         iter++;
     }
@@ -88,8 +100,8 @@ void save_devices()
 void save_state_names()
 {
     ofstream states_file("states.dat");
-    map<string, int>::iterator iter = state_map.begin();
-    while (iter != state_map.end()) {
+    map<string, int>::const_iterator iter = interner.states().begin();
+    while (iter != interner.states().end()) {
         states_file << (*iter).first << "\t" << (*iter).second << "\n";
         iter++;
     }
@@ -115,12 +127,25 @@ class SamplerOptions {
         bool timestamp;
         string output_format;
         string date_format;
+        RotatingFileSink::Config file_sink;
+        string shm_ring_name;
+        int shm_ring_slots;
+        TriggerCapture::Config capture;
+        string trigger;
+        int history_memory;
+        bool low_latency;
+        int cpu;
+        int spin_us;
+        bool lock_memory;
+        int fifo_priority;
 
         SamplerOptions() : subscribe_to_port(5556), subscribe_to_host("localhost"),
             publish_to_port(5560), publish_to_interface("*"),
             republish(false), quiet(false), raw(false), ignore_values(false), only_numeric_values(false),
             use_millis(true), channel_name("SAMPLER_CHANNEL"), cw_port(5555), debug_flag(false),
-            user_start_time(0), timestamp(false), output_format("std"), date_format("iso8601")
+            user_start_time(0), timestamp(false), output_format("std"), date_format("iso8601"),
+            shm_ring_slots(65536), history_memory(0),
+            low_latency(false), cpu(-1), spin_us(100), lock_memory(false), fifo_priority(0)
         {}
     public:
         static SamplerOptions *instance() { if (!_instance) _instance = new SamplerOptions(); return _instance; }
@@ -147,6 +172,19 @@ class SamplerOptions {
         bool emitTimestamp() { return timestamp; }
         const std::string &format() { return output_format; }
         const std::string &dateFormat() { return date_format; }
+        bool useFileSink() { return !file_sink.directory.empty(); }
+        const RotatingFileSink::Config &fileSinkConfig() { return file_sink; }
+        const std::string &shmRing() { return shm_ring_name; }
+        int shmRingSlots() { return shm_ring_slots; }
+        bool useCapture() { return !capture.directory.empty(); }
+        const TriggerCapture::Config &captureConfig() { return capture; }
+        const std::string &triggerExpression() { return trigger; }
+        size_t historyMemory() { return (size_t)history_memory * 1024 * 1024; }
+        bool lowLatency() { return low_latency; }
+        int cpuCore() { return cpu; }
+        int spinMicros() { return spin_us; }
+        bool lockMemory() { return lock_memory; }
+        int fifoPriority() { return fifo_priority; }
 };
 
 bool SamplerOptions::parseCommandLine(int argc, const char *argv[])
@@ -173,6 +211,26 @@ bool SamplerOptions::parseCommandLine(int argc, const char *argv[])
         ("start", po::value<string>(), "start time for time deltas")
         ("format", po::value<string>(), "select output format (std, kv, kvq)")
         ("date-format", po::value<string>(), "timestamp format (posix, iso8601) (implies --timestamp)")
+        ("output-dir", po::value<string>(), "write output to rotating files in this directory instead of stdout")
+        ("output-prefix", po::value<string>(), "file name prefix for --output-dir [sampler]")
+        ("output-max-size", po::value<int>(), "rotate output files after this many megabytes [256]")
+        ("output-rotate", po::value<int>(), "rotate output files after this many seconds [3600]")
+        ("output-sync", po::value<string>(), "output durability (none, rotate, batch, periodic) [rotate]")
+        ("output-sync-interval", po::value<int>(), "milliseconds between syncs for --output-sync periodic [1000]")
+        ("shm-ring", po::value<string>(), "also publish binary events to the named shared memory ring")
+        ("shm-ring-slots", po::value<int>(), "number of events held by the shared memory ring [65536]")
+        ("capture-dir", po::value<string>(), "write triggered captures to files in this directory")
+        ("trigger", po::value<string>(), "condition that starts a capture (see TRIGGER)")
+        ("capture-slots", po::value<int>(), "number of recent events held for captures [65536]")
+        ("capture-pre", po::value<int>(), "milliseconds captured before a trigger [5000]")
+        ("capture-post", po::value<int>(), "milliseconds captured after a trigger [5000]")
+        ("capture-holdoff", po::value<int>(), "milliseconds from one trigger to the next [10000]")
+        ("history-memory", po::value<int>(), "megabytes of recent device history kept for HISTORY [0]")
+        ("low-latency", "spin waiting for messages before sleeping in poll")
+        ("cpu", po::value<int>(), "pin the receive thread to this core (implies --low-latency)")
+        ("spin-us", po::value<int>(), "microseconds to spin before polling in --low-latency mode [100]")
+        ("mlock", "lock sampler's memory so it cannot be paged out")
+        ("fifo-priority", po::value<int>(), "run the receive thread with SCHED_FIFO at this priority")
         ;
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -248,6 +306,76 @@ bool SamplerOptions::parseCommandLine(int argc, const char *argv[])
                 return false;
             }
         }
+        if (vm.count("output-dir")) {
+            file_sink.directory = vm["output-dir"].as<string>();
+        }
+        if (vm.count("output-prefix")) {
+            file_sink.prefix = vm["output-prefix"].as<string>();
+        }
+        if (vm.count("output-max-size")) {
+            file_sink.max_file_size = (uint64_t)vm["output-max-size"].as<int>() * 1024 * 1024;
+        }
+        if (vm.count("output-rotate")) {
+            file_sink.rotate_secs = vm["output-rotate"].as<int>();
+        }
+        if (vm.count("output-sync")) {
+            string policy = vm["output-sync"].as<string>();
+            if (!RotatingFileSink::parseSyncPolicy(policy, file_sink.sync_policy)) {
+                cerr << "error: invalid output sync policy '" << policy << "'\n";
+                cerr << "valid policies are: none, rotate, batch, periodic\n";
+                return false;
+            }
+        }
+        if (vm.count("output-sync-interval")) {
+            file_sink.sync_interval_ms = vm["output-sync-interval"].as<int>();
+        }
+        if (vm.count("shm-ring")) {
+            shm_ring_name = vm["shm-ring"].as<string>();
+        }
+        if (vm.count("shm-ring-slots")) {
+            shm_ring_slots = vm["shm-ring-slots"].as<int>();
+        }
+        if (vm.count("capture-dir")) {
+            capture.directory = vm["capture-dir"].as<string>();
+        }
+        if (vm.count("trigger")) {
+            trigger = vm["trigger"].as<string>();
+        }
+        if (vm.count("capture-slots")) {
+            capture.slots = vm["capture-slots"].as<int>();
+        }
+        if (vm.count("capture-pre")) {
+            capture.pre_ms = vm["capture-pre"].as<int>();
+        }
+        if (vm.count("capture-post")) {
+            capture.post_ms = vm["capture-post"].as<int>();
+        }
+        if (vm.count("capture-holdoff")) {
+            capture.holdoff_ms = vm["capture-holdoff"].as<int>();
+        }
+        if (vm.count("history-memory")) {
+            history_memory = vm["history-memory"].as<int>();
+        }
+        if (vm.count("low-latency")) {
+            low_latency = true;
+        }
+        if (vm.count("cpu")) {
+            cpu = vm["cpu"].as<int>();
+            low_latency = true;
+        }
+        if (vm.count("spin-us")) {
+            spin_us = vm["spin-us"].as<int>();
+        }
+        if (vm.count("mlock")) {
+            lock_memory = true;
+        }
+        if (vm.count("fifo-priority")) {
+            fifo_priority = vm["fifo-priority"].as<int>();
+        }
+        if (!trigger.empty() && capture.directory.empty()) {
+            cerr << "error: --trigger needs --capture-dir\n";
+            return false;
+        }
     }
     catch (const exception &e) {
         cerr << "error: " << e.what() << "\n";
@@ -259,6 +387,8 @@ bool SamplerOptions::parseCommandLine(int argc, const char *argv[])
     }
     return true;
 }
+void sendMessage(zmq::socket_t &socket, const char *message, int flags = 0);
+
 struct CommandThread {
         void operator()();
         CommandThread();
@@ -281,6 +411,8 @@ struct Command {
             done = run(params);
             return done;
         }
+        // send the result of a successful command
+        virtual void reply(zmq::socket_t &socket) { sendMessage(socket, result()); }
 
     protected:
         virtual bool run(std::vector<Value> &params) = 0;
@@ -347,6 +479,141 @@ bool CommandInfo::run(std::vector<Value> &params)
     return true;
 }
 
+static TriggerCapture *trigger_capture = 0;
+
+struct CommandTrigger : public Command {
+    bool run(std::vector<Value> &params);
+};
+
+bool CommandTrigger::run(std::vector<Value> &params)
+{
+    if (!trigger_capture) {
+        error_str = "triggered capture is not enabled (see --capture-dir)";
+        return false;
+    }
+    if (params.size() == 1) {
+        result_str = trigger_capture->status();
+        return true;
+    }
+    std::string expression;
+    if (params.size() != 2 || !(params[1] == "OFF" || params[1] == "off")) {
+        for (size_t i = 1; i < params.size(); ++i) {
+            if (i > 1) {
+                expression += " ";
+            }
+            expression += params[i].asString();
+        }
+    }
+    if (!trigger_capture->setTrigger(expression, error_str)) {
+        return false;
+    }
+    result_str = trigger_capture->status();
+    return true;
+}
+
+static ReceiveCounters receive_counters;     // written only by the receive loop
+
+struct CommandStats : public Command {
+    bool run(std::vector<Value> &params);
+};
+
+bool CommandStats::run(std::vector<Value> &params)
+{
+    ReceiveStats stats;
+    receive_counters.read(stats);
+    if (params.size() == 2 && (params[1] == "RESET" || params[1] == "reset")) {
+        receive_counters.requestClear();
+    }
+    std::ostringstream out;
+    write_receive_stats_json(out, stats, SamplerOptions::instance()->lowLatency());
+    result_str = out.str();
+    return true;
+}
+
+static DeviceHistory *device_history = 0;
+
+struct CommandHistory : public Command {
+    bool run(std::vector<Value> &params);
+    void reply(zmq::socket_t &socket);
+    std::string device;
+    uint64_t from;
+    uint64_t to;
+};
+
+// times are milliseconds; a negative time is relative to the latest event
+static bool historyTime(const Value &param, uint64_t latest, uint64_t &time)
+{
+    std::string text(param.asString());
+    char *end;
+    long long ms = strtoll(text.c_str(), &end, 10);
+    if (text.empty() || *end) {
+        return false;
+    }
+    if (ms < 0) {
+        uint64_t back = (uint64_t)-ms * 1000;
+        time = back < latest ? latest - back : 0;
+    }
+    else {
+        time = (uint64_t)ms * 1000;
+    }
+    return true;
+}
+
+bool CommandHistory::run(std::vector<Value> &params)
+{
+    if (!device_history) {
+        error_str = "device history is not enabled (see --history-memory)";
+        return false;
+    }
+    if (params.size() < 2 || params.size() > 4) {
+        error_str = "usage: HISTORY device [from] [to]";
+        return false;
+    }
+    uint64_t latest = device_history->latest();
+    device = params[1].asString();
+    from = 0;
+    to = UINT64_MAX;
+    if ((params.size() > 2 && !historyTime(params[2], latest, from))
+            || (params.size() > 3 && !historyTime(params[3], latest, to))) {
+        error_str = "usage: HISTORY device [from] [to] (milliseconds, negative for before the latest change)";
+        return false;
+    }
+    std::string none;
+    uint64_t position = 0;
+    size_t points;
+    if (!device_history->read(device, from, to, position, none, 0, points)) {
+        error_str = "unknown device " + device;
+        return false;
+    }
+    return true;
+}
+
+// the points are sent in batches as the parts of a multipart reply; the
+// last part gives the number of points, and of any points dropped to stay
+// within the memory budget
+void CommandHistory::reply(zmq::socket_t &socket)
+{
+    std::string batch;
+    uint64_t position = 0;
+    size_t total = 0;
+    size_t points;
+    while (device_history->read(device, from, to, position, batch, 1000, points) && points) {
+        sendMessage(socket, batch.c_str(), ZMQ_SNDMORE);
+        total += points;
+        batch.clear();
+    }
+    char buf[80];
+    uint64_t dropped = device_history->dropped(device);
+    if (dropped) {
+        snprintf(buf, sizeof(buf), "%lu points, %llu dropped (--history-memory)", (unsigned long)total,
+                (unsigned long long)dropped);
+    }
+    else {
+        snprintf(buf, sizeof(buf), "%lu points", (unsigned long)total);
+    }
+    sendMessage(socket, buf);
+}
+
 struct CommandMonitor : public Command {
     bool run(std::vector<Value> &params);
 };
@@ -471,13 +738,13 @@ bool CommandStopMonitor::run(std::vector<Value> &params)
     return false;
 }
 
-void sendMessage(zmq::socket_t &socket, const char *message)
+void sendMessage(zmq::socket_t &socket, const char *message, int flags)
 {
     const char *msg = (message) ? message : "";
     size_t len = strlen(msg);
     zmq::message_t reply(len);
     memcpy((void *) reply.data(), msg, len);
-    socket.send(reply);
+    socket.send(reply, flags);
 }
 
 enum RecoveryType { no_recovery, send_recovery, recv_recovery } recovery_type;
@@ -548,11 +815,20 @@ void CommandThread::operator()()
                 else if (ds == "refresh" || ds == "REFRESH") {
                     command = new CommandRefresh();
                 }
+                else if (ds == "trigger" || ds == "TRIGGER") {
+                    command = new CommandTrigger();
+                }
+                else if (ds == "history" || ds == "HISTORY") {
+                    command = new CommandHistory();
+                }
+                else if (ds == "stats" || ds == "STATS") {
+                    command = new CommandStats();
+                }
                 else {
                     command = new CommandUnknown;
                 }
                 if ((*command)(params)) {
-                    sendMessage(socket, command->result());
+                    command->reply(socket);
                 }
                 else {
                     NB_MSG << command->error() << "\n";
@@ -619,51 +895,84 @@ std::string outputRemaining(std::ostream &out, std::istream &in)
     return res;
 }
 
-static int next_device_num = 0;
-static int next_state_num = 0;
+static bool need_refresh = false;
+static RotatingFileSink *file_sink = 0;
 
-int lookupState(std::string &state)
+void stop_file_sink()
 {
-    int state_num = 0;
-    map<string, int>::iterator idx = state_map.find(state);
-    if (idx == state_map.end()) {// new state
-        state_num = next_state_num;
-        state_map[state] = next_state_num++;
-        save_state_names();
+    if (file_sink) {
+        file_sink->stop();
     }
-    else {
-        state_num = (*idx).second;
+}
+
+static ShmRing event_ring;
+static bool use_event_ring = false;
+
+void close_event_ring()
+{
+    if (use_event_ring) {
+        event_ring.close();
     }
-    return state_num;
 }
 
-std::string escapeNonprintables(const char *buf)
+void stop_trigger_capture()
 {
-    const char *hex = "0123456789ABCDEF";
-    std::string res;
-    while (*buf) {
-        if (isprint(*buf)) {
-            res += *buf;
-        }
-        else if (*buf == '\015') {
-            res += "\\r";
-        }
-        else if (*buf == '\012') {
-            res += "\\n";
-        }
-        else if (*buf == '\010') {
-            res += "\\t";
+    if (trigger_capture) {
+        trigger_capture->stop();
+    }
+}
+
+// pin, lock and raise the priority of the calling thread for --low-latency;
+// failures are reported but sampling continues
+void setupLowLatency(SamplerOptions &options)
+{
+    if (options.cpuCore() >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(options.cpuCore(), &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err) {
+            cerr << "warning: cannot pin to cpu " << options.cpuCore() << ": " << strerror(err) << "\n";
         }
-        else {
-            const char tmp[3] = { hex[(*buf & 0xf0) >> 4], hex[(*buf & 0x0f)], 0 };
-            res = res + "#{" + tmp + "}";
+    }
+    if (options.lockMemory() && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        cerr << "warning: cannot lock memory: " << strerror(errno) << "\n";
+    }
+    if (options.fifoPriority() > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = options.fifoPriority();
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err) {
+            cerr << "warning: cannot use SCHED_FIFO: " << strerror(err) << "\n";
         }
-        ++buf;
     }
-    return res;
 }
 
-static bool need_refresh = false;
+static uint64_t monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// checks the socket's pending events in a loop, rather than sleeping in
+// poll, until a message is ready or spin_us have passed. Reading
+// ZMQ_EVENTS processes the socket's pending commands, which may still
+// enter the kernel, but the thread does not block waiting for a message
+bool spinForMessage(zmq::socket_t &socket, int spin_us)
+{
+    uint64_t until = monotonic_us() + spin_us;
+    do {
+        int events = 0;
+        size_t size = sizeof(events);
+        socket.getsockopt(ZMQ_EVENTS, &events, &size);
+        if (events & ZMQ_POLLIN) {
+            return true;
+        }
+    } while (monotonic_us() < until);
+    return false;
+}
 
 class SetupConnectMonitor : public EventResponder {
     public:
@@ -674,38 +983,6 @@ class SetupConnectMonitor : public EventResponder {
 
 SamplerOptions *SamplerOptions::_instance = 0;
 
-std::ostream &timestamp(std::ostream &out, uint64_t offset, long scale, bool use_datetime, const string &dateformat)
-{
-    using namespace boost::posix_time;
-    if (use_datetime) {
-        if (dateformat == "posix") {
-            time_t rawtime;
-            struct tm timeinfo;
-
-            time(&rawtime);
-            localtime_r(&rawtime, &timeinfo);
-            char buf[40];
-            asctime_r(&timeinfo, buf);
-            size_t n = strlen(buf);
-            if (n > 1 && buf[n - 1] == '\n') {
-                buf[n - 1] = 0;
-            }
-            out << buf << " " << timeinfo.tm_zone;
-        }
-        else if (dateformat == "iso8601") {
-            ptime t = microsec_clock::universal_time();
-            out << to_iso_string(t) << "Z";
-        }
-        else {
-            out << "unknown date format: " << dateformat;
-        }
-    }
-    else {
-        return out << offset / scale;
-    }
-    return out;
-}
-
 int main(int argc, const char *argv[])
 {
     char *pn = strdup(argv[0]);
@@ -719,7 +996,7 @@ int main(int argc, const char *argv[])
         return 1;
     }
 
-    if (options.quietMode() && !options.publish()) {
+    if (options.quietMode() && !options.publish() && !options.useFileSink()) {
         cerr << "Warning: not writing to stdout or zmq\n";
     }
     //  if (options.debug())
@@ -730,6 +1007,38 @@ int main(int argc, const char *argv[])
         mif = MessagingInterface::create("*", options.publisherPort());
     }
 
+    if (options.useFileSink()) {
+        file_sink = new RotatingFileSink(options.fileSinkConfig());
+        std::string error;
+        if (!file_sink->start(error)) {
+            cerr << "error: " << error << "\n";
+            return 1;
+        }
+        atexit(stop_file_sink);
+    }
+    if (!options.shmRing().empty()) {
+        std::string error;
+        if (!event_ring.create(options.shmRing(), options.shmRingSlots(), error)) {
+            cerr << "error: " << error << "\n";
+            return 1;
+        }
+        use_event_ring = true;
+        atexit(close_event_ring);
+    }
+    if (options.useCapture()) {
+        trigger_capture = new TriggerCapture(options.captureConfig());
+        std::string error;
+        if (!trigger_capture->start(error)
+                || (!options.triggerExpression().empty() && !trigger_capture->setTrigger(options.triggerExpression(), error))) {
+            cerr << "error: " << error << "\n";
+            return 1;
+        }
+        atexit(stop_trigger_capture);
+    }
+    if (options.historyMemory()) {
+        device_history = new DeviceHistory(options.historyMemory());
+    }
+
     atexit(save_devices);
     atexit(save_state_names);
     signal(SIGINT, interrupt_handler);
@@ -753,8 +1062,44 @@ int main(int argc, const char *argv[])
     gettimeofday(&start, 0);
     uint64_t first_message_time = options.userStartTime(); // can be initialised on the commandline
     stringstream output;
+    SampleFormat sample_format;
+    sample_format.format = options.format();
+    sample_format.scale = options.reportMillis() ? 1000 : 1;
+    sample_format.use_datetime = options.emitTimestamp();
+    sample_format.date_format = options.dateFormat();
+
+    // clockwork's STATE and PROPERTY messages, and the older STATE and
+    // VALUE text messages, are turned into events that are numbered,
+    // published to the ring and formatted by pipeline stages
+    Event event;
+    TextFormatter formatter(output, sample_format, false);
+    RingWriter ring_writer(event_ring);
+    Stage *last = &interner;
+    if (use_event_ring) {
+        last = &last->then(ring_writer);
+    }
+    if (trigger_capture) {
+        last = &last->then(*trigger_capture);
+    }
+    if (device_history) {
+        last = &last->then(*device_history);
+    }
+    last->then(formatter);
+    // after the other threads have started so that they are not pinned
+    if (options.lowLatency() || options.lockMemory() || options.fifoPriority() > 0) {
+        setupLowLatency(options);
+    }
     unsigned int retry_count = 3;
     for (;;) {
+        // a message found here is already waiting when checkConnections polls
+        uint64_t ready_us = 0;  // monotonic time at which a message was known to be waiting
+        if (options.lowLatency() && !current_channel.empty()) {
+            bool found = spinForMessage(subscription_manager.subscriber(), options.spinMicros());
+            if (found) {
+                ready_us = monotonic_us();
+            }
+            receive_counters.addSpin(found);
+        }
         zmq::pollitem_t items[] = {
             { subscription_manager.setup(), 0, ZMQ_POLLERR | ZMQ_POLLIN, 0 },
             { subscription_manager.subscriber(), 0, ZMQ_POLLERR | ZMQ_POLLIN, 0 },
@@ -784,8 +1129,12 @@ int main(int argc, const char *argv[])
             continue;
         }
         if (!(items[1].revents & ZMQ_POLLIN) || (items[1].revents & ZMQ_POLLERR)) {
+            interner.idle();
             continue;
         }
+        if (ready_us == 0) {
+            ready_us = monotonic_us();
+        }
 
         try {
             #if 0
@@ -799,18 +1148,24 @@ int main(int argc, const char *argv[])
             MessageHeader mh;
             char *data = 0;
             size_t len = 0;
+            struct timeval received;
             if (!safeRecv(subscription_manager.subscriber(), &data, &len, false, 1, mh)) {
                 std::cout << "failed to receive message\n";
+                gettimeofday(&received, 0);
+            }
+            else {
+                gettimeofday(&received, 0);
+                int64_t receive_us = (int64_t)(monotonic_us() - ready_us);
+                // a header without a send time says nothing about transport
+                int64_t transport_us = ((int64_t)received.tv_sec * 1000000 + received.tv_usec) - (int64_t)mh.start_time;
+                receive_counters.addMessage(receive_us, mh.start_time != 0, transport_us);
             }
             if (first_message_time == 0) {
                 first_message_time = mh.start_time;
             }
             #endif
 
-            long scale = 1;
-            if (options.reportMillis()) {
-                scale = 1000;
-            }
+            long scale = sample_format.scale;
 
             output.str("");
             output.clear();
@@ -819,41 +1174,13 @@ int main(int argc, const char *argv[])
             }
             else {
                 std::list<Value> *message = 0;
-                string machine, property, op, state;
-                Value val(SymbolTable::Null);
+                string op, state;
                 if (MessageEncoding::getCommand(data, op, &message)) {
                     if (message == nullptr) {
                         std::cerr << "unexpected empty parameter list for recieved message: " << op << "\n";
                     }
-                    else if (op == "STATE" && message->size() == 2) {
-                        machine = message->front().asString();
-                        message->pop_front();
-                        state = message->front().asString();
-                        int state_num = lookupState(state);
-                        map<string, int>::iterator idx = device_map.find(machine);
-                        if (idx == device_map.end()) { //new machine
-                            device_map[machine] = next_device_num++;
-                        }
-                        if (options.format() == "std") {
-                            timestamp(output, mh.start_time - first_message_time, scale, options.emitTimestamp(), options.dateFormat());
-                            output << "\t" << machine << "\t" << state << "\t" << state_num;
-                        }
-                        else if (options.format() == "kv") {
-                            output << "machine: " << machine << ", state: " << state << ", timestamp: ";
-                            timestamp(output, mh.start_time - first_message_time, scale, options.emitTimestamp(), options.dateFormat());
-                        }
-                        else if (options.format() == "kvq") {
-                            output << "\"machine\": \""
-                                    << machine << "\", \"state\": \""
-                                    << state << "\", \"timestamp\": ";
-                            if (options.emitTimestamp()) {
-                                output << "\"";
-                            }
-                            timestamp(output, mh.start_time - first_message_time, scale, options.emitTimestamp(), options.dateFormat());
-                            if (options.emitTimestamp()) {
-                                output << "\"";
-                            }
-                        }
+                    else if (decode_command(op, *message, mh.start_time - first_message_time, event)) {
+                        interner.process(event);
                     }
                     else if (op == "UPDATE") {
                         output << (mh.start_time - first_message_time) / scale;
@@ -866,95 +1193,42 @@ int main(int argc, const char *argv[])
                             }
                         }
                     }
-                    else if (op == "PROPERTY" && message->size() == 3) {
-                        std::string machine = message->front().asString();
-                        message->pop_front();
-                        std::string prop = message->front().asString();
-                        message->pop_front();
-                        property = machine + "." + prop;
-                        val = message->front();
-
-                        map<string, int>::iterator idx = device_map.find(property);
-                        if (idx == device_map.end()) { //new machine
-                            device_map[property] = next_device_num++;
-                        }
-
-                        std::string value_str;
-                        if (val.kind == Value::t_string) {
-                            value_str = "\"";
-                            value_str += escapeNonprintables(val.asString().c_str());
-                            value_str += "\"";
-                        }
-                        else {
-                            value_str = escapeNonprintables(val.asString().c_str());
-                        }
-
-                        if (options.format() == "std") {
-                            timestamp(output, mh.start_time - first_message_time, scale, options.emitTimestamp(), options.dateFormat());
-                            output << "\t" << property << "\tvalue\t" << value_str;
-                        }
-                        else if (options.format() == "kv") {
-                            output << "machine: " << machine << ", " << prop << ": " << value_str << ", timestamp: ";
-                            timestamp(output, mh.start_time - first_message_time, scale, options.emitTimestamp(), options.dateFormat());
-                        }
-                        else if (options.format() == "kvq") {
-                            output << "\"machine\": \""
-                                    << machine << "\", \"" << prop << "\": "
-                                    << value_str << ", \"timestamp\": ";
-                            if (options.emitTimestamp()) {
-                                output << "\"";
-                            }
-                            timestamp(output, mh.start_time - first_message_time, scale, options.emitTimestamp(), options.dateFormat());
-                            if (options.emitTimestamp()) {
-                                output << "\"";
-                            }
-                        }
-                    }
                     else {
                         std::cerr << "unexpected message " << op << " with " << (message != nullptr ? message->size() : 0) << " paramters\n";
                     }
                     delete message;
                 }
                 else {
-                    struct timeval now;
-                    gettimeofday(&now, 0);
                     istringstream iss(data);
                     std::string machine;
                     iss >> machine >> op;
+                    uint64_t offset = get_diff_in_microsecs(&received, &start);
                     if (op == "STATE") {
                         iss >> state;
-                        int state_num = lookupState(state);
-                        map<string, int>::iterator idx = device_map.find(machine);
-                        if (idx == device_map.end()) { //new machine
-                            device_map[machine] = next_device_num++;
-                        }
-
-                        output << get_diff_in_microsecs(&now, &start) / scale
-                                << "\t" << machine << "\t" << state << "\t" << state_num;
+                        event.setState(offset, machine, state);
+                        interner.process(event);
                     }
                     else if (op == "VALUE" && !options.ignoreValues()) {
-                        property = machine;
-                        map<string, int>::iterator idx = device_map.find(property);
-                        if (idx == device_map.end()) { //new machine
-                            device_map[property] = next_device_num++;
-                        }
-
+                        // a value of the machine itself rather than of a property
                         if (options.onlyNumericValues()) {
                             long val;
-                            if (outputNumeric(output, iss, val))
-                                output << get_diff_in_microsecs(&now, &start) / scale
-                                        << "\t" << property << "\tvalue\t" << val;
+                            if (outputNumeric(output, iss, val)) {
+                                event.setProperty(offset, machine, "", std::to_string(val));
+                                interner.process(event);
+                            }
                         }
                         else {
-                            std::string val(outputRemaining(output, iss));
-                            output << get_diff_in_microsecs(&now, &start) / scale
-                                    << "\t" << property << "\tvalue\t" << escapeNonprintables(val.c_str());
+                            event.setProperty(offset, machine, "", escapeNonprintables(outputRemaining(output, iss).c_str()));
+                            interner.process(event);
                         }
                     }
                 }
             }
             if (!output.str().empty()) {
-                if (!options.quietMode()) {
+                if (file_sink) {
+                    file_sink->write(output.str());
+                }
+                else if (!options.quietMode()) {
                     cout << output.str() << "\n" << flush;
                 }
                 if (options.publish()) {
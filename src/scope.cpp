@@ -6,171 +6,429 @@
 */
 
 #include <iostream>
-#include <iomanip>
 #include <fstream>
-#include <map>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
-
-long last_t = 0, t;
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/thread/thread.hpp>
+#include "column_store.h"
+#include "decimator.h"
+#include "event_queue.h"
+#include "line_io.h"
+#include "parse_number.h"
+#include "pipeline.h"
+#include "shm_ring.h"
+#include "terminal_renderer.h"
+#include "time_index.h"
 
 bool emit_state_names = false;
 bool emit_state_ids = true;
 bool square_wave = false;
 bool help = false;
 bool graph = false;
-bool only_show_changes = true;
+ScopeRows::Mode output_mode = ScopeRows::dense_rows;
+unsigned int frame_rate = 30;	// -g redraws per second on a terminal, 0 for a line per change
+TerminalRenderer *renderer = 0;
+Decimator *decimator = 0;	// -D: plot the whole input in a fixed number of rows
+long from_time = LONG_MIN;	// --from and --to, in ms, when reading a file
+long to_time = LONG_MAX;
 long min_y = 1000000;
 long max_y = -1000000;
 
-struct TimeSeriesGraph {
-	long min_value;
-	long max_value;
-	int screen_width;
-	char *row;
-	char *last_row;
-	std::map<std::string, long> series;
-	TimeSeriesGraph() : min_value(min_y), max_value(max_y), screen_width(140) {
-		row = new char[screen_width + 1];
-		memset(row, ' ', screen_width);
-		row[screen_width] = 0;
-		last_row = new char[screen_width + 1];
-		memset(last_row, ' ', screen_width);
-		last_row[screen_width] = 0;
+// the columns and the text output; -g replaces the output with a ScopeGraph
+ScopeRows rows(std::cout);
+
+void usage(const char *prog)
+{
+	std::cerr << "Usage: \n"
+	        << prog << " [options]\n"
+	        << " where options are any of: "
+	        << "  -S   emit state names\n"
+	        << "  -s   do not emit state names\n"
+	        << "  -I   emit state ids\n"
+	        << "  -i   do not emit state ids\n"
+	        << "  -R   synthesize a square wave display\n"
+	        << "  -r   do not synthesize a square wave\n"
+	        << "  -C   only write the columns that change, as label=value\n"
+	        << "  -L   write the runs of each column, as label start end value\n"
+	        << "  --vcd  write a value change dump for waveform viewers such as GTKWave\n"
+	        << "  --expand  convert the output of -C on stdin back to full rows (with -R)\n"
+	        << "  -h   show this help text\n"
+	        << "  -g   graphical output (adds -s and -i)\n"
+	        << "  -m val  minimum of the graph range\n"
+	        << "  -x val  maximum of the graph range\n"
+	        << "  -D rows plot the whole input in this many rows, showing the range\n"
+	        << "          of each series within each row (implies -g)\n"
+	        << "  -F hz   graph redraws per second when writing to a terminal (default 30),\n"
+	        << "          0 to write a line per change as when not writing to a terminal\n"
+	        << "  --shm name  read events from sampler's shared memory ring instead of stdin\n"
+	        << "  --from ms, --to ms  only report this part of a file given as an argument\n"
+	        ;
+}
+
+int read_ring(const char *name, Stage &view)
+{
+	ShmRing ring;
+	std::string error;
+	if (!ring.attach(name, error)) {
+		std::cerr << "error: " << error << "\n";
+		return 1;
+	}
+	RingEvent record;
+	Event event;
+	unsigned int idle = 0;
+	while (!ring.finished()) {
+		if (renderer && renderer->interrupted()) {
+			break;
+		}
+		if (!ring.next(record)) {
+			view.idle();
+			if (++idle > 1000) {
+				usleep(1000);
+			}
+			continue;
+		}
+		idle = 0;
+		event.setValue(record.time, record.name, record.name_len, record.text, record.text_len,
+				record.value, record.device_id);
+		event.numeric = record.numeric;
+		view.process(event);
 	}
-	void emit();
-	bool plot(long v, char symbol);
-	bool rescaleGraph(long val);
-};
+	return 0;
+}
+
+// a line of the form: time device state value. Lines that do not have a
+// numeric time and value (such as properties with text values) are
+// skipped.
+static bool parse_event(const char *line, size_t len, LineField *fields, long &event_time, double &value)
+{
+	return split_fields(line, len, fields, 4) == 4
+		&& parse_integer(fields[0].text, fields[0].len, event_time)
+		&& parse_number(fields[3].text, fields[3].len, value);
+}
 
+// input is parsed on its own thread and handed over in batches so that
+// reading keeps up while output is slow, and output is flushed only once
+// everything parsed so far has been dealt with
+EventQueue parsed_events(16);
+EventQueue spare_batches(32);
+std::atomic<bool> stop_parsing(false);
+bool input_failed = false;
 
-struct StateInfo {
-	std::string name;
-	int id;
-	StateInfo(const char *name_, int id_) : name(name_), id(id_) { }
-};
+static void send_batch(EventBatch *batch)
+{
+	while (!parsed_events.push(batch)) {
+		if (stop_parsing) {
+			delete batch;
+			return;
+		}
+		usleep(200);
+	}
+}
 
-typedef std::map<std::string, StateInfo> DeviceMap;
-DeviceMap device_map;
+static EventBatch *spare_batch()
+{
+	EventBatch *batch;
+	if (spare_batches.pop(batch)) {
+		batch->clear();
+		return batch;
+	}
+	return new EventBatch;
+}
 
-void emit()
+void parse_input()
 {
-	std::cout << last_t;
-	std::map<std::string, StateInfo>::iterator iter = device_map.begin();
-	while (iter != device_map.end()) {
-		if (emit_state_names) {
-			std::cout << "\t" << (*iter).second.name;
+	LineReader input(STDIN_FILENO);
+	LineField fields[4];
+	EventBatch *batch = spare_batch();
+	while (!stop_parsing) {
+		char *line;
+		size_t len;
+		LineReader::Status status = input.next(line, len);
+		if (status == LineReader::line_ready) {
+			long event_time;
+			double value;
+			if (parse_event(line, len, fields, event_time, value)) {
+				batch->add(event_time, fields[1].text, fields[1].len, fields[2].text, fields[2].len, value);
+				if (batch->full()) {
+					send_batch(batch);
+					batch = spare_batch();
+				}
+			}
+			continue;
+		}
+		if (status == LineReader::end_of_input) {
+			break;
+		}
+		if (!batch->events.empty()) {	// nothing is held back while waiting for input
+			send_batch(batch);
+			batch = spare_batch();
 		}
-		if (emit_state_ids) {
-			std::cout << "\t" << (*iter).second.id;
+		if (input.fill(100) == LineReader::read_error) {
+			perror("scope: read");
+			input_failed = true;
+			break;
 		}
-		iter++;
 	}
-	std::cout << "\n" << std::flush;
+	batch->last = true;
+	send_batch(batch);
 }
 
-void labels()
+int read_input(Stage &view)
 {
-	std::cout << "\"Time\"";
-	std::map<std::string, StateInfo>::iterator iter = device_map.begin();
-	while (iter != device_map.end()) {
-		if (emit_state_names) {
-			std::cout << "\t\"" << (*iter).first << ".state\"";
+	boost::thread parser(parse_input);
+	Event event;
+	for (;;) {
+		EventBatch *batch;
+		if (parsed_events.pop(batch)) {
+			for (size_t i = 0; i < batch->events.size(); ++i) {
+				const EventBatch::Event &e = batch->events[i];
+				event.setValue(e.time, batch->dev(e), e.dev_len, batch->state(e), e.state_len, e.value);
+				view.process(event);
+			}
+			bool last = batch->last;
+			if (!spare_batches.push(batch)) {
+				delete batch;
+			}
+			if (last) {
+				break;
+			}
+			continue;
 		}
-		if (emit_state_ids) {
-			std::cout << "\t\"" << (*iter).first << "\"";
+		view.idle();
+		int timeout = -1;
+		if (renderer) {
+			if (renderer->interrupted()) {
+				break;
+			}
+			timeout = renderer->timeout();
+			if (timeout < 0 || timeout > 100) {
+				timeout = 100;	// the signal may have gone to the parser
+			}
 		}
-		iter++;
+		parsed_events.wait(timeout);
 	}
-	std::cout << "\n" << std::flush;
+	stop_parsing = true;
+	parser.join();
+	return input_failed ? 1 : 0;
 }
 
-bool TimeSeriesGraph::rescaleGraph(long val)
+static size_t line_end(const char *data, size_t pos, size_t size)
 {
-	bool rescaled = false;
-	if (val > max_value) {
-		max_value = ((val > 0) ? 1.1f : 0.9f) * val;
-		rescaled = true;
-	}
-	if (val < min_value) {
-		min_value = ((val > 0) ? 0.9f : 1.1f) * val;
-		rescaled = true;
-	}
-	memset(last_row, ' ', screen_width);
-	return rescaled;
+	const char *nl = (const char *)memchr(data + pos, '\n', size - pos);
+	return nl ? nl - data : size;
 }
 
-bool TimeSeriesGraph::plot(long v, char symbol)
+// scan the whole log, recording the state of the columns every few MB
+static void build_index(const char *data, size_t size, int64_t mtime, TimeIndex &index)
 {
-	bool changed = false;
-	int col = (int)(0.95f * screen_width * (v - min_value) / (max_value - min_value));
-	if (col >= 0 && col < screen_width) {
-		if (last_row[col] == ' ') {
-			changed = true;
+	ColumnStore &columns = rows.columnStore();
+	index.reset(size, mtime, columns);
+	LineField fields[4];
+	size_t next_checkpoint = 0;
+	for (size_t pos = 0; pos < size; ) {
+		size_t end = line_end(data, pos, size);
+		long event_time;
+		double value;
+		if (parse_event(data + pos, end - pos, fields, event_time, value)) {
+			if (pos >= next_checkpoint) {
+				index.checkpoint(event_time, pos, columns);
+				next_checkpoint = pos + TimeIndex::checkpoint_bytes;
+			}
+			int col = columns.find(fields[1].text, fields[1].len);
+			if (col >= 0) {
+				columns.update(col, fields[2].text, fields[2].len, value);
+			}
 		}
-		row[ col ] = symbol;
-	}
-	else {
-		std::cout << " col: " << col << "\n";
+		pos = end + 1;
 	}
-	return changed;
 }
-void TimeSeriesGraph::emit()
+
+// reads a log by mapping it. With --from, reading starts at the nearest
+// checkpoint in the log's index, which is built the first time; the events
+// between there and the start time only update the columns.
+int read_file(const char *path, Stage &view)
 {
-	const char *symbols = "*@#%ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-	int max_sym = strlen(symbols) - 1;
-	if (max_value <= min_value) {
-		std::cout << "\n";
-		return;
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		std::cerr << "scope: cannot read " << path << ": " << strerror(errno) << "\n";
+		return 1;
 	}
-
-	std::map<std::string, long>::const_iterator iter = series.begin();
-	int symbol_idx = 0;
-	bool changed = false;
-	while (iter != series.end()) {
-		const std::pair<std::string, long> &pt = *iter++;
-		changed = plot(pt.second, symbols[symbol_idx]);
-		if (symbol_idx++ > max_sym) {
-			symbol_idx = max_sym;
+	size_t size = st.st_size;
+	if (size == 0) {
+		close(fd);
+		return 0;
+	}
+	const char *data = (const char *)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror("scope: mmap");
+		return 1;
+	}
+	LineField fields[4];
+	long event_time;
+	double value;
+	size_t pos = 0;
+	if (from_time != LONG_MIN) {
+		ColumnStore &columns = rows.columnStore();
+		TimeIndex index;
+		std::string index_path = std::string(path) + ".idx";
+		if (!index.load(index_path, size, st.st_mtime, columns)) {
+			build_index(data, size, st.st_mtime, index);
+			if (!index.save(index_path)) {
+				std::cerr << "scope: cannot save the index " << index_path << "\n";
+			}
+		}
+		int cp = index.find(from_time * 1000);
+		if (cp < 0 && index.size() > 0) {
+			cp = 0;
+		}
+		if (cp >= 0) {
+			index.restore(cp, columns);
+			pos = index.offset(cp);
+		}
+		for (; pos < size; ) {
+			size_t end = line_end(data, pos, size);
+			if (parse_event(data + pos, end - pos, fields, event_time, value)) {
+				if (event_time / 1000 >= from_time) {
+					break;
+				}
+				int col = columns.find(fields[1].text, fields[1].len);
+				if (col >= 0) {
+					columns.update(col, fields[2].text, fields[2].len, value);
+				}
+			}
+			pos = end + 1;
+		}
+		// the first row is the state at the start time
+		if (!graph) {
+			rows.startAt(from_time);
 		}
 	}
-	if (!only_show_changes || (only_show_changes && changed)) {
-		std::cout << std::setw(8) << last_t << " " << row << "\n";
-		memcpy(last_row, row, screen_width);
-		memset(row, ' ', screen_width);
-		if (min_value <= 0 && max_value >= 0) {
-			plot(0, '|');
-		}
-		for (long x = -30000; x <= 30000; x += 10000) {
-			if (min_value <= x && max_value >= x) {
-				plot(x, (x == 0) ? '|' : '!');
+	madvise((void *)data, size, MADV_SEQUENTIAL);
+	Event event;
+	for (; pos < size; ) {
+		size_t end = line_end(data, pos, size);
+		if (parse_event(data + pos, end - pos, fields, event_time, value)) {
+			if (event_time / 1000 > to_time) {
+				break;
 			}
+			event.setValue(event_time, fields[1].text, fields[1].len, fields[2].text, fields[2].len, value);
+			view.process(event);
 		}
+		pos = end + 1;
 	}
+	munmap((void *)data, size);
+	return 0;
 }
 
+// -C output is tab separated; find the field starting at p
+static const char *next_field(const char *p, const char *end, size_t &len)
+{
+	const char *tab = (const char *)memchr(p, '\t', end - p);
+	len = (tab ? tab : end) - p;
+	return tab ? tab + 1 : end;
+}
 
+static void write_row(long time, const std::vector<std::string> &values)
+{
+	std::cout << time;
+	for (size_t i = 0; i < values.size(); ++i) {
+		std::cout << "\t" << values[i];
+	}
+	std::cout << "\n";
+}
 
-void usage(const char *prog)
+// --expand: read the output of -C and write a row of every column for
+// each time at which something changed
+int expand_changes()
 {
-	std::cerr << "Usage: \n"
-	        << prog << " [options]\n"
-	        << " where options are any of: "
-	        << "  -S   emit state names\n"
-	        << "  -s   do not emit state names\n"
-	        << "  -I   emit state ids\n"
-	        << "  -i   do not emit state ids\n"
-	        << "  -R   synthesize a square wave display\n"
-	        << "  -r   do not synthesize a square wave\n"
-	        << "  -h   show this help text\n"
-	        << "  -g   graphical output (adds -s and -i)\n"
-	        << "  -m val  minimum of the graph range\n"
-	        << "  -x val  maximum of the graph range\n"
-	        ;
+	LineReader input(STDIN_FILENO);
+	ColumnStore labels;	// label to position in the header
+	std::vector<std::string> values;
+	bool have_header = false;
+	bool have_row = false;
+	long row_time = 0;
+	for (;;) {
+		char *line;
+		size_t len;
+		LineReader::Status status = input.next(line, len);
+		if (status == LineReader::need_input) {
+			std::cout.flush();
+			if (input.fill() == LineReader::read_error) {
+				perror("scope: read");
+				return 1;
+			}
+			continue;
+		}
+		if (status == LineReader::end_of_input) {
+			break;
+		}
+		const char *end = line + len;
+		size_t field_len;
+		if (!have_header) {
+			// "Time" followed by the quoted labels
+			have_header = true;
+			std::cout.write(line, len);
+			std::cout << "\n";
+			const char *p = next_field(line, end, field_len);
+			while (p < end) {
+				const char *field = p;
+				p = next_field(p, end, field_len);
+				if (field_len >= 2 && field[0] == '"' && field[field_len - 1] == '"') {
+					++field;
+					field_len -= 2;
+				}
+				std::string label(field, field_len);
+				labels.add(label, values.size());
+				bool is_state = field_len > 6 && label.compare(field_len - 6, 6, ".state") == 0;
+				values.push_back(is_state ? "" : "0");
+			}
+			continue;
+		}
+		const char *p = next_field(line, end, field_len);
+		long time;
+		if (!parse_integer(line, field_len, time)) {
+			std::cout.write(line, len);	// End of Scope
+			std::cout << "\n";
+			continue;
+		}
+		if (square_wave && have_row && time > row_time + 1) {
+			write_row(time - 1, values);
+		}
+		while (p < end) {
+			const char *field = p;
+			p = next_field(p, end, field_len);
+			const char *eq = (const char *)memchr(field, '=', field_len);
+			if (!eq) {
+				continue;
+			}
+			int col = labels.find(field, eq - field);
+			if (col >= 0) {
+				values[labels.deviceId(col)].assign(eq + 1, field + field_len - eq - 1);
+			}
+		}
+		write_row(time, values);
+		have_row = true;
+		row_time = time;
+	}
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
-	for (int i = 0; i < argc; ++i) {
+	const char *ring_name = 0;
+	const char *file_name = 0;
+	bool expand = false;
+	std::ios::sync_with_stdio(false);
+	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "-S") == 0) {
 			emit_state_names = true;
 		}
@@ -189,6 +447,18 @@ int main(int argc, char *argv[])
 		else if (strcmp(argv[i], "-r") == 0) {
 			square_wave = false;
 		}
+		else if (strcmp(argv[i], "-C") == 0) {
+			output_mode = ScopeRows::changed_columns;
+		}
+		else if (strcmp(argv[i], "-L") == 0) {
+			output_mode = ScopeRows::column_runs;
+		}
+		else if (strcmp(argv[i], "--vcd") == 0) {
+			output_mode = ScopeRows::value_change_dump;
+		}
+		else if (strcmp(argv[i], "--expand") == 0) {
+			expand = true;
+		}
 		else if (strcmp(argv[i], "-h") == 0) {
 			help = true;
 		}
@@ -211,6 +481,30 @@ int main(int argc, char *argv[])
 				max_y = x;
 			}
 		}
+		else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
+			long rows = strtol(argv[++i], 0, 10);
+			if (rows > 0) {
+				decimator = new Decimator(rows);
+				graph = true;
+				emit_state_ids = false;
+				emit_state_names = false;
+			}
+		}
+		else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc) {
+			frame_rate = strtoul(argv[++i], 0, 10);
+		}
+		else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+			ring_name = argv[++i];
+		}
+		else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+			from_time = strtol(argv[++i], 0, 10);
+		}
+		else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+			to_time = strtol(argv[++i], 0, 10);
+		}
+		else if (argv[i][0] != '-') {
+			file_name = argv[i];
+		}
 	}
 	if (help) {
 		usage(argv[0]);
@@ -219,6 +513,13 @@ int main(int argc, char *argv[])
 	if (!emit_state_names && !emit_state_ids) {
 		emit_state_ids = true;
 	}
+	if (expand) {
+		return expand_changes();
+	}
+	if ((from_time != LONG_MIN || to_time != LONG_MAX) && !file_name) {
+		std::cerr << "scope: --from and --to need a file to read\n";
+		return 1;
+	}
 
 	/*  prime the device list from a file. only devices listed there will
 	    be reported
@@ -233,48 +534,52 @@ int main(int argc, char *argv[])
 		device_file >> name >> id;
 
 		if (device_file.good()) {
-			device_map.insert(make_pair(name, StateInfo("", 0)));
+			rows.addColumn(name, id);
 		}
 	}
+	rows.setMode(output_mode);
+	rows.setFormat(emit_state_names, emit_state_ids);
+	rows.setSquareWave(square_wave);
 
-	TimeSeriesGraph g;
-
+	Stage *view = &rows;
+	ScopeGraph *graph_view = 0;
 	if (!graph) {
-		labels();
+		rows.start();
+	}
+	else if (decimator) {
+		graph_view = new ScopeGraph(*decimator, std::cout, min_y, max_y);
+	}
+	else if (frame_rate > 0 && isatty(STDOUT_FILENO)) {
+		renderer = new TerminalRenderer(STDOUT_FILENO, frame_rate, min_y, max_y);
+		renderer->start();
+		graph_view = new ScopeGraph(*renderer);
+	}
+	else {
+		graph_view = new ScopeGraph(std::cout, min_y, max_y);
+	}
+	if (graph_view) {
+		view = graph_view;
 	}
 
-	std::string dev, state;
-	double value;
-	std::cin >> t >> dev >> state >> value;
-	while (std::cin.good() && !std::cin.eof()) {
-		t = t / 1000; // we work in milliseconds
-
-		if (!graph) {
-			if (t != last_t) {
-				emit();
-				if (square_wave && t > last_t + 1) {
-					last_t = t - 1;
-					emit();
-				}
-				last_t = t;
-			}
-
-			DeviceMap::iterator di = device_map.find(dev);
-			if (di != device_map.end()) {
-				(*di).second.name = state;
-				(*di).second.id = value;
-			}
+	if (ring_name) {
+		if (read_ring(ring_name, *view) != 0) {
+			return 1;
 		}
-		else {
-			g.series[dev] = value;
-			if (g.rescaleGraph(value)) {
-				std::cout << "...\n";
-			}
-			g.emit();
+	}
+	else if (file_name) {
+		if (read_file(file_name, *view) != 0) {
+			return 1;
 		}
-		std::cin >> t >> dev >> state >> value;
-		last_t = t;
 	}
-	emit();
-	std::cout << "End of Scope\n";
+	else if (read_input(*view) != 0) {
+		return 1;
+	}
+	view->finish();
+	if (renderer) {
+		renderer->finish();
+		delete renderer;
+	}
+	delete graph_view;
+	delete decimator;
+	return 0;
 }
@@ -0,0 +1,251 @@
+/*
+    scope-pipeline subscribes to clockwork as sampler does and passes each
+    change straight through a filter to one of scope's views, in a single
+    process. No text is written or parsed between the stages.
+
+    usage: scope-pipeline [options]
+
+        --pattern p     keep changes matching p (repeatable, default all)
+        --format f      write sampler's std, kv or kvq lines (default)
+        --scope         write scope's dense rows for the devices listed in
+                        scope.dat or devices.dat
+        --graph         show scope's live terminal view of values
+*/
+
+#include <iostream>
+#include <fstream>
+#include <list>
+#include <string>
+#include <vector>
+#include <libgen.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <zmq.hpp>
+#include <Logger.h>
+#include <value.h>
+#include <MessageEncoding.h>
+#include <MessagingInterface.h>
+#include <ConnectionManager.h>
+#include <MessageHeader.h>
+#include "message_decoder.h"
+#include "pipeline.h"
+#include "terminal_renderer.h"
+
+namespace po = boost::program_options;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void interrupt_handler(int sig)
+{
+    stopping = 1;
+}
+
+struct PipelineOptions {
+    std::string subscribe_to_host;
+    int subscribe_to_port;
+    std::string channel_name;
+    int cw_port;
+    std::vector<std::string> patterns;
+    std::string output_format;
+    bool scope;
+    bool graph;
+    unsigned int frame_rate;
+
+    PipelineOptions() : subscribe_to_host("localhost"), subscribe_to_port(5556), channel_name("SAMPLER_CHANNEL"),
+        cw_port(5555), output_format("std"), scope(false), graph(false), frame_rate(30) {}
+
+    bool parseCommandLine(int argc, const char *argv[]);
+};
+
+bool PipelineOptions::parseCommandLine(int argc, const char *argv[])
+{
+    try {
+        po::options_description desc("Allowed options");
+        desc.add_options()
+        ("help", "produce help message")
+        ("subscribe", po::value<std::string>(), "host to subscribe to [localhost]")
+        ("subscribe-port", po::value<int>(), "port to subscribe to [5556]")
+        ("channel", po::value<std::string>(), "name of channel to use")
+        ("cw-port", po::value<int>(), "clockwork command port (5555)")
+        ("pattern", po::value<std::vector<std::string> >(), "keep only changes matching this pattern (repeatable)")
+        ("format", po::value<std::string>(), "select output format (std, kv, kvq)")
+        ("scope", "write scope's rows of device states")
+        ("graph", "show a live view of values on the terminal")
+        ("frame-rate", po::value<unsigned int>(), "redraws per second for --graph [30]")
+        ;
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+        if (vm.count("help")) {
+            std::cerr << desc << "\n";
+            return false;
+        }
+        if (vm.count("subscribe")) {
+            subscribe_to_host = vm["subscribe"].as<std::string>();
+        }
+        if (vm.count("subscribe-port")) {
+            subscribe_to_port = vm["subscribe-port"].as<int>();
+        }
+        if (vm.count("channel")) {
+            channel_name = vm["channel"].as<std::string>();
+        }
+        if (vm.count("cw-port")) {
+            cw_port = vm["cw-port"].as<int>();
+        }
+        if (vm.count("pattern")) {
+            patterns = vm["pattern"].as<std::vector<std::string> >();
+        }
+        if (vm.count("format")) {
+            output_format = vm["format"].as<std::string>();
+            if (output_format != "std" && output_format != "kv" && output_format != "kvq") {
+                std::cerr << "error: invalid output format '" << output_format << "'\n";
+                return false;
+            }
+        }
+        if (vm.count("scope")) {
+            scope = true;
+        }
+        if (vm.count("graph")) {
+            graph = true;
+        }
+        if (vm.count("frame-rate")) {
+            frame_rate = vm["frame-rate"].as<unsigned int>();
+        }
+        if (scope && graph) {
+            std::cerr << "error: choose one of --scope and --graph\n";
+            return false;
+        }
+    }
+    catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, const char *argv[])
+{
+    char *pn = strdup(argv[0]);
+    program_name = strdup(basename(pn));
+    free(pn);
+
+    PipelineOptions options;
+    if (!options.parseCommandLine(argc, argv)) {
+        return 1;
+    }
+    zmq::context_t context;
+    MessagingInterface::setContext(&context);
+
+    // build the chain: decoded events -> interner -> [filter] -> view
+    Interner interner;
+    Stage *last = &interner;
+    PatternFilter filter;
+    if (!options.patterns.empty()) {
+        for (size_t i = 0; i < options.patterns.size(); ++i) {
+            if (filter.add(options.patterns[i].c_str()) < 0) {
+                std::cerr << "error: unsupported pattern '" << options.patterns[i] << "'\n";
+                return 1;
+            }
+        }
+        last = &last->then(filter);
+    }
+
+    SampleFormat format;
+    format.format = options.output_format;
+    format.scale = 1000;
+    format.use_datetime = false;
+    format.date_format = "iso8601";
+    TextFormatter formatter(std::cout, format);
+    ScopeRows rows(std::cout);
+    TerminalRenderer *renderer = 0;
+    ScopeGraph *graph = 0;
+    if (options.scope) {
+        std::ifstream device_file("scope.dat");
+        if (!device_file.good()) {
+            device_file.open("devices.dat");
+        }
+        std::string name;
+        int id;
+        while (device_file >> name >> id) {
+            rows.addColumn(name, id);
+        }
+        rows.start();
+        last->then(rows);
+    }
+    else if (options.graph) {
+        renderer = new TerminalRenderer(STDOUT_FILENO, options.frame_rate, 1000000, -1000000);
+        renderer->start();
+        graph = new ScopeGraph(*renderer);
+        last->then(*graph);
+    }
+    else {
+        last->then(formatter);
+    }
+
+    signal(SIGINT, interrupt_handler);
+    signal(SIGTERM, interrupt_handler);
+
+    zmq::socket_t cmd(*MessagingInterface::getContext(), ZMQ_REP);
+    cmd.bind("inproc://remote_commands");
+    SubscriptionManager subscription_manager(options.channel_name.c_str(), eCLOCKWORK,
+            options.subscribe_to_host.c_str(), options.subscribe_to_port);
+    subscription_manager.configureSetupConnection(options.subscribe_to_host.c_str(), options.cw_port);
+
+    uint64_t first_message_time = 0;
+    Event event;
+    while (!stopping && !(renderer && renderer->interrupted())) {
+        zmq::pollitem_t items[] = {
+            { subscription_manager.setup(), 0, ZMQ_POLLERR | ZMQ_POLLIN, 0 },
+            { subscription_manager.subscriber(), 0, ZMQ_POLLERR | ZMQ_POLLIN, 0 },
+            { cmd, 0, ZMQ_POLLERR | ZMQ_POLLIN, 0 }
+        };
+        try {
+            if (!subscription_manager.checkConnections(items, 3, cmd)) {
+                interner.idle();
+                usleep(100000);
+                continue;
+            }
+        }
+        catch (const zmq::error_t &err) {
+            std::cerr << zmq_strerror(errno) << "\n";
+            if (zmq_errno() == EFSM) {
+                break;
+            }
+            continue;
+        }
+        if (!(items[1].revents & ZMQ_POLLIN) || (items[1].revents & ZMQ_POLLERR)) {
+            interner.idle();
+            continue;
+        }
+
+        MessageHeader mh;
+        char *data = 0;
+        size_t len = 0;
+        if (!safeRecv(subscription_manager.subscriber(), &data, &len, false, 1, mh)) {
+            continue;
+        }
+        if (first_message_time == 0) {
+            first_message_time = mh.start_time;
+        }
+        std::string op;
+        std::list<Value> *message = 0;
+        if (MessageEncoding::getCommand(data, op, &message) && message
+                && decode_command(op, *message, mh.start_time - first_message_time, event)) {
+            interner.process(event);
+        }
+        delete message;
+        delete[] data;
+    }
+
+    interner.finish();
+    if (renderer) {
+        renderer->finish();
+        delete graph;
+        delete renderer;
+    }
+    std::cout << std::flush;
+    return 0;
+}
@@ -0,0 +1,260 @@
+#include "shm_ring.h"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t ring_magic = 0x53524e47; // "SRNG"
+static const uint32_t ring_version = 2;
+
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t slot_count;
+    int32_t writer_pid;
+    char pad1[44];
+    std::atomic<uint64_t> head;     // sequence number of the next record to be written
+    char pad2[56];
+    std::atomic<uint32_t> closed;
+    char pad3[60];
+};
+
+struct ShmRingSlot {
+    std::atomic<uint64_t> seq;
+    RingEvent event;
+};
+
+void RingEvent::setName(const char *s, size_t len)
+{
+    if (len >= name_size) {
+        len = name_size - 1;
+    }
+    memcpy(name, s, len);
+    name[len] = 0;
+    name_len = (uint16_t)len;
+}
+
+void RingEvent::setText(const char *s, size_t len)
+{
+    if (len >= text_size) {
+        len = text_size - 1;
+    }
+    memcpy(text, s, len);
+    text[len] = 0;
+    text_len = (uint16_t)len;
+}
+
+ShmRing::ShmRing() : header(0), slots(0), mapped_size(0), cursor(0), lost_records(0), mask(0), writer(false)
+{}
+
+ShmRing::~ShmRing()
+{
+    unmap();
+}
+
+std::string ShmRing::normaliseName(const std::string &name)
+{
+    if (!name.empty() && name[0] == '/') {
+        return name;
+    }
+    return "/" + name;
+}
+
+void ShmRing::unmap()
+{
+    if (header) {
+        munmap(header, mapped_size);
+        header = 0;
+        slots = 0;
+    }
+}
+
+static bool process_running(pid_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+// a ring left under this name by an earlier writer is marked closed, so
+// readers still attached to it finish instead of waiting for it, and then
+// unlinked; the segment itself is never resized or reset because those
+// readers keep it mapped. A ring whose writer is still running is refused.
+static bool retire_ring(const std::string &shm_name, std::string &error)
+{
+    int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        error = "shm_open " + shm_name + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmRingHeader)) {
+        void *mem = mmap(0, sizeof(ShmRingHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem != MAP_FAILED) {
+            ShmRingHeader *old = (ShmRingHeader *)mem;
+            if (old->magic == ring_magic && old->version == ring_version
+                    && !old->closed.load(std::memory_order_acquire)
+                    && old->writer_pid != getpid() && process_running(old->writer_pid)) {
+                error = shm_name + " is in use by sampler process " + std::to_string(old->writer_pid);
+                munmap(mem, sizeof(ShmRingHeader));
+                ::close(fd);
+                return false;
+            }
+            if (old->magic == ring_magic) {
+                old->closed.store(1, std::memory_order_release);
+            }
+            munmap(mem, sizeof(ShmRingHeader));
+        }
+    }
+    ::close(fd);
+    if (shm_unlink(shm_name.c_str()) != 0 && errno != ENOENT) {
+        error = "shm_unlink " + shm_name + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool ShmRing::create(const std::string &name, uint32_t slot_count, std::string &error)
+{
+    uint32_t count = 64;
+    while (count < slot_count) {
+        count <<= 1;
+    }
+    shm_name = normaliseName(name);
+    if (!retire_ring(shm_name, error)) {
+        return false;
+    }
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        error = "shm_open " + shm_name + ": " + strerror(errno);
+        return false;
+    }
+    mapped_size = sizeof(ShmRingHeader) + (size_t)count * sizeof(ShmRingSlot);
+    if (ftruncate(fd, mapped_size) != 0) {
+        error = "ftruncate " + shm_name + ": " + strerror(errno);
+        ::close(fd);
+        shm_unlink(shm_name.c_str());
+        return false;
+    }
+    void *mem = mmap(0, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        error = "mmap " + shm_name + ": " + strerror(errno);
+        shm_unlink(shm_name.c_str());
+        return false;
+    }
+    header = (ShmRingHeader *)mem;
+    slots = (ShmRingSlot *)(header + 1);
+    mask = count - 1;
+    writer = true;
+
+    // the new segment is zero filled; readers ignore it until the magic
+    // number is in place
+    header->version = ring_version;
+    header->slot_size = sizeof(ShmRingSlot);
+    header->slot_count = count;
+    header->writer_pid = getpid();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    header->magic = ring_magic;
+    return true;
+}
+
+void ShmRing::publish(const RingEvent &event)
+{
+    uint64_t seq = header->head.load(std::memory_order_relaxed);
+    ShmRingSlot &slot = slots[seq & mask];
+    slot.seq.store(2 * seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&slot.event, &event, sizeof(RingEvent));
+    slot.seq.store(2 * seq + 2, std::memory_order_release);
+    header->head.store(seq + 1, std::memory_order_release);
+}
+
+void ShmRing::close()
+{
+    if (header && writer) {
+        // readers already attached keep the segment mapped until they finish
+        header->closed.store(1, std::memory_order_release);
+        shm_unlink(shm_name.c_str());
+        writer = false;
+    }
+}
+
+bool ShmRing::attach(const std::string &name, std::string &error, bool from_oldest)
+{
+    shm_name = normaliseName(name);
+    int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        error = "shm_open " + shm_name + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmRingHeader)) {
+        error = shm_name + " is not a sampler ring";
+        ::close(fd);
+        return false;
+    }
+    mapped_size = st.st_size;
+    void *mem = mmap(0, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        error = "mmap " + shm_name + ": " + strerror(errno);
+        return false;
+    }
+    header = (ShmRingHeader *)mem;
+    slots = (ShmRingSlot *)(header + 1);
+    if (header->magic != ring_magic || header->version != ring_version
+            || header->slot_size != sizeof(ShmRingSlot)
+            || mapped_size < sizeof(ShmRingHeader) + (size_t)header->slot_count * sizeof(ShmRingSlot)) {
+        error = shm_name + " is not a compatible sampler ring";
+        unmap();
+        return false;
+    }
+    mask = header->slot_count - 1;
+    writer = false;
+    cursor = header->head.load(std::memory_order_acquire);
+    if (from_oldest) {
+        cursor = (cursor > header->slot_count) ? cursor - header->slot_count : 0;
+    }
+    return true;
+}
+
+bool ShmRing::next(RingEvent &event)
+{
+    for (;;) {
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        if (cursor >= head) {
+            return false;
+        }
+        if (head - cursor > header->slot_count) {
+            lost_records += head - cursor - header->slot_count;
+            cursor = head - header->slot_count;
+        }
+        const ShmRingSlot &slot = slots[cursor & mask];
+        uint64_t expected = 2 * cursor + 2;
+        uint64_t before = slot.seq.load(std::memory_order_acquire);
+        if (before == expected) {
+            memcpy(&event, &slot.event, sizeof(RingEvent));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == expected) {
+                ++cursor;
+                return true;
+            }
+        }
+        // the writer has lapped us while we were reading this slot
+        ++lost_records;
+        ++cursor;
+    }
+}
+
+bool ShmRing::finished() const
+{
+    return header->closed.load(std::memory_order_acquire)
+            && cursor >= header->head.load(std::memory_order_acquire);
+}
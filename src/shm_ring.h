@@ -0,0 +1,88 @@
+#ifndef __shm_ring_h__
+#define __shm_ring_h__
+
+/*
+    A single writer, multiple reader ring of fixed size event records in
+    POSIX shared memory. Sampler publishes every state and property change
+    into the ring; scope and filter attach as readers, each keeping its own
+    cursor, so any number of local consumers can follow the stream without
+    additional zmq subscriptions or text re-parsing.
+
+    Each slot carries a sequence word that the writer makes odd while the
+    slot is being updated and sets to 2 * (sequence + 1) when the record is
+    complete. Readers copy the record and check the sequence word again, so
+    a reader that falls more than a ring's length behind detects that it
+    was overrun and skips forward instead of reading torn data. Neither side
+    makes a system call while records are flowing.
+
+    The writer creates a new segment each time and unlinks it when it
+    closes. A segment left by a writer that exited without closing is
+    marked closed before it is replaced, so its readers finish rather than
+    wait on a ring that will never be written again.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+enum RingEventKind {
+    ring_state = 1,
+    ring_property = 2
+};
+
+struct RingEvent {
+    enum { name_size = 104, text_size = 106 };
+    uint64_t time;          // microseconds since the first message, as used for sampler's offsets
+    uint64_t epoch_time;    // wall clock microseconds when the message was received
+    int32_t device_id;      // sampler's device number (see devices.dat)
+    int32_t state_id;       // state number for ring_state events, -1 otherwise
+    double value;           // state id or the numeric value of a property, 0 if not numeric
+    uint8_t kind;
+    uint8_t numeric;        // value holds a number
+    uint16_t name_len;
+    uint16_t text_len;
+    char name[name_size];   // machine or machine.property, nul terminated
+    char text[text_size];   // state name or formatted property value, nul terminated
+
+    void setName(const char *s, size_t len);
+    void setText(const char *s, size_t len);
+};
+
+struct ShmRingHeader;
+struct ShmRingSlot;
+
+class ShmRing {
+    public:
+        ShmRing();
+        ~ShmRing();
+
+        // writer side; fails if another running writer owns the name
+        bool create(const std::string &name, uint32_t slots, std::string &error);
+        void publish(const RingEvent &event);
+        void close();   // mark the stream finished so readers can exit, and unlink it
+
+        // reader side
+        bool attach(const std::string &name, std::string &error, bool from_oldest = false);
+        bool next(RingEvent &event);    // false when no new record is available
+        bool finished() const;          // writer has closed and all records were read
+        uint64_t lost() const { return lost_records; }
+
+        static std::string normaliseName(const std::string &name);
+
+    private:
+        void unmap();
+
+        ShmRingHeader *header;
+        ShmRingSlot *slots;
+        size_t mapped_size;
+        uint64_t cursor;
+        uint64_t lost_records;
+        uint32_t mask;
+        bool writer;
+        std::string shm_name;
+
+        ShmRing(const ShmRing &);
+        ShmRing &operator=(const ShmRing &);
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include "terminal_renderer.h"
+#include <algorithm>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+static volatile sig_atomic_t window_changed = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void note_resize(int)
+{
+    window_changed = 1;
+}
+
+static void note_stop(int)
+{
+    stop_requested = 1;
+}
+
+static uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static const char *symbols = "*@#%ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static const int label_width = 16;
+static const int value_width = 12;
+
+TerminalRenderer::TerminalRenderer(int fd, unsigned int frames_per_second, long min_value, long max_value)
+    : fd(fd), frame_ms(1000 / (frames_per_second ? frames_per_second : 1)), next_frame(0), started(false),
+      changed(false), time(0), events(0), min_value(min_value), max_value(max_value), rows(0), cols(0)
+{
+}
+
+TerminalRenderer::~TerminalRenderer()
+{
+    finish();
+}
+
+void TerminalRenderer::start()
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = note_resize;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, 0);
+    // no SA_RESTART, so that a blocking read returns to notice
+    sa.sa_handler = note_stop;
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    querySize();
+    started = true;
+    changed = true;
+    compose();
+    draw(true);
+}
+
+void TerminalRenderer::finish()
+{
+    if (!started) {
+        return;
+    }
+    started = false;
+    compose();
+    draw(false);
+    // leave the last frame on the screen
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "\x1b[%d;1H\n\x1b[?25h", rows);
+    ssize_t written = write(fd, buf, n);
+    (void)written;
+}
+
+bool TerminalRenderer::interrupted() const
+{
+    return stop_requested != 0;
+}
+
+void TerminalRenderer::querySize()
+{
+    struct winsize ws;
+    if (ioctl(fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+        rows = ws.ws_row;
+        cols = ws.ws_col;
+    }
+    else {
+        rows = 24;
+        cols = 140;
+    }
+    frame.assign(rows * cols, ' ');
+    shown.assign(rows * cols, ' ');
+}
+
+void TerminalRenderer::update(long t, const char *name, size_t len, double value)
+{
+    key.assign(name, len);
+    std::map<std::string, Series>::iterator found = series.find(key);
+    if (found == series.end()) {
+        Series s = { value };
+        series.insert(std::make_pair(key, s));
+    }
+    else {
+        found->second.value = value;
+    }
+    // the same widening of the range as TimeSeriesGraph::rescaleGraph
+    if (value > max_value) {
+        max_value = (long)(((value > 0) ? 1.1f : 0.9f) * value);
+    }
+    if (value < min_value) {
+        min_value = (long)(((value > 0) ? 0.9f : 1.1f) * value);
+    }
+    time = t;
+    ++events;
+    changed = true;
+}
+
+int TerminalRenderer::timeout() const
+{
+    if (!changed && !window_changed) {
+        return -1;
+    }
+    uint64_t now = monotonic_ms();
+    return now >= next_frame ? 0 : (int)(next_frame - now);
+}
+
+void TerminalRenderer::tick()
+{
+    if (!started) {
+        return;
+    }
+    bool everything = false;
+    if (window_changed) {
+        window_changed = 0;
+        querySize();
+        everything = true;
+    }
+    if (!changed && !everything) {
+        return;
+    }
+    uint64_t now = monotonic_ms();
+    if (!everything && now < next_frame) {
+        return;
+    }
+    compose();
+    draw(everything);
+    changed = false;
+    next_frame = now + frame_ms;
+}
+
+void TerminalRenderer::put(int row, int col, const char *text, size_t len)
+{
+    if (row < 0 || row >= rows || col >= cols) {
+        return;
+    }
+    // writing the bottom right corner would scroll the screen
+    int width = (row == rows - 1) ? cols - 1 : cols;
+    if (col >= width) {
+        return;
+    }
+    len = std::min(len, (size_t)(width - col));
+    memcpy(&frame[row * cols + col], text, len);
+}
+
+void TerminalRenderer::compose()
+{
+    std::fill(frame.begin(), frame.end(), ' ');
+    char buf[160];
+    int n = snprintf(buf, sizeof(buf), "t=%ld  series=%d  events=%llu  range %ld..%ld",
+        time, (int)series.size(), (unsigned long long)events, (long)min_value, (long)max_value);
+    put(0, 0, buf, n);
+
+    int track = label_width + 1 + value_width + 1;
+    int track_width = cols - track;
+    bool scaled = max_value > min_value && track_width >= 10;
+    std::vector<char> ruler(track_width > 0 ? track_width : 0, ' ');
+    if (scaled) {
+        for (long x = -30000; x <= 30000; x += 10000) {
+            if (min_value <= x && max_value >= x) {
+                ruler[(int)((track_width - 1) * (x - min_value) / (max_value - min_value))] = (x == 0) ? '|' : '!';
+            }
+        }
+        put(1, track, ruler.data(), ruler.size());
+    }
+
+    int row = 2;
+    int symbol_idx = 0;
+    int max_sym = strlen(symbols) - 1;
+    std::map<std::string, Series>::const_iterator iter = series.begin();
+    for (; iter != series.end() && row < rows; ++iter, ++row) {
+        if (row == rows - 1 && (int)series.size() > rows - 2) {
+            n = snprintf(buf, sizeof(buf), "... %d more", (int)series.size() - (rows - 3));
+            put(row, 0, buf, n);
+            break;
+        }
+        const Series &s = iter->second;
+        put(row, 0, iter->first.data(), std::min(iter->first.length(), (size_t)label_width));
+        n = snprintf(buf, sizeof(buf), "%*.6g", value_width, s.value);
+        put(row, label_width + 1, buf, n);
+        if (scaled) {
+            put(row, track, ruler.data(), ruler.size());
+            int pos = (int)((track_width - 1) * (s.value - min_value) / (max_value - min_value));
+            if (pos >= 0 && pos < track_width) {
+                put(row, track + pos, &symbols[symbol_idx], 1);
+            }
+        }
+        if (symbol_idx < max_sym) {
+            ++symbol_idx;
+        }
+    }
+}
+
+// write the parts of each row that differ from what is on the screen
+void TerminalRenderer::draw(bool everything)
+{
+    out.clear();
+    if (everything) {
+        out += "\x1b[?25l\x1b[H\x1b[2J";
+        std::fill(shown.begin(), shown.end(), ' ');
+    }
+    char move[32];
+    for (int row = 0; row < rows; ++row) {
+        const char *now = &frame[row * cols];
+        const char *before = &shown[row * cols];
+        int first = 0;
+        while (first < cols && now[first] == before[first]) {
+            ++first;
+        }
+        if (first == cols) {
+            continue;
+        }
+        int last = cols - 1;
+        while (now[last] == before[last]) {
+            --last;
+        }
+        int n = snprintf(move, sizeof(move), "\x1b[%d;%dH", row + 1, first + 1);
+        out.append(move, n);
+        out.append(now + first, last - first + 1);
+    }
+    shown = frame;
+    size_t done = 0;
+    while (done < out.length()) {
+        ssize_t n = write(fd, out.data() + done, out.length() - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef __terminal_renderer_h__
+#define __terminal_renderer_h__
+
+/*
+    A live view of scope's graph series for a terminal. Values are taken
+    in as fast as events arrive but the screen is only redrawn at a fixed
+    frame rate, and only the characters that differ from the previous
+    frame are written, using ANSI cursor addressing. The view follows the
+    size of the terminal (SIGWINCH).
+
+    Each series has a row showing its name, its latest value and a marker
+    positioned within the range of values seen so far.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class TerminalRenderer {
+    public:
+        TerminalRenderer(int fd, unsigned int frames_per_second, long min_value, long max_value);
+        ~TerminalRenderer();
+
+        // hide the cursor, clear the screen and catch SIGWINCH, SIGINT and SIGTERM
+        void start();
+        // draw the last frame, leave it on the screen and show the cursor
+        void finish();
+
+        void update(long time, const char *name, size_t len, double value);
+
+        // redraws if a frame is due
+        void tick();
+        // ms until the next frame is due, -1 if nothing has changed
+        int timeout() const;
+        // SIGINT or SIGTERM was received
+        bool interrupted() const;
+
+    private:
+        struct Series {
+            double value;
+        };
+
+        void querySize();
+        void compose();
+        void draw(bool everything);
+        void put(int row, int col, const char *text, size_t len);
+
+        int fd;
+        unsigned int frame_ms;
+        uint64_t next_frame;
+        bool started;
+        bool changed;
+        long time;
+        uint64_t events;
+        double min_value;
+        double max_value;
+        std::map<std::string, Series> series;
+        std::string key;        // reused for lookups
+        int rows;
+        int cols;
+        std::vector<char> frame;    // rows * cols
+        std::vector<char> shown;    // what is on the screen
+        std::string out;
+
+        TerminalRenderer(const TerminalRenderer &);
+        TerminalRenderer &operator=(const TerminalRenderer &);
+};
+
+#endif
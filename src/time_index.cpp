@@ -0,0 +1,146 @@
+#include "time_index.h"
+#include "column_store.h"
+#include <fstream>
+
+static const char *magic = "scope-index";
+static const int version = 2;
+
+TimeIndex::TimeIndex() : log_size(0), log_mtime(0)
+{
+}
+
+void TimeIndex::reset(uint64_t size, int64_t mtime, const ColumnStore &columns)
+{
+    log_size = size;
+    log_mtime = mtime;
+    names.clear();
+    for (size_t i = 0; i < columns.size(); ++i) {
+        names.push_back(columns.name(i));
+    }
+    entries.clear();
+    states.clear();
+    values.clear();
+}
+
+void TimeIndex::checkpoint(long time, uint64_t offset, const ColumnStore &columns)
+{
+    Entry entry = { time, offset };
+    entries.push_back(entry);
+    for (size_t i = 0; i < names.size(); ++i) {
+        states.push_back(columns.stateName(i));
+        values.push_back(columns.value(i));
+    }
+}
+
+int TimeIndex::find(long time) const
+{
+    size_t lo = 0;
+    size_t hi = entries.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].time <= time) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return (int)lo - 1;
+}
+
+void TimeIndex::restore(int cp, ColumnStore &columns) const
+{
+    size_t base = cp * names.size();
+    for (size_t i = 0; i < names.size(); ++i) {
+        int col = columns.find(names[i].data(), names[i].length());
+        if (col >= 0) {
+            const std::string &state = states[base + i];
+            columns.update(col, state.data(), state.length(), values[base + i]);
+        }
+    }
+}
+
+/*
+    scope-index 2 <log size> <log mtime> <columns> <entries>
+    one line per column name
+    per entry: a line with the time and offset, then a line of state value pairs
+*/
+
+bool TimeIndex::save(const std::string &path) const
+{
+    std::ofstream out(path.c_str());
+    if (!out) {
+        return false;
+    }
+    out.precision(17);
+    out << magic << " " << version << " " << log_size << " " << log_mtime << " "
+        << names.size() << " " << entries.size() << "\n";
+    for (size_t i = 0; i < names.size(); ++i) {
+        out << names[i] << "\n";
+    }
+    for (size_t e = 0; e < entries.size(); ++e) {
+        out << entries[e].time << " " << entries[e].offset << "\n";
+        size_t base = e * names.size();
+        for (size_t i = 0; i < names.size(); ++i) {
+            // an empty state name is written as - so the line splits evenly
+            out << (i ? "\t" : "") << (states[base + i].empty() ? "-" : states[base + i]) << "\t" << values[base + i];
+        }
+        out << "\n";
+    }
+    out.close();
+    return !out.fail();
+}
+
+bool TimeIndex::load(const std::string &path, uint64_t size, int64_t mtime, const ColumnStore &columns)
+{
+    std::ifstream in(path.c_str());
+    if (!in) {
+        return false;
+    }
+    std::string word;
+    int file_version;
+    uint64_t file_size;
+    int64_t file_mtime;
+    size_t column_count, entry_count;
+    in >> word >> file_version >> file_size >> file_mtime >> column_count >> entry_count;
+    if (!in || word != magic || file_version != version || file_size != size || file_mtime != mtime) {
+        return false;
+    }
+    std::string line;
+    std::getline(in, line);
+    names.resize(column_count);
+    for (size_t i = 0; i < column_count; ++i) {
+        std::getline(in, names[i]);
+    }
+    entries.resize(entry_count);
+    states.resize(entry_count * column_count);
+    values.resize(entry_count * column_count);
+    for (size_t e = 0; e < entry_count; ++e) {
+        in >> entries[e].time >> entries[e].offset;
+        size_t base = e * column_count;
+        for (size_t i = 0; i < column_count; ++i) {
+            in >> states[base + i] >> values[base + i];
+            if (states[base + i] == "-") {
+                states[base + i].clear();
+            }
+        }
+    }
+    if (!in) {
+        entries.clear();
+        return false;
+    }
+    // the state of a column the index does not have would not be restored
+    ColumnStore indexed;
+    for (size_t i = 0; i < column_count; ++i) {
+        indexed.add(names[i], i);
+    }
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (indexed.find(columns.name(i).data(), columns.name(i).length()) < 0) {
+            entries.clear();
+            return false;
+        }
+    }
+    log_size = size;
+    log_mtime = mtime;
+    return true;
+}
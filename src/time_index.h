@@ -0,0 +1,62 @@
+#ifndef __time_index_h__
+#define __time_index_h__
+
+/*
+    A sparse index of a sampler log so that scope can start part way
+    through it. Every few megabytes the index records the time and byte
+    offset of an event line together with a checkpoint of every column's
+    state just before that line, so that reading can start at the nearest
+    checkpoint instead of the beginning of the file.
+
+    The index is kept as text next to the log (log.idx) and records the
+    size and modification time of the log it was built from and the
+    columns it checkpoints; a log that has changed since, or a column
+    that has been added to scope.dat, means the log is indexed again.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class ColumnStore;
+
+class TimeIndex {
+    public:
+        enum { checkpoint_bytes = 4 * 1024 * 1024 };
+
+        TimeIndex();
+
+        // false if the file is missing, unreadable, for a different log or
+        // lacks any of the columns of the store
+        bool load(const std::string &path, uint64_t log_size, int64_t log_mtime, const ColumnStore &columns);
+        bool save(const std::string &path) const;
+
+        // start a new index of the given log for the columns of the store
+        void reset(uint64_t log_size, int64_t log_mtime, const ColumnStore &columns);
+        void checkpoint(long time, uint64_t offset, const ColumnStore &columns);
+
+        size_t size() const { return entries.size(); }
+        // the last checkpoint at or before time, -1 if there is none
+        int find(long time) const;
+        long time(int cp) const { return entries[cp].time; }
+        uint64_t offset(int cp) const { return entries[cp].offset; }
+        // set the columns of the store that are in the index to their
+        // state at the checkpoint
+        void restore(int cp, ColumnStore &columns) const;
+
+    private:
+        struct Entry {
+            long time;
+            uint64_t offset;
+        };
+
+        uint64_t log_size;
+        int64_t log_mtime;
+        std::vector<std::string> names;
+        std::vector<Entry> entries;
+        std::vector<std::string> states;    // entries * names
+        std::vector<double> values;
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "trigger_capture.h"
+#include <iostream>
+#include <fstream>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include "predicate.h"
+
+static uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// the event as a line in sampler's std format, times in milliseconds
+static void format_line(std::string &line, const RingEvent &event)
+{
+    char buf[32];
+    line.assign(buf, snprintf(buf, sizeof(buf), "%llu\t", (unsigned long long)(event.time / 1000)));
+    line.append(event.name, event.name_len);
+    if (event.kind == ring_state) {
+        line += '\t';
+        line.append(event.text, event.text_len);
+        line.append(buf, snprintf(buf, sizeof(buf), "\t%d", event.state_id));
+    }
+    else {
+        line += "\tvalue\t";
+        line.append(event.text, event.text_len);
+    }
+}
+
+TriggerCapture::Config::Config() : prefix("trigger"), slots(65536), pre_ms(5000), post_ms(5000), holdoff_ms(10000)
+{}
+
+TriggerCapture::TriggerCapture(const Config &config_) : config(config_), written(0), mask(0),
+    trigger(0), last_trigger(0), triggered(false), capture(0), capture_started(0),
+    pending(0), changed(false), captures(0), write_errors(0), running(false), stopping(false), sequence(0)
+{
+    uint32_t size = 1;
+    while (size < config.slots) {
+        size <<= 1;
+    }
+    history.resize(size);
+    mask = size - 1;
+}
+
+TriggerCapture::~TriggerCapture()
+{
+    stop();
+    delete trigger;
+    delete pending;
+}
+
+bool TriggerCapture::start(std::string &error)
+{
+    if (mkdir(config.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        error = "cannot create capture directory " + config.directory + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (stat(config.directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        error = config.directory + " is not a directory";
+        return false;
+    }
+    running = true;
+    writer = boost::thread(&TriggerCapture::run, this);
+    return true;
+}
+
+void TriggerCapture::stop()
+{
+    if (capture) {
+        complete();
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!running) {
+            return;
+        }
+        stopping = true;
+        work_ready.notify_one();
+    }
+    writer.join();
+    running = false;
+}
+
+bool TriggerCapture::setTrigger(const std::string &new_expression, std::string &error)
+{
+    Predicate *predicate = 0;
+    if (!new_expression.empty()) {
+        predicate = new Predicate;
+        if (!predicate->compile(new_expression, error)) {
+            delete predicate;
+            return false;
+        }
+    }
+    boost::unique_lock<boost::mutex> lock(mutex);
+    delete pending;
+    pending = predicate;
+    pending_expression = new_expression;
+    current_expression = new_expression;
+    changed = true;
+    return true;
+}
+
+std::string TriggerCapture::status()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    char buf[200];
+    snprintf(buf, sizeof(buf), "%llu captures (pre %ums, post %ums, holdoff %ums)",
+            (unsigned long long)captures, config.pre_ms, config.post_ms, config.holdoff_ms);
+    std::string result = current_expression.empty() ? "no trigger" : "trigger " + current_expression;
+    result += ", ";
+    result += buf;
+    if (write_errors) {
+        snprintf(buf, sizeof(buf), ", %llu not written", (unsigned long long)write_errors);
+        result += buf;
+    }
+    return result;
+}
+
+void TriggerCapture::process(Event &event)
+{
+    if (changed.load(std::memory_order_acquire)) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        delete trigger;
+        trigger = pending;
+        expression = pending_expression;
+        pending = 0;
+        changed = false;
+    }
+    if (capture && event.time > capture->trigger_time + config.post_ms * (uint64_t)1000) {
+        complete();
+    }
+
+    RingEvent &record = history[written++ & mask];
+    fill_ring_event(event, record);
+
+    if (capture) {
+        capture->events.push_back(record);
+    }
+    else if (trigger && (!triggered || event.time >= last_trigger + config.holdoff_ms * (uint64_t)1000)) {
+        format_line(line, record);
+        if (trigger->matches(line.data(), line.length())) {
+            fire(record);
+        }
+    }
+    pass(event);
+}
+
+void TriggerCapture::idle()
+{
+    if (capture && monotonic_ms() - capture_started >= config.post_ms) {
+        complete();
+    }
+    Stage::idle();
+}
+
+void TriggerCapture::finish()
+{
+    if (capture) {
+        complete();
+    }
+    Stage::finish();
+}
+
+void TriggerCapture::fire(const RingEvent &record)
+{
+    triggered = true;
+    last_trigger = record.time;
+    capture_started = monotonic_ms();
+    capture = new Capture;
+    capture->trigger_time = record.time;
+    capture->epoch_time = record.epoch_time;
+    capture->expression = expression;
+
+    // walk back from the trigger to the start of the pre-trigger period,
+    // then copy forwards
+    uint64_t available = written < history.size() ? written : history.size();
+    uint64_t first = written;
+    while (first > written - available) {
+        const RingEvent &earlier = history[(first - 1) & mask];
+        if (earlier.time + config.pre_ms * (uint64_t)1000 < record.time) {
+            break;
+        }
+        --first;
+    }
+    capture->events.reserve(written - first + 1024);
+    for (uint64_t i = first; i < written; ++i) {
+        capture->events.push_back(history[i & mask]);
+    }
+}
+
+void TriggerCapture::complete()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    ++captures;
+    completed.push_back(capture);
+    capture = 0;
+    work_ready.notify_one();
+}
+
+void TriggerCapture::run()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (;;) {
+        while (completed.empty() && !stopping) {
+            work_ready.wait(lock);
+        }
+        if (completed.empty()) {
+            break;
+        }
+        Capture *next = completed.front();
+        completed.pop_front();
+        lock.unlock();
+        write(next);
+        delete next;
+        lock.lock();
+    }
+}
+
+// called on the writer thread
+void TriggerCapture::write(Capture *capture)
+{
+    char stamp[40];
+    time_t when = capture->epoch_time / 1000000;
+    struct tm tm_when;
+    gmtime_r(&when, &tm_when);
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &tm_when);
+    char name[60];
+    snprintf(name, sizeof(name), "-%s-%06u.log", stamp, ++sequence);
+    std::string path = config.directory + "/" + config.prefix + name;
+
+    std::ofstream out(path.c_str());
+    std::string text;
+    for (size_t i = 0; out.good() && i < capture->events.size(); ++i) {
+        format_line(text, capture->events[i]);
+        out << text << "\n";
+    }
+    out.close();
+    if (out.fail()) {
+        std::cerr << "error writing " << path << ": " << strerror(errno) << "\n";
+        boost::unique_lock<boost::mutex> lock(mutex);
+        ++write_errors;
+    }
+    else {
+        std::cerr << "trigger " << capture->expression << ": " << capture->events.size()
+                << " events written to " << path << "\n";
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef __trigger_capture_h__
+#define __trigger_capture_h__
+
+/*
+    Triggered capture, as on an oscilloscope. Every event passing through
+    the stage is copied into a fixed size ring in memory. When an event
+    matches the trigger condition (a Predicate, see predicate.h) the events
+    of the preceding pre_ms are taken from the ring and the events of the
+    following post_ms are added to them; the capture is then written to a
+    file of its own by a separate thread, so sampling continues at full
+    rate. A trigger is ignored until holdoff_ms after the previous one.
+
+    Files are named <prefix>-<YYYYMMDDTHHMMSSZ>-<sequence>.log after the
+    time of the trigger and hold lines in sampler's std format with times
+    in milliseconds, so they can be read by filter and scope.
+
+    The condition can be changed from another thread with setTrigger().
+*/
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include "pipeline.h"
+#include "shm_ring.h"
+
+class Predicate;
+
+class TriggerCapture : public Stage {
+    public:
+        struct Config {
+            std::string directory;
+            std::string prefix;
+            uint32_t slots;             // events held for the pre-trigger period
+            unsigned int pre_ms;
+            unsigned int post_ms;
+            unsigned int holdoff_ms;    // from one trigger to the next
+            Config();
+        };
+
+        explicit TriggerCapture(const Config &config);
+        ~TriggerCapture();
+
+        bool start(std::string &error);
+        // writes any capture in progress and waits for the writer
+        void stop();
+
+        // an empty expression disarms the trigger; may be called from any thread
+        bool setTrigger(const std::string &expression, std::string &error);
+        std::string status();
+
+        void process(Event &event);
+        // completes a capture whose post-trigger period has passed
+        void idle();
+        void finish();
+
+    private:
+        struct Capture {
+            uint64_t trigger_time;      // event time of the trigger
+            uint64_t epoch_time;
+            std::string expression;
+            std::vector<RingEvent> events;
+        };
+
+        void fire(const RingEvent &trigger);
+        void complete();
+        void run();
+        void write(Capture *capture);
+
+        Config config;
+        std::vector<RingEvent> history;
+        uint64_t written;
+        uint32_t mask;
+        std::string line;           // the event in std format for the predicate
+
+        Predicate *trigger;         // owned by the sampling thread
+        std::string expression;
+        uint64_t last_trigger;
+        bool triggered;
+        Capture *capture;           // in progress
+        uint64_t capture_started;   // monotonic ms
+
+        boost::mutex mutex;         // protects the members below
+        boost::condition_variable work_ready;
+        Predicate *pending;         // set by setTrigger
+        std::string pending_expression;
+        std::atomic<bool> changed;
+        std::list<Capture *> completed;
+        std::string current_expression;
+        uint64_t captures;
+        uint64_t write_errors;
+        bool running;
+        bool stopping;
+        boost::thread writer;
+        unsigned int sequence;
+
+        TriggerCapture(const TriggerCapture &);
+        TriggerCapture &operator=(const TriggerCapture &);
+};
+
+#endif
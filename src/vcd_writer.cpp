@@ -0,0 +1,99 @@
+#include "vcd_writer.h"
+#include "column_store.h"
+#include <stdint.h>
+#include <stdio.h>
+
+VcdWriter::VcdWriter(std::ostream &out) : out(out), last_time(0), have_time(false)
+{
+}
+
+// identifier codes are strings of the printable characters ! to ~, the
+// first 94 signals get a single character
+std::string VcdWriter::code(size_t n)
+{
+    std::string result;
+    do {
+        result += (char)('!' + n % 94);
+        n /= 94;
+    } while (n > 0);
+    return result;
+}
+
+void VcdWriter::header(const ColumnStore &columns)
+{
+    codes.resize(columns.size());
+    real.resize(columns.size());
+    written.assign(columns.size(), 0);
+    out << "$version scope $end\n"
+        << "$timescale 1 ms $end\n"
+        << "$scope module scope $end\n";
+    for (size_t col = 0; col < columns.size(); ++col) {
+        codes[col] = code(col);
+        real[col] = columns.name(col).find('.') != std::string::npos;
+        if (real[col]) {
+            out << "$var real 64 " << codes[col] << " " << columns.name(col) << " $end\n";
+        }
+        else {
+            out << "$var integer 32 " << codes[col] << " " << columns.name(col) << " $end\n";
+        }
+    }
+    out << "$upscope $end\n"
+        << "$enddefinitions $end\n"
+        << "#0\n"
+        << "$dumpvars\n";
+    for (size_t col = 0; col < columns.size(); ++col) {
+        written[col] = real[col] ? columns.value(col) : columns.stateId(col);
+        writeValue(col, written[col]);
+    }
+    out << "$end\n";
+    have_time = true;
+}
+
+void VcdWriter::writeValue(size_t col, double value)
+{
+    char buf[40];
+    if (real[col]) {
+        snprintf(buf, sizeof(buf), "r%.16g ", value);
+        out << buf << codes[col] << "\n";
+        return;
+    }
+    uint32_t bits = (uint32_t)(int)value;
+    char *p = buf + sizeof(buf);
+    *--p = 0;
+    do {
+        *--p = '0' + (bits & 1);
+        bits >>= 1;
+    } while (bits);
+    out << 'b' << p << ' ' << codes[col] << "\n";
+}
+
+void VcdWriter::changes(long time, const ColumnStore &columns)
+{
+    if (time < last_time) {
+        time = last_time;   // markers must not go backwards
+    }
+    bool any = false;
+    for (int col = columns.nextDirty(-1); col >= 0; col = columns.nextDirty(col)) {
+        double value = real[col] ? columns.value(col) : columns.stateId(col);
+        if (value == written[col]) {
+            continue;
+        }
+        if (!any && (!have_time || time != last_time)) {
+            out << "#" << time << "\n";
+            last_time = time;
+            have_time = true;
+        }
+        any = true;
+        written[col] = value;
+        writeValue(col, value);
+    }
+}
+
+void VcdWriter::finish(long time)
+{
+    if (!have_time || time > last_time) {
+        out << "#" << time << "\n";
+        last_time = time;
+        have_time = true;
+    }
+}
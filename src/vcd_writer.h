@@ -0,0 +1,45 @@
+#ifndef __vcd_writer_h__
+#define __vcd_writer_h__
+
+/*
+    Writes scope's columns as a Value Change Dump (IEEE 1364) that
+    waveform viewers such as GTKWave can load. Each column is one signal
+    with a short identifier code: device columns are integers holding the
+    state id, and property columns (named machine.property by sampler)
+    are reals. Only values that changed are written, after a #time marker
+    in milliseconds.
+*/
+
+#include <stddef.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class ColumnStore;
+
+class VcdWriter {
+    public:
+        explicit VcdWriter(std::ostream &out);
+
+        // declarations and the initial value of every column
+        void header(const ColumnStore &columns);
+        // the changed (dirty) columns whose value differs from the last one written
+        void changes(long time, const ColumnStore &columns);
+        // a final time marker so that viewers show the last values
+        void finish(long time);
+
+        // the identifier code of the nth signal
+        static std::string code(size_t n);
+
+    private:
+        void writeValue(size_t col, double value);
+
+        std::ostream &out;
+        std::vector<std::string> codes;
+        std::vector<bool> real;
+        std::vector<double> written;
+        long last_time;
+        bool have_time;
+};
+
+#endif